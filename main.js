@@ -9,7 +9,7 @@ END_intro_wasm`;
 const VISUAL_SHADER = `BEGIN_visual_wgsl
 END_visual_wgsl`;
 
-const bufType = { GLB: 0, BVH: 1, IDX: 2, OBJ: 3, SHP: 4, MAT: 5, ACC: 6, IMG: 7 };
+const bufType = { GLB: 0, BVH: 1, OBJ: 2, SHP: 3, MAT: 4, ACC: 5, IMG: 6 };
 
 let canvas, context, device;
 let wa, res = {};
@@ -45,19 +45,12 @@ function Wasm(module)
     log_buf: (addr, len) => {
       let s = "";
       for(let i=0; i<len; i++)
-        s += String.fromCharCode(this.memUint8[addr + i]);
+        s += String.fromCharCode(this.getMem()[addr + i]);
       console.log(s);
     },
     time: () => performance.now(),
-    sqrtf: (v) => Math.sqrt(v),
-    sinf: (v) => Math.sin(v),
-    cosf: (v) => Math.cos(v),
-    tanf: (v) => Math.tan(v),
-    acosf: (v) => Math.acos(v),
-    atan2f: (y, x) => Math.atan2(y, x),
-    powf: (b, e) => Math.pow(b, e),
-    gpu_create_res: (g, b, i, o, s, m) => createGpuResources(g, b, i, o, s, m),
-    gpu_write_buf: (id, ofs, addr, sz) => device.queue.writeBuffer(res.buf[id], ofs, wa.memUint8, addr, sz)
+    gpu_create_res: (g, b, o, s, m) => createGpuResources(g, b, o, s, m),
+    gpu_write_buf: (id, ofs, addr, sz) => device.queue.writeBuffer(res.buf[id], ofs, wa.getMem(), addr, sz)
   };
 
   this.instantiate = async function()
@@ -66,6 +59,14 @@ function Wasm(module)
     Object.assign(this, res.instance.exports);
     this.memUint8 = new Uint8Array(this.memory.buffer);
   }
+
+  // memory.grow replaces the buffer of the wasm memory
+  this.getMem = function()
+  {
+    if(this.memUint8.buffer !== this.memory.buffer)
+      this.memUint8 = new Uint8Array(this.memory.buffer);
+    return this.memUint8;
+  }
 }
 
 function createComputePipeline(shaderModule, pipelineLayout, entryPoint)
@@ -115,7 +116,7 @@ function encodeRenderPassAndSubmit(commandEncoder, pipeline, bindGroup, renderPa
   passEncoder.end();
 }
 
-function createGpuResources(globalsSize, bvhSize, indicesSize, objsSize, shapesSize, matsSize)
+function createGpuResources(globalsSize, bvhSize, objsSize, shapesSize, matsSize)
 {
   res.buf = [];
 
@@ -129,11 +130,6 @@ function createGpuResources(globalsSize, bvhSize, indicesSize, objsSize, shapesS
     usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_DST
   });
 
-  res.buf[bufType.IDX] = device.createBuffer({
-    size: indicesSize,
-    usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_DST
-  });
-
   res.buf[bufType.OBJ] = device.createBuffer({
     size: objsSize,
     usage: GPUBufferUsage.STORAGE | GPUBufferUsage.COPY_DST
@@ -167,9 +163,6 @@ function createGpuResources(globalsSize, bvhSize, indicesSize, objsSize, shapesS
       { binding: bufType.BVH,
         visibility: GPUShaderStage.COMPUTE,
         buffer: { type: "read-only-storage" } },
-      { binding: bufType.IDX,
-        visibility: GPUShaderStage.COMPUTE,
-        buffer: { type: "read-only-storage" } },
       { binding: bufType.OBJ,
         visibility: GPUShaderStage.COMPUTE,
         buffer: { type: "read-only-storage" } },
@@ -193,7 +186,6 @@ function createGpuResources(globalsSize, bvhSize, indicesSize, objsSize, shapesS
     entries: [
       { binding: bufType.GLB, resource: { buffer: res.buf[bufType.GLB] } },
       { binding: bufType.BVH, resource: { buffer: res.buf[bufType.BVH] } },
-      { binding: bufType.IDX, resource: { buffer: res.buf[bufType.IDX] } },
       { binding: bufType.OBJ, resource: { buffer: res.buf[bufType.OBJ] } },
       { binding: bufType.SHP, resource: { buffer: res.buf[bufType.SHP] } },
       { binding: bufType.MAT, resource: { buffer: res.buf[bufType.MAT] } },
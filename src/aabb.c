@@ -1,6 +1,7 @@
 #include "aabb.h"
 #include <float.h>
 #include "mutil.h"
+#include "vec4.h"
 
 aabb aabb_init()
 {
@@ -12,13 +13,16 @@ aabb aabb_init()
 
 aabb aabb_combine(aabb a, aabb b)
 {
-  return (aabb){ vec3_min(a.min, b.min), vec3_max(a.max, b.max) };
+  return (aabb){
+    vec4_to_vec3(vec4_min(vec4_from_vec3(a.min), vec4_from_vec3(b.min))),
+    vec4_to_vec3(vec4_max(vec4_from_vec3(a.max), vec4_from_vec3(b.max))) };
 }
 
 void aabb_grow(aabb *a, vec3 v)
 {
-  a->min = vec3_min(a->min, v);
-  a->max = vec3_max(a->max, v);
+  vec4 v4 = vec4_from_vec3(v);
+  a->min = vec4_to_vec3(vec4_min(vec4_from_vec3(a->min), v4));
+  a->max = vec4_to_vec3(vec4_max(vec4_from_vec3(a->max), v4));
 }
 
 void aabb_pad(aabb *a)
@@ -35,6 +39,5 @@ void aabb_pad(aabb *a)
 
 float aabb_calc_area(aabb a)
 {
-  vec3 d = vec3_sub(a.max, a.min);
-  return d.x * d.y + d.y * d.z + d.z * d.x;
+  return vec4_calc_area(vec4_from_vec3(a.min), vec4_from_vec3(a.max));
 }
@@ -1,26 +1,17 @@
 #include "bvh.h"
 #include <float.h>
+#include <stdbool.h>
 #include "sutil.h"
 #include "mutil.h"
 #include "scn.h"
 #include "obj.h"
 #include "shape.h"
+#include "ray.h"
 #include "log.h"
+#include "sort.h"
+#include "bvh_int.h"
 
-#define INTERVAL_CNT 8
-
-typedef struct interval {
-  aabb    aabb;
-  size_t  cnt;
-} interval;
-
-typedef struct split {
-  float   cost;
-  float   pos;
-  uint8_t axis;
-} split;
-
-aabb get_obj_aabb(const bvh * b, const scn *s, size_t idx)
+aabb get_obj_aabb(const bvh *b, const scn *s, size_t idx)
 {
   obj *o = scn_get_obj(s, b->indices[idx]);
   switch(o->shape_type) {
@@ -28,6 +19,7 @@ aabb get_obj_aabb(const bvh * b, const scn *s, size_t idx)
       return sphere_get_aabb((sphere *)scn_get_shape(s, o->shape_ofs));
       break;
     case QUAD:
+    case QUAD_BAKED: // Starts like a quad
       return quad_get_aabb((quad *)scn_get_shape(s, o->shape_ofs));
       break;
     default:
@@ -45,6 +37,7 @@ vec3 get_obj_center(const bvh *b, const scn *s, size_t idx)
       return ((sphere *)scn_get_shape(s, o->shape_ofs))->center;
       break;
     case QUAD:
+    case QUAD_BAKED:
       return quad_get_center((quad *)scn_get_shape(s, o->shape_ofs));
       break;
    default:
@@ -54,62 +47,265 @@ vec3 get_obj_center(const bvh *b, const scn *s, size_t idx)
   }
 }
 
-split find_best_cost_interval_split(const bvh *b, const scn *s, bvh_node *n)
+void set_prim(prim_cache *c, size_t i, vec3 center, aabb box)
 {
-  split best = { .cost = FLT_MAX };
+  c->center[0][i] = center.x;
+  c->center[1][i] = center.y;
+  c->center[2][i] = center.z;
+  c->bounds[2 * i] = vec4_from_vec3(box.min);
+  c->bounds[2 * i + 1] = vec4_from_vec3(box.max);
+}
+
+aabb get_prim_aabb(const prim_cache *c, size_t i)
+{
+  return (aabb){
+    vec4_to_vec3(c->bounds[2 * i]), vec4_to_vec3(c->bounds[2 * i + 1]) };
+}
+
+sweep *init_sweep(size_t cnt)
+{
+  sweep *sw = malloc(sizeof(*sw));
+  for(uint8_t a=0; a<3; a++)
+    sw->sorted[a] = malloc(cnt * sizeof(*sw->sorted[a]));
+  sw->centers = malloc(cnt * sizeof(*sw->centers));
+  sw->boxes = malloc(cnt * sizeof(*sw->boxes));
+  sw->areas_r = malloc(cnt * sizeof(*sw->areas_r));
+  sw->tmp = malloc(cnt * sizeof(*sw->tmp));
+  sw->left = malloc(cnt * sizeof(*sw->left));
+  return sw;
+}
+
+void presort_sweep(sweep *sw, const bvh *b, size_t cnt)
+{
+  uint32_t *tmp_keys = malloc(2 * cnt * sizeof(*tmp_keys));
+  uint32_t *tmp_vals = tmp_keys + cnt;
+  for(uint8_t a=0; a<3; a++) {
+    for(size_t i=0; i<cnt; i++) {
+      uint32_t id = b->indices[i];
+      sw->tmp[i] = sort_float_key(vec3_get(sw->centers[id], a));
+      sw->sorted[a][i] = id;
+    }
+    sort_radix(sw->tmp, sw->sorted[a], tmp_keys, tmp_vals, cnt);
+  }
+  free(tmp_keys);
+}
+
+void alloc_prim_cache(prim_cache *c, size_t cap)
+{
+  float *buf = malloc(3 * cap * sizeof(*buf));
+  for(uint8_t a=0; a<3; a++)
+    c->center[a] = buf + a * cap;
+  c->bounds = malloc(2 * cap * sizeof(*c->bounds));
+}
+
+void init_prim_cache(prim_cache *c, const bvh *b, const scn *s,
+    const aabb *boxes, size_t cnt)
+{
+  alloc_prim_cache(c, cnt);
+
+  c->sweep = b->opts.full_sweep ? init_sweep(b->obj_cnt) : NULL;
+  c->scn = b->opts.typed_leaves ? s : NULL;
+
+  for(size_t i=0; i<cnt; i++) {
+    vec3 center;
+    aabb box;
+    if(boxes) {
+      box = boxes[b->indices[i]];
+      center = vec3_scale(vec3_add(box.min, box.max), 0.5f);
+    } else {
+      center = get_obj_center(b, s, i);
+      box = get_obj_aabb(b, s, i);
+    }
+    set_prim(c, i, center, box);
+    if(c->sweep) {
+      c->sweep->centers[b->indices[i]] = center;
+      c->sweep->boxes[b->indices[i]] = box;
+    }
+  }
+
+  if(c->sweep)
+    presort_sweep(c->sweep, b, cnt);
+}
+
+void release_prim_cache(prim_cache *c)
+{
+  free(c->center[0]);
+  free(c->bounds);
+  if(c->sweep) {
+    sweep *sw = c->sweep;
+    for(uint8_t a=0; a<3; a++)
+      free(sw->sorted[a]);
+    free(sw->centers);
+    free(sw->boxes);
+    free(sw->areas_r);
+    free(sw->tmp);
+    free(sw->left);
+    free(sw);
+  }
+}
+
+void grow_by_prim(aabb *a, const prim_cache *c, size_t i)
+{
+  a->min = vec4_to_vec3(
+      vec4_min(vec4_from_vec3(a->min), c->bounds[2 * i]));
+  a->max = vec4_to_vec3(
+      vec4_max(vec4_from_vec3(a->max), c->bounds[2 * i + 1]));
+}
+
+void swap_prims(bvh *b, prim_cache *c, size_t i, size_t j)
+{
+  uint32_t t = b->indices[i];
+  b->indices[i] = b->indices[j];
+  b->indices[j] = t;
+
+  for(uint8_t a=0; a<3; a++) {
+    float f = c->center[a][i];
+    c->center[a][i] = c->center[a][j];
+    c->center[a][j] = f;
+  }
+
+  for(uint8_t k=0; k<2; k++) {
+    vec4 v = c->bounds[2 * i + k];
+    c->bounds[2 * i + k] = c->bounds[2 * j + k];
+    c->bounds[2 * j + k] = v;
+  }
+}
+
+aabb calc_center_bounds(const prim_cache *c, size_t start, size_t cnt)
+{
+  float minc[3];
+  float maxc[3];
   for(uint8_t axis=0; axis<3; axis++) {
-    // Calculate bounds of object centers
-    float minc = FLT_MAX;
-    float maxc = -FLT_MAX;
-    for(size_t i=0; i<n->obj_cnt; i++) {
-      float c = vec3_get(get_obj_center(b, s, n->start_idx + i), axis);
-      minc = min(minc, c);
-      maxc = max(maxc, c);
+    const float *centers = c->center[axis] + start;
+    minc[axis] = FLT_MAX;
+    maxc[axis] = -FLT_MAX;
+    for(size_t i=0; i<cnt; i++) {
+      minc[axis] = min(minc[axis], centers[i]);
+      maxc[axis] = max(maxc[axis], centers[i]);
+    }
+  }
+
+  return (aabb){
+    (vec3){ minc[0], minc[1], minc[2] }, (vec3){ maxc[0], maxc[1], maxc[2] } };
+}
+
+void init_intervals(interval_set *is, uint32_t cnt)
+{
+  is->cnt = cnt;
+  vec4 mi = vec4_set1(FLT_MAX);
+  vec4 ma = vec4_set1(-FLT_MAX);
+  for(uint8_t axis=0; axis<3; axis++)
+    for(size_t i=0; i<cnt; i++)
+      is->intervals[axis][i] = (interval){ mi, ma, 0 };
+}
+
+// Grows the interval of each axis by the bounds of object i
+static void bin_prim(interval_set *is, const prim_cache *c, size_t i,
+    const int32_t *int_idx)
+{
+  vec4 mi = c->bounds[2 * i];
+  vec4 ma = c->bounds[2 * i + 1];
+  for(uint8_t axis=0; axis<3; axis++) {
+    interval *iv = &is->intervals[axis][int_idx[axis]];
+    iv->min = vec4_min(iv->min, mi);
+    iv->max = vec4_max(iv->max, ma);
+    iv->cnt++;
+  }
+}
+
+void bin_prims(interval_set *is, const prim_cache *c, size_t start,
+    size_t cnt, aabb center_bounds)
+{
+  // Intervals of flat axes are filled, but not used by the split search
+  float minc[3];
+  float delta[3];
+  for(uint8_t axis=0; axis<3; axis++) {
+    minc[axis] = vec3_get(center_bounds.min, axis);
+    float maxc = vec3_get(center_bounds.max, axis);
+    delta[axis] = (fabsf(maxc - minc[axis]) < EPSILON) ?
+      0.0f : is->cnt / (maxc - minc[axis]);
+  }
+
+  // Interval indices of 4 objects per axis at a time from the SoA centers,
+  // then count the objects per interval and find their combined bounds
+  vec4 last = vec4_set1(is->cnt - 1);
+  size_t i = 0;
+  for(; i + 4 <= cnt; i += 4) {
+    int32_t int_idx[3][4];
+    for(uint8_t axis=0; axis<3; axis++) {
+      vec4 t = vec4_mul(vec4_sub(vec4_load(c->center[axis] + start + i),
+            vec4_set1(minc[axis])), vec4_set1(delta[axis]));
+      vec4_store_int(int_idx[axis], vec4_min(last, t));
     }
+    for(uint8_t k=0; k<4; k++)
+      bin_prim(is, c, start + i + k,
+          (int32_t[3]){ int_idx[0][k], int_idx[1][k], int_idx[2][k] });
+  }
+
+  for(; i<cnt; i++) {
+    int32_t int_idx[3];
+    for(uint8_t axis=0; axis<3; axis++)
+      int_idx[axis] = (int32_t)min(is->cnt - 1,
+          (c->center[axis][start + i] - minc[axis]) * delta[axis]);
+    bin_prim(is, c, start + i, int_idx);
+  }
+}
+
+void merge_intervals(interval_set *dst, const interval_set *src)
+{
+  for(uint8_t axis=0; axis<3; axis++) {
+    for(size_t i=0; i<dst->cnt; i++) {
+      interval *d = &dst->intervals[axis][i];
+      const interval *s = &src->intervals[axis][i];
+      d->min = vec4_min(d->min, s->min);
+      d->max = vec4_max(d->max, s->max);
+      d->cnt += s->cnt;
+    }
+  }
+}
+
+split find_best_interval_split(const interval_set *is, aabb center_bounds)
+{
+  split best = { .cost = FLT_MAX };
+  for(uint8_t axis=0; axis<3; axis++) {
+    float minc = vec3_get(center_bounds.min, axis);
+    float maxc = vec3_get(center_bounds.max, axis);
     if(fabsf(maxc - minc) < EPSILON)
       continue;
-    
-    // Initialize empty intervals
-    interval intervals[INTERVAL_CNT];
-    for(size_t i=0; i<INTERVAL_CNT; i++)
-      intervals[i] = (interval){ aabb_init(), 0 };
-
-    // Count objects per interval and find their combined bounds
-    float delta = INTERVAL_CNT / (maxc - minc);
-    for(size_t i=0; i<n->obj_cnt; i++) {
-      vec3 center = get_obj_center(b, s, n->start_idx + i);
-      size_t int_idx =
-        (size_t)min(INTERVAL_CNT - 1, (vec3_get(center, axis) - minc) * delta);
-      intervals[int_idx].aabb = aabb_combine(
-          intervals[int_idx].aabb, get_obj_aabb(b, s, n->start_idx + i));
-      intervals[int_idx].cnt++;
-    }
 
     // Calculate left/right area and count for each plane separating the intervals
-    float areas_l[INTERVAL_CNT - 1];
-    float areas_r[INTERVAL_CNT - 1];
-    size_t cnts_l[INTERVAL_CNT - 1];
-    size_t cnts_r[INTERVAL_CNT - 1];
-    aabb aabb_l = aabb_init();
-    aabb aabb_r = aabb_init();
+    const interval *intervals = is->intervals[axis];
+    uint32_t cnt = is->cnt;
+    float areas_l[BVH_MAX_INTERVALS - 1];
+    float areas_r[BVH_MAX_INTERVALS - 1];
+    size_t cnts_l[BVH_MAX_INTERVALS - 1];
+    size_t cnts_r[BVH_MAX_INTERVALS - 1];
+    vec4 min_l = vec4_set1(FLT_MAX);
+    vec4 max_l = vec4_set1(-FLT_MAX);
+    vec4 min_r = min_l;
+    vec4 max_r = max_l;
     size_t total_cnt_l = 0;
     size_t total_cnt_r = 0;
-    for(size_t i=0; i<INTERVAL_CNT - 1; i++) {
+    for(size_t i=0; i<cnt - 1; i++) {
       // From left
-      total_cnt_l += intervals[i].cnt;
+      const interval *l = &intervals[i];
+      total_cnt_l += l->cnt;
       cnts_l[i] = total_cnt_l;
-      aabb_l = aabb_combine(aabb_l, intervals[i].aabb);
-      areas_l[i] = aabb_calc_area(aabb_l);
+      min_l = vec4_min(min_l, l->min);
+      max_l = vec4_max(max_l, l->max);
+      areas_l[i] = vec4_calc_area(min_l, max_l);
       // From right
-      total_cnt_r += intervals[INTERVAL_CNT - 1 - i].cnt;
-      cnts_r[INTERVAL_CNT - 2 - i] = total_cnt_r;
-      aabb_r = aabb_combine(aabb_r, intervals[INTERVAL_CNT - 1 - i].aabb);
-      areas_r[INTERVAL_CNT - 2 - i] = aabb_calc_area(aabb_r);
+      const interval *r = &intervals[cnt - 1 - i];
+      total_cnt_r += r->cnt;
+      cnts_r[cnt - 2 - i] = total_cnt_r;
+      min_r = vec4_min(min_r, r->min);
+      max_r = vec4_max(max_r, r->max);
+      areas_r[cnt - 2 - i] = vec4_calc_area(min_r, max_r);
     }
 
     // Find best surface area cost for prepared interval planes
-    delta = 1.0f / delta;
-    for(size_t i=0; i<INTERVAL_CNT - 1; i++) {
+    float delta = 1.0f / (cnt / (maxc - minc));
+    for(size_t i=0; i<cnt - 1; i++) {
       float cost = cnts_l[i] * areas_l[i] + cnts_r[i] * areas_r[i];
       if(cost < best.cost) {
         best.cost = cost;
@@ -122,98 +318,503 @@ split find_best_cost_interval_split(const bvh *b, const scn *s, bvh_node *n)
   return best;
 }
 
-void update_node_bounds(const bvh *b, const scn *s, bvh_node *n)
+split find_best_sweep_split(const sweep *sw, const bvh_node *n)
+{
+  split best = { .cost = FLT_MAX };
+  size_t start = n->start_idx;
+  size_t cnt = n->obj_cnt;
+  for(uint8_t axis=0; axis<3; axis++) {
+    const uint32_t *ids = sw->sorted[axis] + start;
+
+    // Area of the right side for each position the right side starts at
+    aabb aabb_r = aabb_init();
+    for(size_t i=cnt - 1; i>0; i--) {
+      aabb_r = aabb_combine(aabb_r, sw->boxes[ids[i]]);
+      sw->areas_r[start + i] = aabb_calc_area(aabb_r);
+    }
+
+    // Sweep from left and find the best surface area cost
+    aabb aabb_l = aabb_init();
+    for(size_t i=1; i<cnt; i++) {
+      aabb_l = aabb_combine(aabb_l, sw->boxes[ids[i - 1]]);
+      float cost =
+        i * aabb_calc_area(aabb_l) + (cnt - i) * sw->areas_r[start + i];
+      if(cost < best.cost) {
+        best.cost = cost;
+        best.axis = axis;
+        best.pos = vec3_get(sw->centers[ids[i]], axis);
+        best.left_cnt = i;
+      }
+    }
+  }
+
+  return best;
+}
+
+split find_best_split(const bvh *b, const prim_cache *c, const bvh_node *n)
+{
+  if(c->sweep)
+    return find_best_sweep_split(c->sweep, n);
+
+  aabb center_bounds = calc_center_bounds(c, n->start_idx, n->obj_cnt);
+
+  interval_set is;
+  init_intervals(&is, b->opts.interval_cnt);
+  bin_prims(&is, c, n->start_idx, n->obj_cnt, center_bounds);
+
+  return find_best_interval_split(&is, center_bounds);
+}
+
+void update_node_bounds(const prim_cache *c, bvh_node *n)
+{
+  vec4 mi = vec4_set1(FLT_MAX);
+  vec4 ma = vec4_set1(-FLT_MAX);
+  for(size_t i=n->start_idx; i<n->start_idx + n->obj_cnt; i++) {
+    mi = vec4_min(mi, c->bounds[2 * i]);
+    ma = vec4_max(ma, c->bounds[2 * i + 1]);
+  }
+  n->min = vec4_to_vec3(mi);
+  n->max = vec4_to_vec3(ma);
+}
+
+// Stable partition of the per axis sorted ids of n by the left flags. Keeps
+// the order of each side.
+void partition_sorted(sweep *sw, const bvh_node *n)
+{
+  for(uint8_t a=0; a<3; a++) {
+    uint32_t *ids = sw->sorted[a] + n->start_idx;
+    uint32_t *right = sw->tmp + n->start_idx;
+    size_t l = 0;
+    size_t r = 0;
+    for(size_t i=0; i<n->obj_cnt; i++) {
+      if(sw->left[ids[i]])
+        ids[l++] = ids[i];
+      else
+        right[r++] = ids[i];
+    }
+    memcpy(ids + l, right, r * sizeof(*ids));
+  }
+}
+
+// Moves the ids of the first left_obj_cnt positions of n to the left in the
+// sorted lists
+void sync_sorted(const bvh *b, sweep *sw, const bvh_node *n,
+    size_t left_obj_cnt)
 {
-  n->min = (vec3){ FLT_MAX, FLT_MAX, FLT_MAX };
-  n->max = (vec3){ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+  for(size_t i=0; i<n->obj_cnt; i++)
+    sw->left[b->indices[n->start_idx + i]] = i < left_obj_cnt;
+  partition_sorted(sw, n);
+}
+
+// Applies a full sweep split, indices and cache of n are taken from the
+// sorted list of the split axis
+void partition_node_sweep(bvh *b, prim_cache *c, const bvh_node *n, split sp)
+{
+  sweep *sw = c->sweep;
+  const uint32_t *ids = sw->sorted[sp.axis] + n->start_idx;
   for(size_t i=0; i<n->obj_cnt; i++) {
-    aabb obj_aabb = get_obj_aabb(b, s, n->start_idx + i);
-    n->min = vec3_min(n->min, obj_aabb.min);
-    n->max = vec3_max(n->max, obj_aabb.max);
+    size_t j = n->start_idx + i;
+    b->indices[j] = ids[i];
+    set_prim(c, j, sw->centers[ids[i]], sw->boxes[ids[i]]);
   }
+
+  sync_sorted(b, sw, n, sp.left_cnt);
 }
 
-void subdivide_node(bvh *b, const scn *s, bvh_node *n)
+size_t partition_node_median(bvh *b, prim_cache *c, const bvh_node *n)
 {
+  // Use axis of largest center extent
+  aabb cb = calc_center_bounds(c, n->start_idx, n->obj_cnt);
+  vec3 ext = vec3_sub(cb.max, cb.min);
+  uint8_t axis = (ext.x > ext.y && ext.x > ext.z) ? 0 : ((ext.y > ext.z) ? 1 : 2);
+
+  // Quickselect, left half ends up with the smaller centers
+  const float *centers = c->center[axis];
+  int32_t lo = n->start_idx;
+  int32_t hi = n->start_idx + n->obj_cnt - 1;
+  int32_t k = n->start_idx + n->obj_cnt / 2;
+  while(lo < hi) {
+    float pivot = centers[lo + (hi - lo) / 2];
+    int32_t l = lo;
+    int32_t r = hi;
+    while(l <= r) {
+      while(centers[l] < pivot)
+        l++;
+      while(centers[r] > pivot)
+        r--;
+      if(l <= r)
+        swap_prims(b, c, l++, r--);
+    }
+    if(k <= r)
+      hi = r;
+    else if(k >= l)
+      lo = l;
+    else
+      break;
+  }
+
+  if(c->sweep)
+    sync_sorted(b, c->sweep, n, n->obj_cnt / 2);
+
+  return n->obj_cnt / 2;
+}
+
+size_t partition_node(bvh *b, prim_cache *c, const bvh_node *n, split sp,
+    uint32_t depth_left)
+{
+  // Oversized leaves are split in any case
+  bool force = n->obj_cnt > b->opts.max_leaf_cnt;
+  if(sp.cost == FLT_MAX)
+    return force ? partition_node_median(b, c, n) : 0;
+
   // Calculate if we need to split or not
-  split split = find_best_cost_interval_split(b, s, n);
-  float no_split_cost = n->obj_cnt * aabb_calc_area((aabb){ n->min, n->max });
-  if(no_split_cost <= split.cost)
-    return;
+  float area = aabb_calc_area((aabb){ n->min, n->max });
+  float leaf_cost = b->opts.isect_cost * n->obj_cnt * area;
+  float split_cost = b->opts.trav_cost * area + b->opts.isect_cost * sp.cost;
+  if(!force && leaf_cost <= split_cost)
+    return 0;
 
-  // Partition object data into left and right of split pos
-  int32_t l = n->start_idx;
-  int32_t r = n->start_idx + n->obj_cnt - 1;
-  while(l <= r) {
-    vec3 center = get_obj_center(b, s, l);
-    if(vec3_get(center, split.axis) < split.pos) {
-      l++;
-    } else {
-      // Swap object index left/right
-      size_t t = b->indices[l];
-      b->indices[l] = b->indices[r];
-      b->indices[r] = t;
-      r--;
+  size_t left_obj_cnt = sp.left_cnt;
+  if(!c->sweep) {
+    // Partition object data into left and right of split pos
+    const float *centers = c->center[sp.axis];
+    int32_t l = n->start_idx;
+    int32_t r = n->start_idx + n->obj_cnt - 1;
+    while(l <= r) {
+      if(centers[l] < sp.pos) {
+        l++;
+      } else {
+        // Swap object index and cached data left/right
+        swap_prims(b, c, l, r);
+        r--;
+      }
     }
+    left_obj_cnt = l - n->start_idx;
   }
 
   // Stop if one side of the l/r partition is empty
-  size_t left_obj_cnt = l - n->start_idx;
   if(left_obj_cnt == 0 || left_obj_cnt == n->obj_cnt)
-    return;
+    return force ? partition_node_median(b, c, n) : 0;
 
-  // Init child nodes
-  bvh_node *left_child = &b->nodes[b->node_cnt++];
+  // Median splits get a child down to single objects in log2(cnt) levels.
+  // Use them if the SAH split leaves not enough depth for this.
+  size_t max_child_cnt = max(left_obj_cnt, n->obj_cnt - left_obj_cnt);
+  if(max_child_cnt > ((uint64_t)1 << depth_left))
+    return partition_node_median(b, c, n);
+
+  if(c->sweep)
+    partition_node_sweep(b, c, n, sp);
+
+  return left_obj_cnt;
+}
+
+void link_child_nodes(bvh *b, const prim_cache *c, bvh_node *n,
+    uint32_t child_idx, size_t left_obj_cnt)
+{
+  bvh_node *left_child = &b->nodes[child_idx];
   left_child->start_idx = n->start_idx;
   left_child->obj_cnt = left_obj_cnt;
 
-  update_node_bounds(b, s, left_child);
+  update_node_bounds(c, left_child);
 
-  bvh_node *right_child = &b->nodes[b->node_cnt++];
-  right_child->start_idx = l;
+  bvh_node *right_child = &b->nodes[child_idx + 1];
+  right_child->start_idx = n->start_idx + left_obj_cnt;
   right_child->obj_cnt = n->obj_cnt - left_obj_cnt;
 
-  update_node_bounds(b, s, right_child);
+  update_node_bounds(c, right_child);
 
   // Update current node with child link
-  n->start_idx = b->node_cnt - 2; // Right child implicitly + 1
+  n->start_idx = child_idx; // Right child implicitly + 1
   n->obj_cnt = 0; // No leaf
+}
 
-  subdivide_node(b, s, left_child);
-  subdivide_node(b, s, right_child);
+uint32_t get_shape_type(const bvh *b, const scn *s, size_t idx)
+{
+  return scn_get_obj(s, b->indices[idx])->shape_type;
 }
 
-bvh *bvh_init(size_t obj_cnt)
+size_t partition_node_type(bvh *b, prim_cache *c, const bvh_node *n,
+    uint32_t depth_left)
+{
+  // Objects of the shape type of the first one to the left
+  uint32_t type = get_shape_type(b, c->scn, n->start_idx);
+  int32_t l = n->start_idx;
+  int32_t r = n->start_idx + n->obj_cnt - 1;
+  while(l <= r) {
+    if(get_shape_type(b, c->scn, l) == type) {
+      l++;
+    } else {
+      swap_prims(b, c, l, r);
+      r--;
+    }
+  }
+
+  size_t left_obj_cnt = l - n->start_idx;
+  if(left_obj_cnt == n->obj_cnt)
+    return 0; // Single type
+
+  // Same depth limit as partition_node
+  size_t max_child_cnt = max(left_obj_cnt, n->obj_cnt - left_obj_cnt);
+  if(max_child_cnt > ((uint64_t)1 << depth_left))
+    return partition_node_median(b, c, n);
+
+  if(c->sweep)
+    sync_sorted(b, c->sweep, n, left_obj_cnt);
+
+  return left_obj_cnt;
+}
+
+size_t split_node(bvh *b, prim_cache *c, const bvh_node *n, uint32_t depth)
+{
+  if(depth >= b->opts.max_depth)
+    return 0;
+
+  size_t left_obj_cnt = 0;
+  if(n->obj_cnt > b->opts.min_leaf_cnt) {
+    split split = find_best_split(b, c, n);
+    left_obj_cnt =
+      partition_node(b, c, n, split, b->opts.max_depth - depth - 1);
+  }
+
+  // Leaves of typed builds must not mix shape types
+  if(left_obj_cnt == 0 && c->scn && n->obj_cnt > 1)
+    left_obj_cnt = partition_node_type(b, c, n, b->opts.max_depth - depth - 1);
+
+  return left_obj_cnt;
+}
+
+aabb get_idx_aabb(const bvh *b, const scn *s, const aabb *boxes, size_t idx)
+{
+  return boxes ? boxes[b->indices[idx]] : get_obj_aabb(b, s, idx);
+}
+
+bool is_huge(const uint32_t *huge, uint32_t huge_cnt, size_t idx)
+{
+  for(uint32_t i=0; i<huge_cnt; i++)
+    if(huge[i] == idx)
+      return true;
+  return false;
+}
+
+size_t separate_huge_objs(bvh *b, const scn *s, const aabb *boxes,
+    size_t cnt)
+{
+  b->huge_cnt = 0;
+  if(b->opts.huge_ratio <= 0.0f || cnt < 2)
+    return cnt;
+
+  // Positions of the largest objects by area, descending
+  uint32_t cands[BVH_MAX_HUGE];
+  float areas[BVH_MAX_HUGE];
+  uint32_t cand_cnt = 0;
+  uint32_t max_cand_cnt = min(BVH_MAX_HUGE, cnt - 1);
+  for(size_t i=0; i<cnt; i++) {
+    float area = aabb_calc_area(get_idx_aabb(b, s, boxes, i));
+    if(cand_cnt == max_cand_cnt && area <= areas[cand_cnt - 1])
+      continue;
+    uint32_t j = cand_cnt < max_cand_cnt ? cand_cnt++ : cand_cnt - 1;
+    for(; j>0 && areas[j - 1] < area; j--) {
+      cands[j] = cands[j - 1];
+      areas[j] = areas[j - 1];
+    }
+    cands[j] = i;
+    areas[j] = area;
+  }
+
+  // Bounds of all objects smaller than each candidate
+  aabb smaller[BVH_MAX_HUGE];
+  aabb rest = aabb_init();
+  for(size_t i=0; i<cnt; i++)
+    if(!is_huge(cands, cand_cnt, i))
+      rest = aabb_combine(rest, get_idx_aabb(b, s, boxes, i));
+  for(int32_t i=cand_cnt - 1; i>=0; i--) {
+    smaller[i] = rest;
+    rest = aabb_combine(rest, get_idx_aabb(b, s, boxes, cands[i]));
+  }
+
+  uint32_t huge_cnt = 0;
+  while(huge_cnt < cand_cnt &&
+      areas[huge_cnt] > b->opts.huge_ratio * aabb_calc_area(smaller[huge_cnt]))
+    huge_cnt++;
+  if(huge_cnt == 0)
+    return cnt;
+
+  // Keep the order of the others, huge objects go to the end
+  uint32_t huge_ids[BVH_MAX_HUGE];
+  for(uint32_t i=0; i<huge_cnt; i++)
+    huge_ids[i] = b->indices[cands[i]];
+  size_t j = 0;
+  for(size_t i=0; i<cnt; i++)
+    if(!is_huge(cands, huge_cnt, i))
+      b->indices[j++] = b->indices[i];
+  for(uint32_t i=0; i<huge_cnt; i++)
+    b->indices[j++] = huge_ids[i];
+
+  b->huge_cnt = huge_cnt;
+  return cnt - huge_cnt;
+}
+
+void tag_leaves(bvh *b, const scn *s)
+{
+  // Includes the huge objects leaf
+  for(size_t i=0; i<=b->node_cnt; i++) {
+    bvh_node *n = &b->nodes[i];
+    if(n->obj_cnt == 0)
+      continue;
+    uint32_t type = get_shape_type(b, s, n->start_idx);
+    for(size_t j=n->start_idx + 1; j<n->start_idx + n->obj_cnt; j++) {
+      if(get_shape_type(b, s, j) != type) {
+        type = 0;
+        break;
+      }
+    }
+    n->obj_cnt |= type << BVH_TYPE_SHIFT;
+  }
+}
+
+void init_huge_node(bvh *b, const scn *s, const aabb *boxes)
+{
+  bvh_node *n = &b->nodes[b->node_cnt];
+  aabb box = aabb_init();
+  for(size_t i=b->idx_cnt; i<b->idx_cnt + b->huge_cnt; i++)
+    box = aabb_combine(box, get_idx_aabb(b, s, boxes, i));
+  n->min = box.min;
+  n->max = box.max;
+  n->start_idx = b->idx_cnt;
+  n->obj_cnt = b->huge_cnt;
+}
+
+bvh_opts bvh_default_opts()
+{
+  return (bvh_opts){
+    .interval_cnt = 8,
+    .full_sweep = false,
+    .trav_cost = 0.0f,
+    .isect_cost = 1.0f,
+    .min_leaf_cnt = 1,
+    .max_leaf_cnt = UINT32_MAX,
+    .max_depth = BVH_MAX_DEPTH,
+    .spatial_splits = false,
+    .dup_budget = 0.3f,
+    .huge_ratio = 100.0f,
+    .typed_leaves = false };
+}
+
+bvh *bvh_init(size_t obj_cnt, const bvh_opts *opts)
 {
   bvh *b = malloc(sizeof(*b));
-  b->nodes = malloc((2 * obj_cnt - 1) * sizeof(*b->nodes));
-  b->indices = malloc(obj_cnt * sizeof(*b->indices));
+  b->refit_ready = false;
+  b->parents = NULL;
+  b->leaf_order = false;
+
+  bvh_opts *o = &b->opts;
+  *o = opts ? *opts : bvh_default_opts();
+  o->interval_cnt = max(2u, min(o->interval_cnt, BVH_MAX_INTERVALS));
+  o->min_leaf_cnt = max(1u, o->min_leaf_cnt);
+  o->max_leaf_cnt = max(o->min_leaf_cnt, o->max_leaf_cnt);
+  o->max_depth = min(o->max_depth, BVH_MAX_DEPTH);
+  o->dup_budget = max(0.0f, o->dup_budget);
+
+  // Every leaf holds at least one reference
+  size_t dup_cnt = o->spatial_splits ? (size_t)(o->dup_budget * obj_cnt) : 0;
+  b->obj_cnt = obj_cnt;
+  b->idx_cnt = 0;
+  b->idx_cap = obj_cnt + dup_cnt;
+  b->node_cap = 2 * b->idx_cap - 1;
+  b->nodes = malloc((b->node_cap + 1) * sizeof(*b->nodes));
+  b->indices = malloc(b->idx_cap * sizeof(*b->indices));
 
   return b;
 }
 
-void bvh_create(bvh *b, const scn *s)
+void build(bvh *b, const scn *s, const aabb *boxes, size_t cnt)
 {
+  reserve_nodes(b);
   b->node_cnt = 0;
+  b->depth = 0;
+  b->refit_ready = false;
+  b->leaf_order = false;
 
-  for(size_t i=0; i<s->obj_cnt; i++)
+  for(size_t i=0; i<cnt; i++)
     b->indices[i] = i;
 
+  cnt = separate_huge_objs(b, s, boxes, cnt);
+  b->idx_cnt = cnt;
+
+  prim_cache c;
+  init_prim_cache(&c, b, s, boxes, cnt);
+
   bvh_node *root = &b->nodes[b->node_cnt++];
   root->start_idx = 0;
-  root->obj_cnt = s->obj_cnt;
+  root->obj_cnt = cnt;
+
+  update_node_bounds(&c, root);
+
+  // Work queue of nodes to split. Depth first with the left child on top,
+  // i.e. holds at most one right child per level.
+  bld_item stack[BVH_MAX_DEPTH + 1];
+  uint32_t stack_cnt = 0;
+  stack[stack_cnt++] = (bld_item){ 0, 0 };
+
+  while(stack_cnt > 0) {
+    bld_item item = stack[--stack_cnt];
+    bvh_node *n = &b->nodes[item.node_idx];
+    size_t left_obj_cnt = split_node(b, &c, n, item.depth);
+    if(left_obj_cnt == 0) {
+      b->depth = max(b->depth, item.depth);
+      continue;
+    }
+
+    uint32_t child_idx = b->node_cnt;
+    b->node_cnt += 2;
+    link_child_nodes(b, &c, n, child_idx, left_obj_cnt);
+
+    stack[stack_cnt++] = (bld_item){ child_idx + 1, item.depth + 1 };
+    stack[stack_cnt++] = (bld_item){ child_idx, item.depth + 1 };
+  }
+
+  release_prim_cache(&c);
+  init_huge_node(b, s, boxes);
+  if(b->opts.typed_leaves && s)
+    tag_leaves(b, s);
+}
 
-  update_node_bounds(b, s, root);
-  subdivide_node(b, s, root);
+void bvh_create(bvh *b, const scn *s)
+{
+  if(b->opts.spatial_splits)
+    build_sbvh(b, s);
+  else
+    build(b, s, NULL, s->obj_cnt);
+}
+
+void bvh_create_boxes(bvh *b, const aabb *boxes, size_t cnt)
+{
+  build(b, NULL, boxes, cnt);
+}
+
+void bvh_reorder_scn(bvh *b, scn *s)
+{
+  size_t cnt = b->idx_cnt + b->huge_cnt;
+  scn_reorder(s, b->indices, cnt);
+  for(size_t i=0; i<cnt; i++)
+    b->indices[i] = i;
+  b->obj_cnt = cnt;
+  b->leaf_order = true;
+  b->refit_ready = false;
 }
 
 void bvh_refit(bvh *b, const scn *s)
 {
-  for(int32_t i=b->node_cnt - 1; i>=0; i--) {
+  // Includes the huge objects leaf
+  for(int32_t i=b->node_cnt; i>=0; i--) {
     bvh_node *n = &b->nodes[i];
-    if(n->obj_cnt > 0) {
+    if(n->obj_cnt > 0 || i == (int32_t)b->node_cnt) {
       // Leaf with objects
-      update_node_bounds(b, s, n);
+      aabb box = aabb_init();
+      for(size_t j=0; j<(n->obj_cnt & BVH_CNT_MASK); j++)
+        box = aabb_combine(box, get_obj_aabb(b, s, n->start_idx + j));
+      n->min = box.min;
+      n->max = box.max;
     } else {
       // Interior node. Just update bounds as per child bounds.
       bvh_node *l = &b->nodes[n->start_idx];
@@ -224,9 +825,248 @@ void bvh_refit(bvh *b, const scn *s)
   }
 }
 
+void init_refit(bvh *b)
+{
+  if(!b->parents) {
+    b->parents = malloc((b->node_cap + 1) * sizeof(*b->parents));
+    b->leaves = malloc(b->idx_cap * sizeof(*b->leaves));
+    b->dirty = malloc(b->idx_cap * sizeof(*b->dirty));
+    b->marked = malloc((b->node_cap + 1) * sizeof(*b->marked));
+  }
+
+  b->parents[0] = 0; // Root
+  b->parents[b->node_cnt] = b->node_cnt; // Huge objects leaf
+  for(size_t i=0; i<=b->node_cnt; i++) {
+    const bvh_node *n = &b->nodes[i];
+    b->marked[i] = false;
+    if(n->obj_cnt > 0 || i == b->node_cnt) {
+      uint32_t end = n->start_idx + (n->obj_cnt & BVH_CNT_MASK);
+      for(size_t j=n->start_idx; j<end; j++)
+        b->leaves[b->indices[j]] = i;
+    } else {
+      b->parents[n->start_idx] = i;
+      b->parents[n->start_idx + 1] = i;
+    }
+  }
+
+  b->dirty_cnt = 0;
+  b->refit_ready = true;
+}
+
+void bvh_mark_obj(bvh *b, uint32_t obj_idx)
+{
+  if(!b->refit_ready)
+    init_refit(b);
+
+  uint32_t leaf = b->leaves[obj_idx];
+  if(!b->marked[leaf]) {
+    b->marked[leaf] = true;
+    b->dirty[b->dirty_cnt++] = leaf;
+  }
+}
+
+bool set_node_bounds(bvh_node *n, aabb box)
+{
+  if(vec3_eq(n->min, box.min) && vec3_eq(n->max, box.max))
+    return false;
+
+  n->min = box.min;
+  n->max = box.max;
+  return true;
+}
+
+void bvh_refit_dirty(bvh *b, const scn *s)
+{
+  if(!b->refit_ready)
+    return;
+
+  // Objects split by spatial splits are in several leaves
+  bool full = b->idx_cnt > b->obj_cnt;
+  for(size_t i=0; i<b->dirty_cnt; i++) {
+    uint32_t idx = b->dirty[i];
+    bvh_node *n = &b->nodes[idx];
+    b->marked[idx] = false;
+    if(full)
+      continue;
+
+    aabb box = aabb_init();
+    for(size_t j=0; j<(n->obj_cnt & BVH_CNT_MASK); j++)
+      box = aabb_combine(box, get_obj_aabb(b, s, n->start_idx + j));
+
+    // Walk up while bounds change. Ancestors shared with later leaves are
+    // revisited by those.
+    while(set_node_bounds(n, box) && b->parents[idx] != idx) {
+      idx = b->parents[idx];
+      n = &b->nodes[idx];
+      bvh_node *l = &b->nodes[n->start_idx];
+      bvh_node *r = &b->nodes[n->start_idx + 1];
+      box = (aabb){ vec3_min(l->min, r->min), vec3_max(l->max, r->max) };
+    }
+  }
+
+  if(full && b->dirty_cnt > 0)
+    bvh_refit(b, s);
+
+  b->dirty_cnt = 0;
+}
+
+void release_refit(bvh *b)
+{
+  if(b->parents) {
+    free(b->marked);
+    free(b->dirty);
+    free(b->leaves);
+    free(b->parents);
+    b->parents = NULL;
+  }
+  b->refit_ready = false;
+}
+
+void reserve_nodes(bvh *b)
+{
+  size_t cap = 2 * b->idx_cap - 1;
+  if(b->node_cap == cap)
+    return;
+
+  // Refit data is sized by the node capacity
+  release_refit(b);
+  free(b->nodes);
+  b->nodes = malloc((cap + 1) * sizeof(*b->nodes));
+  b->node_cap = cap;
+}
+
+void bvh_shrink(bvh *b)
+{
+  release_refit(b);
+  bvh_node *nodes = malloc((b->node_cnt + 1) * sizeof(*nodes));
+  memcpy(nodes, b->nodes, (b->node_cnt + 1) * sizeof(*nodes));
+  free(b->nodes);
+  b->nodes = nodes;
+  b->node_cap = b->node_cnt;
+}
+
 void bvh_release(bvh *b)
 {
+  release_refit(b);
   free(b->indices);
   free(b->nodes);
   free(b);
 }
+
+bvh_stats bvh_calc_stats(const bvh *b)
+{
+  bvh_stats st = { .node_cnt = b->node_cnt };
+  if(b->node_cnt == 0)
+    return st;
+
+  float inv_root_area =
+    1.0f / aabb_calc_area((aabb){ b->nodes[0].min, b->nodes[0].max });
+  uint64_t depth_sum = 0;
+
+  // Depth first, same as the build. Needs max depth + 1 entries, sized by
+  // the inner node count as the bound that holds for trees of any builder.
+  bld_item *stack = malloc(((b->node_cnt + 1) / 2 + 1) * sizeof(*stack));
+  uint32_t stack_cnt = 0;
+  stack[stack_cnt++] = (bld_item){ 0, 0 };
+
+  while(stack_cnt > 0) {
+    bld_item item = stack[--stack_cnt];
+    const bvh_node *n = &b->nodes[item.node_idx];
+    float rel_area = aabb_calc_area((aabb){ n->min, n->max }) * inv_root_area;
+    if(n->obj_cnt > 0) {
+      uint32_t cnt = n->obj_cnt & BVH_CNT_MASK;
+      st.leaf_cnt++;
+      st.obj_cnt += cnt;
+      st.max_depth = max(st.max_depth, item.depth);
+      depth_sum += item.depth;
+      st.sah_cost += cnt * rel_area;
+      st.typed_leaf_cnt += (n->obj_cnt >> BVH_TYPE_SHIFT) > 0;
+      uint32_t bucket = 0;
+      while(bucket < BVH_HIST_CNT - 1 && cnt > (1u << bucket))
+        bucket++;
+      st.leaf_hist[bucket]++;
+    } else {
+      st.sah_cost += rel_area;
+      stack[stack_cnt++] = (bld_item){ n->start_idx + 1, item.depth + 1 };
+      stack[stack_cnt++] = (bld_item){ n->start_idx, item.depth + 1 };
+    }
+  }
+
+  free(stack);
+
+  // Every ray entering the root tests the huge objects too
+  st.huge_cnt = b->huge_cnt;
+  st.sah_cost += b->huge_cnt;
+
+  st.avg_depth = (float)depth_sum / st.leaf_cnt;
+  st.wasted_ratio = 1.0f - (float)b->node_cnt / b->node_cap;
+
+  return st;
+}
+
+void bvh_log_stats(const bvh_stats *st)
+{
+  log("bvh: %zu nodes, %zu leaves, %zu objs, %zu huge, depth max %u avg %.2f, sah %.2f, wasted %.1f%%",
+      st->node_cnt, st->leaf_cnt, st->obj_cnt, st->huge_cnt, st->max_depth,
+      st->avg_depth, st->sah_cost, st->wasted_ratio * 100.0f);
+  log("bvh leaf objs: 1: %u, 2: %u, 3-4: %u, 5-8: %u, 9-16: %u, 17-32: %u, 33-64: %u, 65+: %u",
+      st->leaf_hist[0], st->leaf_hist[1], st->leaf_hist[2], st->leaf_hist[3],
+      st->leaf_hist[4], st->leaf_hist[5], st->leaf_hist[6], st->leaf_hist[7]);
+}
+
+void intersect_leaf(const bvh *b, const scn *s, const bvh_node *n, ray *r,
+    uint32_t *obj_idx)
+{
+  scn_intersect_objs(s, b->leaf_order ? NULL : b->indices, n->start_idx,
+      n->obj_cnt & BVH_CNT_MASK, n->obj_cnt >> BVH_TYPE_SHIFT, r, obj_idx);
+}
+
+void bvh_intersect(const bvh *b, const scn *s, ray *r, uint32_t *obj_idx)
+{
+  // Huge objects first, their hits shorten the ray for the tree
+  intersect_leaf(b, s, &b->nodes[b->node_cnt], r, obj_idx);
+
+  uint32_t stack[BVH_MAX_DEPTH];
+  uint32_t stack_idx = 0;
+  bvh_node *n = &b->nodes[0];
+
+  // Node bounds are loaded with the index and count in w, which the box
+  // test ignores
+  vec4 ori = vec4_load(&r->ori.x);
+  vec4 inv_dir = vec4_load(&r->inv_dir.x);
+
+  while(true) {
+    if(n->obj_cnt > 0) {
+      // Leaf, test all objects
+      intersect_leaf(b, s, n, r, obj_idx);
+      if(stack_idx == 0)
+        break;
+      n = &b->nodes[stack[--stack_idx]];
+    } else {
+      // Interior node, continue with near child and push far child
+      uint32_t l = n->start_idx;
+      const bvh_node *cl = &b->nodes[l];
+      const bvh_node *cr = &b->nodes[l + 1];
+      float dist_l = ray_intersect_aabb4(r, ori, inv_dir,
+          vec4_load(&cl->min.x), vec4_load(&cl->max.x));
+      float dist_r = ray_intersect_aabb4(r, ori, inv_dir,
+          vec4_load(&cr->min.x), vec4_load(&cr->max.x));
+
+      bool swap = dist_l > dist_r;
+      float near_dist = swap ? dist_r : dist_l;
+      float far_dist = swap ? dist_l : dist_r;
+      uint32_t near_idx = swap ? l + 1 : l;
+      uint32_t far_idx = swap ? l : l + 1;
+
+      if(near_dist < MAX_DISTANCE) {
+        n = &b->nodes[near_idx];
+        if(far_dist < MAX_DISTANCE)
+          stack[stack_idx++] = far_idx;
+      } else {
+        if(stack_idx == 0)
+          break;
+        n = &b->nodes[stack[--stack_idx]];
+      }
+    }
+  }
+}
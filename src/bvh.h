@@ -1,28 +1,155 @@
 #ifndef BVH_H
 #define BVH_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include "vec3.h"
 
+#define BVH_MAX_DEPTH     32 // Size of the traversal stack in the shader
+#define BVH_MAX_INTERVALS 64
+#define BVH_HIST_CNT      8  // Leaf size buckets 1, 2, 3-4, .., 65+
+#define BVH_MAX_HUGE      8  // Objects kept out of the tree at most
+
+// Leaves of a typed build keep the shape type of their objects in the top
+// bits of obj_cnt, 0 if the objects are of mixed type
+#define BVH_TYPE_SHIFT    29
+#define BVH_CNT_MASK      ((1u << BVH_TYPE_SHIFT) - 1)
+
 typedef struct scn scn;
+typedef struct ray ray;
+typedef struct aabb aabb;
+typedef struct bvh_lazy bvh_lazy;
 
 typedef struct bvh_node {
-  vec3    min;
-  size_t  start_idx; // obj start or node index
-  vec3    max;
-  size_t  obj_cnt;
+  vec3      min;
+  uint32_t  start_idx; // obj start or node index
+  vec3      max;
+  uint32_t  obj_cnt;
 } bvh_node;
 
+// Build options. The SAH cost of a split node is trav_cost * area plus
+// isect_cost * (left cnt * left area + right cnt * right area). A leaf costs
+// isect_cost * cnt * area.
+typedef struct bvh_opts {
+  uint32_t  interval_cnt; // Bins per axis, at most BVH_MAX_INTERVALS
+  bool      full_sweep;   // Exact SAH over all objects instead of bins
+  float     trav_cost;
+  float     isect_cost;
+  uint32_t  min_leaf_cnt; // Nodes with this many objects or less stay leaves
+  uint32_t  max_leaf_cnt; // Nodes with more objects are split regardless of SAH
+  // LBVH builds ignore SAH and split every node above min_leaf_cnt, so
+  // their leaves stay within max_leaf_cnt (bvh_init keeps it >= min)
+  uint32_t  max_depth;    // Build limit for leaf depth, at most BVH_MAX_DEPTH
+  // Spatial splits (SBVH) of bvh_create. Objects straddling a spatial split
+  // plane are referenced by both children with their bounds clipped to each
+  // side. Uses interval_cnt spatial bins per axis.
+  bool      spatial_splits;
+  float     dup_budget;   // Extra references allowed, relative to obj count
+  // Objects whose bounds area exceeds huge_ratio times the area of all
+  // smaller objects are kept out of the tree and tested by every ray, e.g. a
+  // ground sphere. 0 keeps all objects in the tree.
+  float     huge_ratio;
+  // Leaves of bvh_create and bvh_create_par hold a single shape type, which
+  // is tagged in obj_cnt (see BVH_TYPE_SHIFT). Lets the traversal use a
+  // specialized loop per leaf. Not used by spatial split and LBVH builds.
+  bool      typed_leaves;
+} bvh_opts;
+
+// nodes[node_cnt] is a leaf outside the tree with the huge objects, i.e.
+// nodes[0] to nodes[node_cnt] are a self-contained layout for the GPU
 typedef struct bvh {
   size_t    node_cnt;
+  size_t    node_cap;   // Allocated nodes without the huge objects leaf
   bvh_node  *nodes;
-  size_t    *indices;
+  uint32_t  *indices;
+  size_t    obj_cnt;
+  size_t    idx_cnt;    // Used by the tree, more than obj_cnt with spatial splits
+  size_t    huge_cnt;   // Indices after the ones of the tree
+  size_t    idx_cap;    // Allocated indices, builds need 2 * idx_cap - 1 nodes
+  bvh_opts  opts;
+  uint32_t  depth;      // Max leaf depth = traversal stack entries needed
+  bool      leaf_order; // Scene is in leaf order, indices are not needed
+  // Incremental refit, set up by the first bvh_mark_obj after a build
+  bool      refit_ready;
+  uint32_t  *parents;   // Per node
+  uint32_t  *leaves;    // Per object, leaf node containing it
+  uint32_t  *dirty;     // Leaves with moved objects
+  size_t    dirty_cnt;
+  bool      *marked;    // Per node, leaf is in dirty
 } bvh;
 
-bvh   *bvh_init(size_t obj_cnt);
+// Tree quality. The SAH cost uses traversal and intersection cost 1 and is
+// relative to the root area, i.e. comparable across build options.
+typedef struct bvh_stats {
+  size_t    node_cnt;
+  size_t    leaf_cnt;
+  size_t    obj_cnt;      // Referenced by leaves
+  uint32_t  max_depth;
+  float     avg_depth;    // Of leaves, weighted by leaf
+  float     sah_cost;
+  float     wasted_ratio; // Unused part of the node allocation
+  uint32_t  leaf_hist[BVH_HIST_CNT]; // Leaves per object count bucket
+  size_t    huge_cnt;     // Objects outside the tree, part of the SAH cost
+  size_t    typed_leaf_cnt; // Leaves tagged with a single shape type
+} bvh_stats;
+
+bvh_opts  bvh_default_opts();
+
+// Uses the default options if opts is NULL
+bvh   *bvh_init(size_t obj_cnt, const bvh_opts *opts);
 void  bvh_create(bvh *b, const scn *s);
+
+// Builds over arbitrary bounds, e.g. of instances. Not for bvh_refit.
+void  bvh_create_boxes(bvh *b, const aabb *boxes, size_t cnt);
+
+// Native build only, same tree as bvh_create built by thread_cnt threads.
+// Spatial split builds are always serial.
+void  bvh_create_par(bvh *b, const scn *s, uint32_t thread_cnt);
+
+// Native build only, lazy build for the CPU traversal. Sets up the root and
+// leaves every node to the first bvh_lazy_intersect that reaches it, i.e.
+// only what rays visit gets built. Thread-safe, expanded nodes are published
+// to all threads. Spatial splits are not supported. bvh_lazy_finish turns b
+// into a regular BVH whose unbuilt nodes are leaves and returns the number
+// of objects in them.
+bvh_lazy  *bvh_lazy_init(bvh *b, const scn *s);
+void      bvh_lazy_intersect(bvh_lazy *l, const scn *s, ray *r,
+            uint32_t *obj_idx);
+size_t    bvh_lazy_finish(bvh_lazy *l);
+
+// Linear build from Morton codes of the object centers for per frame
+// rebuilds. Much faster than the SAH builders, at a higher SAH cost.
+void  bvh_create_lbvh(bvh *b, const scn *s);
+
+// Optional post-build pass of treelet restructuring. Visits every node once
+// and returns the resulting SAH cost as of bvh_calc_stats. Passes can be
+// repeated while they still pay off, e.g. within a build time budget.
+float bvh_optimize_pass(bvh *b);
+
+// Moves the scene objects, shapes and materials into leaf order so that
+// leaves address objects directly. Indices become the identity. Objects
+// referenced by several leaves are duplicated, sharing shape and material.
+void  bvh_reorder_scn(bvh *b, scn *s);
+
+// Frees the node allocation beyond node_cnt, i.e. the up to 2 * obj_cnt - 1
+// nodes a build may need. The next build allocates them again. Drops the
+// incremental refit data.
+void  bvh_shrink(bvh *b);
+
 void  bvh_refit(bvh *b, const scn *s);
+
+// Marks an object as moved. bvh_refit_dirty then updates only the leaves of
+// the marked objects and their ancestors whose bounds change. Trees with
+// spatial splits get a full refit instead. Refits use the unclipped object
+// bounds, i.e. the benefit of spatial splits is lost until the next build.
+void  bvh_mark_obj(bvh *b, uint32_t obj_idx);
+void  bvh_refit_dirty(bvh *b, const scn *s);
 void  bvh_release(bvh *b);
 
+bvh_stats bvh_calc_stats(const bvh *b);
+void      bvh_log_stats(const bvh_stats *st);
+
+void  bvh_intersect(const bvh *b, const scn *s, ray *r, uint32_t *obj_idx);
+
 #endif
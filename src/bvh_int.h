@@ -0,0 +1,134 @@
+#ifndef BVH_INT_H
+#define BVH_INT_H
+
+// Build steps shared by the BVH builders, not part of the public interface
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "aabb.h"
+#include "bvh.h"
+#include "vec4.h"
+
+typedef struct interval {
+  vec4    min;
+  vec4    max;
+  size_t  cnt;
+} interval;
+
+// Intervals of all three axes
+typedef struct interval_set {
+  uint32_t  cnt;
+  interval  intervals[3][BVH_MAX_INTERVALS];
+} interval_set;
+
+typedef struct split {
+  float     cost; // Sum of object count * area of both sides
+  float     pos;
+  uint8_t   axis;
+  uint32_t  left_cnt; // Full sweep only
+} split;
+
+// Data of the full sweep SAH. Per node range, the object ids are kept
+// sorted by center along each axis.
+typedef struct sweep {
+  uint32_t  *sorted[3];
+  vec3      *centers; // Per object id
+  aabb      *boxes; // Per object id
+  float     *areas_r; // Per position, right side areas of a sweep
+  uint32_t  *tmp; // Per position
+  bool      *left; // Per object id, side of the current split
+} sweep;
+
+// Object centers in SoA layout and bounds, computed once per build. Kept in
+// the same order as b->indices, i.e. partitioning swaps both.
+typedef struct prim_cache {
+  float *center[3];
+  vec4  *bounds; // Min at 2 * i, max at 2 * i + 1
+  sweep *sweep; // Only with full sweep SAH
+  const scn *scn; // Shape types of typed leaves, else NULL
+} prim_cache;
+
+// Node to split at the given depth
+typedef struct bld_item {
+  uint32_t  node_idx;
+  uint32_t  depth;
+} bld_item;
+
+// Of the object at position idx of b->indices
+aabb    get_obj_aabb(const bvh *b, const scn *s, size_t idx);
+vec3    get_obj_center(const bvh *b, const scn *s, size_t idx);
+
+void    set_prim(prim_cache *c, size_t i, vec3 center, aabb box);
+aabb    get_prim_aabb(const prim_cache *c, size_t i);
+void    grow_by_prim(aabb *a, const prim_cache *c, size_t i);
+
+// Takes the bounds from boxes if given, else from the scene
+aabb    get_idx_aabb(const bvh *b, const scn *s, const aabb *boxes, size_t idx);
+
+// Restores the full node allocation after bvh_shrink, called by every builder
+void    reserve_nodes(bvh *b);
+
+// Moves the huge objects (see bvh_opts) among the first cnt indices to the
+// end and sets b->huge_cnt. Returns the object count left for the tree.
+size_t  separate_huge_objs(bvh *b, const scn *s, const aabb *boxes,
+          size_t cnt);
+
+// Tags every leaf including the huge objects leaf with its shape type, see
+// bvh_opts.typed_leaves
+void    tag_leaves(bvh *b, const scn *s);
+
+// Sets up nodes[node_cnt] for the huge objects after the tree indices
+void    init_huge_node(bvh *b, const scn *s, const aabb *boxes);
+
+// Allocates for cap objects, leaves sweep and scn unset
+void    alloc_prim_cache(prim_cache *c, size_t cap);
+
+// Takes the object bounds from boxes if given, else from the scene
+void    init_prim_cache(prim_cache *c, const bvh *b, const scn *s,
+          const aabb *boxes, size_t cnt);
+void    release_prim_cache(prim_cache *c);
+
+aabb    calc_center_bounds(const prim_cache *c, size_t start, size_t cnt);
+void    init_intervals(interval_set *is, uint32_t cnt);
+void    bin_prims(interval_set *is, const prim_cache *c, size_t start,
+          size_t cnt, aabb center_bounds);
+void    merge_intervals(interval_set *dst, const interval_set *src);
+split   find_best_interval_split(const interval_set *is, aabb center_bounds);
+
+// Binned or full sweep SAH as per b->opts
+split   find_best_split(const bvh *b, const prim_cache *c, const bvh_node *n);
+
+void    update_node_bounds(const prim_cache *c, bvh_node *n);
+
+// Partitions the objects of n at the given split if the SAH or the leaf
+// size limit ask for it. Falls back to an object median split if there is
+// no valid split or if a child could not be split down to single objects
+// within depth_left levels below it. Returns the object count of the left
+// side or 0 if n should stay a leaf.
+size_t  partition_node(bvh *b, prim_cache *c, const bvh_node *n, split sp,
+          uint32_t depth_left);
+size_t  partition_node_median(bvh *b, prim_cache *c, const bvh_node *n);
+
+// Partitions the objects of n by shape type (typed leaves). Returns 0 if
+// they are of a single type, else like partition_node.
+size_t  partition_node_type(bvh *b, prim_cache *c, const bvh_node *n,
+          uint32_t depth_left);
+
+// Finds the best split for n and partitions it, see partition_node. Nodes
+// at max depth or with at most min_leaf_cnt objects stay leaves. With typed
+// leaves, leaves of mixed shape types are partitioned by type instead.
+size_t  split_node(bvh *b, prim_cache *c, const bvh_node *n, uint32_t depth);
+
+// Initializes the children of n at child_idx (left) and child_idx + 1 (right)
+void    link_child_nodes(bvh *b, const prim_cache *c, bvh_node *n,
+          uint32_t child_idx, size_t left_obj_cnt);
+
+// Tests the objects of leaf n, updates r->t and obj_idx on closer hits
+void    intersect_leaf(const bvh *b, const scn *s, const bvh_node *n, ray *r,
+          uint32_t *obj_idx);
+
+// Spatial split build of bvh_create, see bvh_opts
+void    build_sbvh(bvh *b, const scn *s);
+
+#endif
@@ -0,0 +1,204 @@
+#include "bvh.h"
+#include <stdatomic.h>
+#include "sutil.h"
+#include "mutil.h"
+#include "scn.h"
+#include "ray.h"
+#include "sys.h"
+#include "bvh_int.h"
+
+// Lazy build of the native version. The tree starts as a root leaf holding
+// all objects. Nodes are pending until the first ray reaches them, then that
+// ray splits them as bvh_create would. Large nodes are split one level at a
+// time into pending children, small ones get their whole subtree at once.
+//
+// A pending node is a valid leaf at any time, i.e. the tree is a regular BVH
+// whenever no ray is in flight. Nodes are expanded by whichever thread gets
+// to them first. It publishes the children and the new node links with a
+// release store of the node state. Other threads reaching the node wait for
+// it, as the expansion reorders the object indices of the node.
+
+#define LAZY_SUBTREE_CNT 256 // Nodes with less objects are built completely
+
+enum lazy_state {
+  LAZY_PENDING,
+  LAZY_BUILDING,
+  LAZY_DONE
+};
+
+struct bvh_lazy {
+  bvh           *b;
+  prim_cache    c;
+  bvh_node      huge; // Kept here as node_cnt grows
+  atomic_size_t node_cnt;
+  atomic_uchar  *states; // Per node
+  uint8_t       *depths; // Per node
+};
+
+bvh_lazy *bvh_lazy_init(bvh *b, const scn *s)
+{
+  reserve_nodes(b);
+  b->node_cnt = 0;
+  b->depth = 0;
+  b->refit_ready = false;
+  b->leaf_order = false;
+
+  for(size_t i=0; i<s->obj_cnt; i++)
+    b->indices[i] = i;
+
+  size_t cnt = separate_huge_objs(b, s, NULL, s->obj_cnt);
+  b->idx_cnt = cnt;
+
+  bvh_lazy *l = malloc(sizeof(*l));
+  l->b = b;
+  init_prim_cache(&l->c, b, s, NULL, cnt);
+  l->states = malloc(b->node_cap * sizeof(*l->states));
+  l->depths = malloc(b->node_cap * sizeof(*l->depths));
+
+  bvh_node *root = &b->nodes[b->node_cnt++];
+  root->start_idx = 0;
+  root->obj_cnt = cnt;
+  update_node_bounds(&l->c, root);
+
+  atomic_init(&l->states[0], LAZY_PENDING);
+  l->depths[0] = 0;
+  atomic_init(&l->node_cnt, 1);
+
+  // Set up at nodes[1] which the first expansion overwrites
+  init_huge_node(b, s, NULL);
+  l->huge = b->nodes[1];
+
+  return l;
+}
+
+// Complete subtree below idx, all its nodes are done right away
+static void build_subtree(bvh_lazy *l, uint32_t idx)
+{
+  bvh *b = l->b;
+  bld_item stack[BVH_MAX_DEPTH + 1];
+  uint32_t stack_cnt = 0;
+  stack[stack_cnt++] = (bld_item){ idx, l->depths[idx] };
+
+  while(stack_cnt > 0) {
+    bld_item item = stack[--stack_cnt];
+    bvh_node *n = &b->nodes[item.node_idx];
+    size_t left_obj_cnt = split_node(b, &l->c, n, item.depth);
+    if(left_obj_cnt == 0)
+      continue;
+
+    uint32_t child_idx = atomic_fetch_add(&l->node_cnt, 2);
+    link_child_nodes(b, &l->c, n, child_idx, left_obj_cnt);
+
+    for(uint32_t i=child_idx; i<child_idx + 2; i++) {
+      atomic_init(&l->states[i], LAZY_DONE);
+      l->depths[i] = item.depth + 1;
+    }
+
+    stack[stack_cnt++] = (bld_item){ child_idx + 1, item.depth + 1 };
+    stack[stack_cnt++] = (bld_item){ child_idx, item.depth + 1 };
+  }
+}
+
+static void expand_node(bvh_lazy *l, uint32_t idx)
+{
+  unsigned char state = LAZY_PENDING;
+  if(!atomic_compare_exchange_strong_explicit(&l->states[idx], &state,
+        LAZY_BUILDING, memory_order_acquire, memory_order_acquire)) {
+    // Expanded by another thread
+    while(state != LAZY_DONE) {
+      sys_yield();
+      state = atomic_load_explicit(&l->states[idx], memory_order_acquire);
+    }
+    return;
+  }
+
+  bvh *b = l->b;
+  bvh_node *n = &b->nodes[idx];
+  if(n->obj_cnt < LAZY_SUBTREE_CNT) {
+    build_subtree(l, idx);
+  } else {
+    size_t left_obj_cnt = split_node(b, &l->c, n, l->depths[idx]);
+    if(left_obj_cnt > 0) {
+      uint32_t child_idx = atomic_fetch_add(&l->node_cnt, 2);
+      link_child_nodes(b, &l->c, n, child_idx, left_obj_cnt);
+      for(uint32_t i=child_idx; i<child_idx + 2; i++) {
+        atomic_init(&l->states[i], LAZY_PENDING);
+        l->depths[i] = l->depths[idx] + 1;
+      }
+    }
+  }
+
+  atomic_store_explicit(&l->states[idx], LAZY_DONE, memory_order_release);
+}
+
+// Returns the node at idx, expanded if it was pending
+static const bvh_node *get_node(bvh_lazy *l, uint32_t idx)
+{
+  if(atomic_load_explicit(&l->states[idx], memory_order_acquire) != LAZY_DONE)
+    expand_node(l, idx);
+  return &l->b->nodes[idx];
+}
+
+void bvh_lazy_intersect(bvh_lazy *l, const scn *s, ray *r, uint32_t *obj_idx)
+{
+  // Same traversal as bvh_intersect. Child bounds are set by the expansion
+  // of the parent and do not change afterwards.
+  const bvh *b = l->b;
+  intersect_leaf(b, s, &l->huge, r, obj_idx);
+
+  uint32_t stack[BVH_MAX_DEPTH];
+  uint32_t stack_idx = 0;
+  const bvh_node *n = get_node(l, 0);
+
+  while(true) {
+    if(n->obj_cnt > 0) {
+      intersect_leaf(b, s, n, r, obj_idx);
+      if(stack_idx == 0)
+        break;
+      n = get_node(l, stack[--stack_idx]);
+    } else {
+      uint32_t c = n->start_idx;
+      float dist_l = ray_intersect_aabb(r, b->nodes[c].min, b->nodes[c].max);
+      float dist_r = ray_intersect_aabb(r, b->nodes[c + 1].min, b->nodes[c + 1].max);
+
+      bool swap = dist_l > dist_r;
+      float near_dist = swap ? dist_r : dist_l;
+      float far_dist = swap ? dist_l : dist_r;
+      uint32_t near_idx = swap ? c + 1 : c;
+      uint32_t far_idx = swap ? c : c + 1;
+
+      if(near_dist < MAX_DISTANCE) {
+        n = get_node(l, near_idx);
+        if(far_dist < MAX_DISTANCE)
+          stack[stack_idx++] = far_idx;
+      } else {
+        if(stack_idx == 0)
+          break;
+        n = get_node(l, stack[--stack_idx]);
+      }
+    }
+  }
+}
+
+size_t bvh_lazy_finish(bvh_lazy *l)
+{
+  bvh *b = l->b;
+  b->node_cnt = atomic_load(&l->node_cnt);
+  b->nodes[b->node_cnt] = l->huge;
+
+  size_t pending_cnt = 0;
+  for(size_t i=0; i<b->node_cnt; i++) {
+    const bvh_node *n = &b->nodes[i];
+    if(n->obj_cnt > 0)
+      b->depth = max(b->depth, (uint32_t)l->depths[i]);
+    if(atomic_load(&l->states[i]) == LAZY_PENDING)
+      pending_cnt += n->obj_cnt;
+  }
+
+  free(l->depths);
+  free(l->states);
+  release_prim_cache(&l->c);
+  free(l);
+
+  return pending_cnt;
+}
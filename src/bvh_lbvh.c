@@ -0,0 +1,176 @@
+#include "bvh.h"
+#include "sutil.h"
+#include "mutil.h"
+#include "scn.h"
+#include "sort.h"
+#include "bvh_int.h"
+
+// Linear BVH. Objects are sorted along a Morton curve of their centers and
+// every node is split where the highest bit of the codes in its range
+// changes. No SAH is evaluated, i.e. the build cost is dominated by the
+// radix sort.
+
+#define MORTON_BITS 10 // Per axis
+
+// Spreads the lower 10 bits of v to every third bit
+static uint32_t expand_bits(uint32_t v)
+{
+  v = (v * 0x00010001u) & 0xff0000ffu;
+  v = (v * 0x00000101u) & 0x0f00f00fu;
+  v = (v * 0x00000011u) & 0xc30c30c3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+static uint32_t quantize(float v, float lo, float scale)
+{
+  float q = (v - lo) * scale;
+  return q <= 0.0f ? 0 : min((uint32_t)q, (1u << MORTON_BITS) - 1);
+}
+
+static void calc_codes(uint32_t *codes, const vec3 *centers, size_t cnt)
+{
+  aabb bounds = aabb_init();
+  for(size_t i=0; i<cnt; i++)
+    aabb_grow(&bounds, centers[i]);
+
+  // Flat axes map to 0
+  vec3 ext = vec3_sub(bounds.max, bounds.min);
+  float max_q = (float)((1u << MORTON_BITS) - 1);
+  float sx = ext.x > 0.0f ? max_q / ext.x : 0.0f;
+  float sy = ext.y > 0.0f ? max_q / ext.y : 0.0f;
+  float sz = ext.z > 0.0f ? max_q / ext.z : 0.0f;
+
+  for(size_t i=0; i<cnt; i++) {
+    vec3 c = centers[i];
+    codes[i] =
+      (expand_bits(quantize(c.x, bounds.min.x, sx)) << 2) |
+      (expand_bits(quantize(c.y, bounds.min.y, sy)) << 1) |
+      expand_bits(quantize(c.z, bounds.min.z, sz));
+  }
+}
+
+// Returns the object count of the left side of the sorted range, i.e. the
+// first position that has the highest bit set in which the codes of the
+// range differ. Identical codes are split at the median.
+static size_t find_split(const uint32_t *codes, size_t start, size_t cnt)
+{
+  uint32_t first = codes[start];
+  uint32_t last = codes[start + cnt - 1];
+  if(first == last)
+    return cnt / 2;
+
+  uint32_t split_bit = 1u << (31 - __builtin_clz(first ^ last));
+
+  // First has the bit clear and last has it set
+  size_t lo = 1;
+  size_t hi = cnt - 1;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(codes[start + mid] & split_bit)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return lo;
+}
+
+void bvh_create_lbvh(bvh *b, const scn *s)
+{
+  reserve_nodes(b);
+  b->node_cnt = 0;
+  b->depth = 0;
+  b->refit_ready = false;
+  b->leaf_order = false;
+
+  for(size_t i=0; i<s->obj_cnt; i++)
+    b->indices[i] = i;
+
+  size_t cnt = separate_huge_objs(b, s, NULL, s->obj_cnt);
+  b->idx_cnt = cnt;
+
+  // Centers per position, boxes per object id as the sort moves the ids
+  vec3 *centers = malloc(cnt * sizeof(*centers));
+  aabb *boxes = malloc(s->obj_cnt * sizeof(*boxes));
+  for(size_t i=0; i<cnt; i++) {
+    centers[i] = get_obj_center(b, s, i);
+    boxes[b->indices[i]] = get_obj_aabb(b, s, i);
+  }
+
+  uint32_t *codes = malloc(cnt * sizeof(*codes));
+  uint32_t *tmp_codes = malloc(cnt * sizeof(*tmp_codes));
+  uint32_t *tmp_indices = malloc(cnt * sizeof(*tmp_indices));
+
+  calc_codes(codes, centers, cnt);
+  sort_radix(codes, b->indices, tmp_codes, tmp_indices, cnt);
+
+  bvh_node *root = &b->nodes[b->node_cnt++];
+  root->start_idx = 0;
+  root->obj_cnt = cnt;
+
+  // Topology top down, depth first with the left child on top
+  bld_item stack[BVH_MAX_DEPTH + 1];
+  uint32_t stack_cnt = 0;
+  stack[stack_cnt++] = (bld_item){ 0, 0 };
+
+  const bvh_opts *o = &b->opts;
+  while(stack_cnt > 0) {
+    bld_item item = stack[--stack_cnt];
+    bvh_node *n = &b->nodes[item.node_idx];
+    if(item.depth >= o->max_depth || n->obj_cnt <= o->min_leaf_cnt) {
+      b->depth = max(b->depth, item.depth);
+      continue;
+    }
+
+    size_t left_cnt = find_split(codes, n->start_idx, n->obj_cnt);
+
+    // Same fallback as partition_node, children need to reach single
+    // objects within the depth left below them
+    uint32_t depth_left = o->max_depth - item.depth - 1;
+    size_t larger_cnt = max(left_cnt, n->obj_cnt - left_cnt);
+    if(depth_left < 32 && larger_cnt > ((size_t)1 << depth_left))
+      left_cnt = n->obj_cnt / 2;
+
+    uint32_t child_idx = b->node_cnt;
+    b->node_cnt += 2;
+
+    bvh_node *left_child = &b->nodes[child_idx];
+    left_child->start_idx = n->start_idx;
+    left_child->obj_cnt = left_cnt;
+
+    bvh_node *right_child = &b->nodes[child_idx + 1];
+    right_child->start_idx = n->start_idx + left_cnt;
+    right_child->obj_cnt = n->obj_cnt - left_cnt;
+
+    n->start_idx = child_idx; // Right child implicitly + 1
+    n->obj_cnt = 0; // No leaf
+
+    stack[stack_cnt++] = (bld_item){ child_idx + 1, item.depth + 1 };
+    stack[stack_cnt++] = (bld_item){ child_idx, item.depth + 1 };
+  }
+
+  // Bounds bottom up, children are always stored after their parent
+  for(size_t i=b->node_cnt; i-- > 0;) {
+    bvh_node *n = &b->nodes[i];
+    aabb box = aabb_init();
+    if(n->obj_cnt > 0) {
+      for(size_t j=0; j<n->obj_cnt; j++)
+        box = aabb_combine(box, boxes[b->indices[n->start_idx + j]]);
+    } else {
+      const bvh_node *l = &b->nodes[n->start_idx];
+      const bvh_node *r = &b->nodes[n->start_idx + 1];
+      box = aabb_combine((aabb){ l->min, l->max }, (aabb){ r->min, r->max });
+    }
+    n->min = box.min;
+    n->max = box.max;
+  }
+
+  init_huge_node(b, s, NULL);
+
+  free(tmp_indices);
+  free(tmp_codes);
+  free(codes);
+  free(boxes);
+  free(centers);
+}
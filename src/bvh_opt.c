@@ -0,0 +1,316 @@
+#include "bvh.h"
+#include <float.h>
+#include "sutil.h"
+#include "mutil.h"
+#include "aabb.h"
+#include "bvh_int.h"
+
+// Treelet restructuring (Karras and Aila 2013). A treelet is a node with up
+// to TREELET_SIZE descendants, grown by opening the largest of them. The
+// topology over these treelet leaves with the lowest SAH cost is found by
+// dynamic programming over all leaf subsets. Nodes are visited bottom up, so
+// each treelet sees already optimized subtrees below it.
+//
+// The cost is the one of bvh_calc_stats (traversal and intersection cost 1).
+// Leaves are moved as a whole, i.e. object ranges and indices stay as they
+// are. Interior nodes reuse the child pairs of the old treelet, so a moved
+// subtree root can end up after its children. Nodes are thus visited in
+// order of a depth first walk and renumbered depth first after each pass,
+// which puts children after their parent again (bottom up refit order).
+
+#define TREELET_SIZE  7
+#define SUBSET_CNT    (1 << TREELET_SIZE)
+
+typedef struct treelet {
+  uint32_t  leaves[TREELET_SIZE]; // Node indices
+  uint32_t  leaf_cnt;
+  uint32_t  pairs[TREELET_SIZE - 1]; // Child pairs of the interior nodes
+  uint32_t  pair_cnt;
+} treelet;
+
+typedef struct opt_state {
+  bvh       *b;
+  float     *costs; // Per node, SAH cost of the subtree
+  uint8_t   *heights; // Per node, max leaf depth below
+  uint8_t   *depths; // Per node
+  uint32_t  *order; // Depth first, each node before its subtree
+  uint32_t  order_cnt;
+} opt_state;
+
+static float calc_node_area(const bvh_node *n)
+{
+  return aabb_calc_area((aabb){ n->min, n->max });
+}
+
+static void update_node(opt_state *st, uint32_t i)
+{
+  const bvh_node *n = &st->b->nodes[i];
+  float area = calc_node_area(n);
+  if(n->obj_cnt > 0) {
+    st->costs[i] = (n->obj_cnt & BVH_CNT_MASK) * area;
+    st->heights[i] = 0;
+  } else {
+    uint32_t l = n->start_idx;
+    st->costs[i] = area + st->costs[l] + st->costs[l + 1];
+    st->heights[i] = 1 + max(st->heights[l], st->heights[l + 1]);
+  }
+}
+
+// Depth first walk from the root, the node indices need no particular order
+static void init_order(opt_state *st)
+{
+  const bvh *b = st->b;
+  uint32_t *stack = malloc(b->node_cnt * sizeof(*stack));
+  uint32_t spos = 0;
+  stack[spos++] = 0;
+  st->order_cnt = 0;
+  while(spos > 0) {
+    uint32_t i = stack[--spos];
+    st->order[st->order_cnt++] = i;
+    const bvh_node *n = &b->nodes[i];
+    if(n->obj_cnt == 0) {
+      stack[spos++] = n->start_idx + 1;
+      stack[spos++] = n->start_idx;
+    }
+  }
+  free(stack);
+}
+
+// Costs and heights in reverse walk order (post-order), depths in walk order
+static void init_state(opt_state *st)
+{
+  const bvh *b = st->b;
+  for(int64_t k=st->order_cnt - 1; k>=0; k--)
+    update_node(st, st->order[k]);
+
+  st->depths[0] = 0;
+  for(uint32_t k=0; k<st->order_cnt; k++) {
+    const bvh_node *n = &b->nodes[st->order[k]];
+    if(n->obj_cnt == 0) {
+      st->depths[n->start_idx] = st->depths[st->order[k]] + 1;
+      st->depths[n->start_idx + 1] = st->depths[st->order[k]] + 1;
+    }
+  }
+}
+
+// Depth first, each interior node gets the next free child pair
+static void renumber(bvh *b)
+{
+  bvh_node *nodes = malloc(b->node_cnt * sizeof(*nodes));
+  uint32_t *stack = malloc(b->node_cnt * sizeof(*stack));
+  uint32_t spos = 0;
+  uint32_t cnt = 1;
+  nodes[0] = b->nodes[0];
+  stack[spos++] = 0;
+  while(spos > 0) {
+    bvh_node *n = &nodes[stack[--spos]];
+    if(n->obj_cnt == 0) {
+      nodes[cnt] = b->nodes[n->start_idx];
+      nodes[cnt + 1] = b->nodes[n->start_idx + 1];
+      n->start_idx = cnt;
+      stack[spos++] = cnt + 1;
+      stack[spos++] = cnt;
+      cnt += 2;
+    }
+  }
+
+  memcpy(b->nodes, nodes, b->node_cnt * sizeof(*nodes));
+  free(stack);
+  free(nodes);
+}
+
+static void form_treelet(const bvh *b, uint32_t root, treelet *t)
+{
+  const bvh_node *r = &b->nodes[root];
+  t->leaves[0] = r->start_idx;
+  t->leaves[1] = r->start_idx + 1;
+  t->leaf_cnt = 2;
+  t->pairs[0] = r->start_idx;
+  t->pair_cnt = 1;
+
+  // Open the interior treelet leaf with the largest area
+  while(t->leaf_cnt < TREELET_SIZE) {
+    int32_t best = -1;
+    float best_area = -1.0f;
+    for(uint32_t i=0; i<t->leaf_cnt; i++) {
+      const bvh_node *n = &b->nodes[t->leaves[i]];
+      float area = calc_node_area(n);
+      if(n->obj_cnt == 0 && area > best_area) {
+        best = i;
+        best_area = area;
+      }
+    }
+    if(best < 0)
+      break;
+
+    uint32_t first = b->nodes[t->leaves[best]].start_idx;
+    t->leaves[best] = first;
+    t->leaves[t->leaf_cnt++] = first + 1;
+    t->pairs[t->pair_cnt++] = first;
+  }
+
+  // Ascending, keeps the pairs of an unchanged treelet where they are
+  for(uint32_t i=1; i<t->pair_cnt; i++) {
+    uint32_t p = t->pairs[i];
+    uint32_t j = i;
+    for(; j>0 && t->pairs[j - 1] > p; j--)
+      t->pairs[j] = t->pairs[j - 1];
+    t->pairs[j] = p;
+  }
+}
+
+// Returns true if the treelet at root was replaced by a cheaper one
+static bool restructure(opt_state *st, uint32_t root)
+{
+  bvh *b = st->b;
+  treelet t;
+  form_treelet(b, root, &t);
+  if(t.leaf_cnt < 3)
+    return false;
+
+  // Bounds and lowest cost of every subset of treelet leaves
+  uint32_t full = (1u << t.leaf_cnt) - 1;
+  aabb boxes[SUBSET_CNT];
+  float costs[SUBSET_CNT];
+  uint32_t parts[SUBSET_CNT];
+  for(uint32_t i=0; i<t.leaf_cnt; i++) {
+    const bvh_node *n = &b->nodes[t.leaves[i]];
+    boxes[1u << i] = (aabb){ n->min, n->max };
+    costs[1u << i] = st->costs[t.leaves[i]];
+  }
+
+  for(uint32_t s=1; s<=full; s++) {
+    uint32_t low = s & (~s + 1);
+    if(s == low)
+      continue; // Single leaf
+    boxes[s] = aabb_combine(boxes[low], boxes[s ^ low]);
+
+    // Partitions with the lowest leaf on the left side, subsets are smaller
+    // than s and thus done already
+    float best = FLT_MAX;
+    uint32_t best_part = low;
+    uint32_t rest = s ^ low;
+    for(uint32_t p=(rest - 1) & rest;; p=(p - 1) & rest) {
+      uint32_t left = p | low;
+      float c = costs[left] + costs[s ^ left];
+      if(c < best) {
+        best = c;
+        best_part = left;
+      }
+      if(p == 0)
+        break;
+    }
+    costs[s] = aabb_calc_area(boxes[s]) + best;
+    parts[s] = best_part;
+  }
+
+  if(costs[full] >= st->costs[root] * (1.0f - 1e-5f))
+    return false;
+
+  // Lay out breadth first, interior nodes take the pairs in ascending order
+  uint32_t sets[2 * TREELET_SIZE - 1];
+  uint32_t slots[2 * TREELET_SIZE - 1];
+  uint8_t depths[2 * TREELET_SIZE - 1];
+  uint32_t cnt = 0;
+  sets[cnt] = full;
+  slots[cnt] = root;
+  depths[cnt++] = st->depths[root];
+  for(uint32_t i=0, p=0; i<cnt; i++) {
+    if((sets[i] & (sets[i] - 1)) == 0)
+      continue;
+    uint32_t pair = t.pairs[p++];
+    uint32_t left = parts[sets[i]];
+    uint32_t right = sets[i] ^ left;
+    sets[cnt] = left;
+    slots[cnt] = pair;
+    depths[cnt++] = depths[i] + 1;
+    sets[cnt] = right;
+    slots[cnt] = pair + 1;
+    depths[cnt++] = depths[i] + 1;
+  }
+
+  // Leaf subtrees must stay within the max depth
+  bvh_node leaf_nodes[TREELET_SIZE];
+  float leaf_costs[TREELET_SIZE];
+  uint8_t leaf_heights[TREELET_SIZE];
+  for(uint32_t i=0; i<cnt; i++) {
+    if((sets[i] & (sets[i] - 1)) != 0)
+      continue;
+    uint32_t leaf = __builtin_ctz(sets[i]);
+    if(depths[i] + st->heights[t.leaves[leaf]] > b->opts.max_depth)
+      return false;
+  }
+  for(uint32_t i=0; i<t.leaf_cnt; i++) {
+    leaf_nodes[i] = b->nodes[t.leaves[i]];
+    leaf_costs[i] = st->costs[t.leaves[i]];
+    leaf_heights[i] = st->heights[t.leaves[i]];
+  }
+
+  // Write bottom up so that children are complete before their parent
+  for(int32_t i=cnt - 1; i>=0; i--) {
+    uint32_t slot = slots[i];
+    bvh_node *n = &b->nodes[slot];
+    if((sets[i] & (sets[i] - 1)) == 0) {
+      uint32_t leaf = __builtin_ctz(sets[i]);
+      *n = leaf_nodes[leaf];
+      st->costs[slot] = leaf_costs[leaf];
+      st->heights[slot] = leaf_heights[leaf];
+    } else {
+      n->min = boxes[sets[i]].min;
+      n->max = boxes[sets[i]].max;
+      n->obj_cnt = 0;
+      st->costs[slot] = costs[sets[i]];
+    }
+    st->depths[slot] = depths[i];
+  }
+
+  // Interior start indices and heights, the pairs follow the layout order
+  for(uint32_t i=0, p=0; i<cnt; i++) {
+    if((sets[i] & (sets[i] - 1)) != 0)
+      b->nodes[slots[i]].start_idx = t.pairs[p++];
+  }
+  for(int32_t i=cnt - 1; i>=0; i--) {
+    const bvh_node *n = &b->nodes[slots[i]];
+    if((sets[i] & (sets[i] - 1)) != 0)
+      st->heights[slots[i]] = 1 +
+        max(st->heights[n->start_idx], st->heights[n->start_idx + 1]);
+  }
+
+  return true;
+}
+
+float bvh_optimize_pass(bvh *b)
+{
+  if(b->node_cnt < 3)
+    return bvh_calc_stats(b).sah_cost;
+
+  opt_state st = { .b = b };
+  st.costs = malloc(b->node_cnt * sizeof(*st.costs));
+  st.heights = malloc(2 * b->node_cnt * sizeof(*st.heights));
+  st.depths = st.heights + b->node_cnt;
+  st.order = malloc(b->node_cnt * sizeof(*st.order));
+  init_order(&st);
+  init_state(&st);
+
+  // Bottom up in reverse walk order. A treelet only moves nodes within the
+  // subtree of its root, which are visited already. Restructured treelets
+  // change the costs and heights of all their ancestors.
+  for(int64_t k=st.order_cnt - 1; k>=0; k--) {
+    uint32_t i = st.order[k];
+    if(b->nodes[i].obj_cnt == 0) {
+      update_node(&st, i);
+      restructure(&st, i);
+    }
+  }
+
+  // Max leaf depth, the root's height is up to date after the walk
+  b->depth = st.heights[0];
+  renumber(b);
+  b->refit_ready = false;
+
+  free(st.order);
+  free(st.heights);
+  free(st.costs);
+
+  return bvh_calc_stats(b).sah_cost;
+}
@@ -0,0 +1,222 @@
+#include "bvh.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "sutil.h"
+#include "mutil.h"
+#include "scn.h"
+#include "sys.h"
+#include "pool.h"
+#include "bvh_int.h"
+
+// Parallel build of the native version. Nodes with many objects are split
+// one after another with the binning work spread across all threads. The
+// remaining subtrees are built by tasks of a work-stealing pool. The tree
+// topology is the same as the one of bvh_create, only the node order differs.
+
+#define PAR_BIN_MIN_CNT 65536 // Nodes with more objects bin on all threads
+#define TASK_MIN_CNT    512   // Smaller subtrees are built within one task
+
+typedef struct par_bld {
+  bvh           *b;
+  prim_cache    c;
+  pool          *p;
+  atomic_size_t node_cnt;
+  atomic_uint   depth;
+} par_bld;
+
+typedef struct par_bin {
+  const bvh         *b;
+  const prim_cache  *c;
+  const bvh_node    *n;
+  uint32_t          thread_cnt;
+  aabb              *center_bounds; // Per thread
+  interval_set      *sets; // Per thread
+  aabb              merged_center_bounds;
+} par_bin;
+
+static void get_chunk(const par_bin *x, uint32_t thread_idx,
+    size_t *start, size_t *cnt)
+{
+  size_t per_thread = (x->n->obj_cnt + x->thread_cnt - 1) / x->thread_cnt;
+  size_t ofs = min(thread_idx * per_thread, (size_t)x->n->obj_cnt);
+  *start = x->n->start_idx + ofs;
+  *cnt = min(per_thread, x->n->obj_cnt - ofs);
+}
+
+static void calc_center_bounds_chunk(void *ctx, uint32_t thread_idx)
+{
+  par_bin *x = ctx;
+  size_t start, cnt;
+  get_chunk(x, thread_idx, &start, &cnt);
+  x->center_bounds[thread_idx] = calc_center_bounds(x->c, start, cnt);
+}
+
+static void bin_chunk(void *ctx, uint32_t thread_idx)
+{
+  par_bin *x = ctx;
+  size_t start, cnt;
+  get_chunk(x, thread_idx, &start, &cnt);
+  init_intervals(&x->sets[thread_idx], x->b->opts.interval_cnt);
+  bin_prims(&x->sets[thread_idx], x->c, start, cnt, x->merged_center_bounds);
+}
+
+static split find_best_split_par(par_bin *x)
+{
+  sys_run_threads(x->thread_cnt, calc_center_bounds_chunk, x);
+
+  x->merged_center_bounds = aabb_init();
+  for(uint32_t i=0; i<x->thread_cnt; i++)
+    x->merged_center_bounds =
+      aabb_combine(x->merged_center_bounds, x->center_bounds[i]);
+
+  sys_run_threads(x->thread_cnt, bin_chunk, x);
+
+  for(uint32_t i=1; i<x->thread_cnt; i++)
+    merge_intervals(&x->sets[0], &x->sets[i]);
+
+  return find_best_interval_split(&x->sets[0], x->merged_center_bounds);
+}
+
+// Task args hold node index and depth of the subtree root
+static size_t pack_item(bld_item item)
+{
+  return ((size_t)item.depth << 32) | item.node_idx;
+}
+
+static bld_item unpack_item(size_t arg)
+{
+  return (bld_item){ arg & 0xffffffff, arg >> 32 };
+}
+
+static void update_depth(par_bld *x, uint32_t depth)
+{
+  uint32_t curr = atomic_load(&x->depth);
+  while(curr < depth && !atomic_compare_exchange_weak(&x->depth, &curr, depth));
+}
+
+static void subdivide_task(void *ctx, size_t arg, uint32_t worker_idx)
+{
+  par_bld *x = ctx;
+
+  // Same work queue as bvh_create, left children with enough objects are
+  // handed off to the pool
+  bld_item stack[BVH_MAX_DEPTH + 1];
+  uint32_t stack_cnt = 0;
+  stack[stack_cnt++] = unpack_item(arg);
+  uint32_t depth = 0;
+
+  while(stack_cnt > 0) {
+    bld_item item = stack[--stack_cnt];
+    bvh_node *n = &x->b->nodes[item.node_idx];
+    size_t left_obj_cnt = split_node(x->b, &x->c, n, item.depth);
+    if(left_obj_cnt == 0) {
+      depth = max(depth, item.depth);
+      continue;
+    }
+
+    uint32_t child_idx = atomic_fetch_add(&x->node_cnt, 2);
+    link_child_nodes(x->b, &x->c, n, child_idx, left_obj_cnt);
+
+    bld_item left = { child_idx, item.depth + 1 };
+    if(left_obj_cnt >= TASK_MIN_CNT)
+      pool_push(x->p, worker_idx, subdivide_task, x, pack_item(left));
+    else
+      stack[stack_cnt++] = left;
+
+    stack[stack_cnt++] = (bld_item){ child_idx + 1, item.depth + 1 };
+  }
+
+  update_depth(x, depth);
+}
+
+void bvh_create_par(bvh *b, const scn *s, uint32_t thread_cnt)
+{
+  if(b->opts.spatial_splits) {
+    bvh_create(b, s);
+    return;
+  }
+
+  reserve_nodes(b);
+  thread_cnt = max(thread_cnt, 1u);
+  b->refit_ready = false;
+  b->leaf_order = false;
+
+  for(size_t i=0; i<s->obj_cnt; i++)
+    b->indices[i] = i;
+
+  size_t cnt = separate_huge_objs(b, s, NULL, s->obj_cnt);
+  b->idx_cnt = cnt;
+
+  par_bld x = { .b = b, .p = pool_init(thread_cnt) };
+  init_prim_cache(&x.c, b, s, NULL, cnt);
+  atomic_init(&x.node_cnt, 1);
+  atomic_init(&x.depth, 0);
+
+  bvh_node *root = &b->nodes[0];
+  root->start_idx = 0;
+  root->obj_cnt = cnt;
+  update_node_bounds(&x.c, root);
+
+  par_bin pb = { .b = b, .c = &x.c, .thread_cnt = thread_cnt,
+    .center_bounds = malloc(thread_cnt * sizeof(*pb.center_bounds)),
+    .sets = malloc(thread_cnt * sizeof(*pb.sets)) };
+
+  // Nodes on the stack are disjoint and have at least PAR_BIN_MIN_CNT objects
+  bld_item *stack = malloc((cnt / PAR_BIN_MIN_CNT + 1) * sizeof(*stack));
+  uint32_t stack_cnt = 0;
+  uint32_t task_cnt = 0;
+
+  // The full sweep SAH is not spread across threads, its tasks start at root
+  if(root->obj_cnt >= PAR_BIN_MIN_CNT && !b->opts.full_sweep)
+    stack[stack_cnt++] = (bld_item){ 0, 0 };
+  else
+    pool_push(x.p, 0, subdivide_task, &x, pack_item((bld_item){ 0, 0 }));
+
+  // Top levels, split one node at a time and bin on all threads
+  while(stack_cnt > 0) {
+    bld_item item = stack[--stack_cnt];
+    bvh_node *n = &b->nodes[item.node_idx];
+    if(item.depth >= b->opts.max_depth || n->obj_cnt <= b->opts.min_leaf_cnt) {
+      update_depth(&x, item.depth);
+      continue;
+    }
+
+    pb.n = n;
+    split sp = find_best_split_par(&pb);
+    uint32_t depth_left = b->opts.max_depth - item.depth - 1;
+    size_t left_obj_cnt = partition_node(b, &x.c, n, sp, depth_left);
+    if(left_obj_cnt == 0 && x.c.scn)
+      left_obj_cnt = partition_node_type(b, &x.c, n, depth_left);
+    if(left_obj_cnt == 0) {
+      update_depth(&x, item.depth);
+      continue;
+    }
+
+    uint32_t child_idx = atomic_fetch_add(&x.node_cnt, 2);
+    link_child_nodes(b, &x.c, n, child_idx, left_obj_cnt);
+
+    for(uint32_t i=child_idx; i<child_idx + 2; i++) {
+      bld_item child = { i, item.depth + 1 };
+      if(b->nodes[i].obj_cnt >= PAR_BIN_MIN_CNT)
+        stack[stack_cnt++] = child;
+      else
+        pool_push(x.p, task_cnt++ % thread_cnt, subdivide_task, &x,
+            pack_item(child));
+    }
+  }
+
+  // Independent subtrees
+  pool_run(x.p);
+
+  b->node_cnt = atomic_load(&x.node_cnt);
+  b->depth = atomic_load(&x.depth);
+  init_huge_node(b, s, NULL);
+  if(b->opts.typed_leaves)
+    tag_leaves(b, s);
+
+  free(stack);
+  free(pb.sets);
+  free(pb.center_bounds);
+  release_prim_cache(&x.c);
+  pool_release(x.p);
+}
@@ -0,0 +1,516 @@
+#include "bvh.h"
+#include <float.h>
+#include "sutil.h"
+#include "mutil.h"
+#include "scn.h"
+#include "obj.h"
+#include "shape.h"
+#include "bvh_int.h"
+
+// Spatial split BVH (SBVH, Stich et al. 2009). Nodes whose best object split
+// has overlapping children also try spatial splits. These chop the object
+// references at a plane, an object straddling it is then referenced by both
+// children with bounds clipped to each side. Straddlers stay on one side if
+// that is cheaper (unsplitting) or if the reference budget is used up.
+//
+// References are kept on a stack. A node being split owns the top of the
+// stack, its children are written to the same place, left below right. The
+// right child is built first, references of leaves move to b->indices.
+
+#define OVERLAP_RATIO 1e-5f // Of the root area, less overlap is not split
+
+typedef struct ref_stack {
+  prim_cache  c; // Per position, clipped bounds and their centers
+  uint32_t    *ids; // Per position
+} ref_stack;
+
+typedef struct sbvh_bld {
+  bvh         *b;
+  const scn   *s;
+  ref_stack   refs;
+  ref_stack   tmp; // Right side of a spatial split
+  size_t      ref_cnt; // Created references
+  size_t      ref_cap; // Indices left besides the huge objects
+  float       min_overlap;
+} sbvh_bld;
+
+typedef struct spatial_bin {
+  aabb    aabb;
+  size_t  enter_cnt; // References starting in this bin
+  size_t  exit_cnt; // References ending in this bin
+} spatial_bin;
+
+typedef struct spatial_split {
+  float     cost; // Same measure as split.cost
+  uint8_t   axis;
+  uint32_t  bin; // Last bin of the left side
+  float     pos;
+  float     lo; // Bin layout
+  float     inv_width;
+  aabb      left; // Bounds of both sides
+  aabb      right;
+  size_t    left_cnt;
+  size_t    right_cnt;
+} spatial_split;
+
+static void init_ref_stack(ref_stack *r, size_t cap)
+{
+  alloc_prim_cache(&r->c, cap);
+  r->c.sweep = NULL;
+  r->c.scn = NULL;
+  r->ids = malloc(cap * sizeof(*r->ids));
+}
+
+static void release_ref_stack(ref_stack *r)
+{
+  free(r->ids);
+  release_prim_cache(&r->c);
+}
+
+static aabb get_ref_box(const ref_stack *r, size_t i)
+{
+  return get_prim_aabb(&r->c, i);
+}
+
+static void set_ref(ref_stack *r, size_t i, uint32_t id, aabb box)
+{
+  r->ids[i] = id;
+  set_prim(&r->c, i, vec3_scale(vec3_add(box.min, box.max), 0.5f), box);
+}
+
+static void copy_ref(ref_stack *dst, size_t i, const ref_stack *src, size_t j)
+{
+  set_ref(dst, i, src->ids[j], get_ref_box(src, j));
+}
+
+static void swap_refs(ref_stack *r, size_t i, size_t j)
+{
+  uint32_t id = r->ids[i];
+  aabb box = get_ref_box(r, i);
+  copy_ref(r, i, r, j);
+  set_ref(r, j, id, box);
+}
+
+static bool is_empty(aabb a)
+{
+  return a.min.x > a.max.x || a.min.y > a.max.y || a.min.z > a.max.z;
+}
+
+static aabb intersect_boxes(aabb a, aabb b)
+{
+  return (aabb){ vec3_max(a.min, b.min), vec3_min(a.max, b.max) };
+}
+
+// Bounds of the part of the object within box on the left (below pos) or
+// right side of the plane. Empty if the object does not reach that side.
+// Quads are clipped exactly, other shapes by their box.
+static aabb clip_ref(const scn *s, uint32_t id, aabb box, uint8_t axis,
+    float pos, bool left)
+{
+  if(left)
+    vec3_set(&box.max, axis, min(vec3_get(box.max, axis), pos));
+  else
+    vec3_set(&box.min, axis, max(vec3_get(box.min, axis), pos));
+
+  const obj *o = scn_get_obj(s, id);
+  if((o->shape_type != QUAD && o->shape_type != QUAD_BAKED) || is_empty(box))
+    return box;
+
+  const quad *q = scn_get_shape(s, o->shape_ofs);
+  vec3 verts[4] = { q->q, vec3_add(q->q, q->u),
+    vec3_add(vec3_add(q->q, q->u), q->v), vec3_add(q->q, q->v) };
+
+  // Bounds of the polygon clipped to the side, i.e. of the vertices on that
+  // side and the edge crossings of the plane
+  aabb clipped = aabb_init();
+  float sgn = left ? -1.0f : 1.0f;
+  for(uint8_t i=0; i<4; i++) {
+    vec3 a = verts[i];
+    vec3 b = verts[(i + 1) % 4];
+    float da = sgn * (vec3_get(a, axis) - pos);
+    float db = sgn * (vec3_get(b, axis) - pos);
+    if(da >= 0.0f)
+      aabb_grow(&clipped, a);
+    if((da < 0.0f && db > 0.0f) || (da > 0.0f && db < 0.0f)) {
+      vec3 p = vec3_add(a, vec3_scale(vec3_sub(b, a), da / (da - db)));
+      vec3_set(&p, axis, pos);
+      aabb_grow(&clipped, p);
+    }
+  }
+
+  if(is_empty(clipped))
+    return clipped;
+
+  // Same padding of flat sides as the unclipped quad bounds
+  aabb_pad(&clipped);
+  return intersect_boxes(clipped, box);
+}
+
+static uint32_t get_bin(const spatial_split *sp, float v, uint32_t bin_cnt)
+{
+  float f = (v - sp->lo) * sp->inv_width;
+  return f <= 0.0f ? 0 : min(bin_cnt - 1, (uint32_t)f);
+}
+
+static void bin_refs(const sbvh_bld *x, const bvh_node *n,
+    const spatial_split *sp, spatial_bin *bins, uint32_t bin_cnt)
+{
+  for(uint32_t i=0; i<bin_cnt; i++)
+    bins[i] = (spatial_bin){ aabb_init(), 0, 0 };
+
+  uint8_t axis = sp->axis;
+  float width = 1.0f / sp->inv_width;
+  for(size_t i=n->start_idx; i<n->start_idx + n->obj_cnt; i++) {
+    uint32_t id = x->refs.ids[i];
+    aabb box = get_ref_box(&x->refs, i);
+    uint32_t first = get_bin(sp, vec3_get(box.min, axis), bin_cnt);
+    uint32_t last = get_bin(sp, vec3_get(box.max, axis), bin_cnt);
+    bins[first].enter_cnt++;
+    bins[last].exit_cnt++;
+
+    // Chop the reference at each bin plane it crosses
+    for(uint32_t j=first; j<last; j++) {
+      float pos = sp->lo + (j + 1) * width;
+      aabb part = clip_ref(x->s, id, box, axis, pos, true);
+      if(!is_empty(part))
+        bins[j].aabb = aabb_combine(bins[j].aabb, part);
+      box = clip_ref(x->s, id, box, axis, pos, false);
+      if(is_empty(box))
+        break;
+    }
+    if(!is_empty(box))
+      bins[last].aabb = aabb_combine(bins[last].aabb, box);
+  }
+}
+
+static spatial_split find_spatial_split(const sbvh_bld *x, const bvh_node *n)
+{
+  spatial_split best = { .cost = FLT_MAX };
+  uint32_t bin_cnt = x->b->opts.interval_cnt;
+  for(uint8_t axis=0; axis<3; axis++) {
+    float lo = vec3_get(n->min, axis);
+    float ext = vec3_get(n->max, axis) - lo;
+    if(ext < EPSILON)
+      continue;
+
+    spatial_split sp = { .axis = axis, .lo = lo, .inv_width = bin_cnt / ext };
+    spatial_bin bins[BVH_MAX_INTERVALS];
+    bin_refs(x, n, &sp, bins, bin_cnt);
+
+    // Right side bounds and counts for each plane separating the bins
+    aabb boxes_r[BVH_MAX_INTERVALS - 1];
+    size_t cnts_r[BVH_MAX_INTERVALS - 1];
+    aabb box_r = aabb_init();
+    size_t cnt_r = 0;
+    for(uint32_t i=bin_cnt - 1; i>0; i--) {
+      box_r = aabb_combine(box_r, bins[i].aabb);
+      cnt_r += bins[i].exit_cnt;
+      boxes_r[i - 1] = box_r;
+      cnts_r[i - 1] = cnt_r;
+    }
+
+    aabb box_l = aabb_init();
+    size_t cnt_l = 0;
+    for(uint32_t i=0; i<bin_cnt - 1; i++) {
+      box_l = aabb_combine(box_l, bins[i].aabb);
+      cnt_l += bins[i].enter_cnt;
+      if(cnt_l == 0 || cnts_r[i] == 0)
+        continue;
+      float cost = cnt_l * aabb_calc_area(box_l) +
+        cnts_r[i] * aabb_calc_area(boxes_r[i]);
+      if(cost < best.cost) {
+        best = sp;
+        best.cost = cost;
+        best.bin = i;
+        best.pos = lo + (i + 1) * (ext / bin_cnt);
+        best.left = box_l;
+        best.right = boxes_r[i];
+        best.left_cnt = cnt_l;
+        best.right_cnt = cnts_r[i];
+      }
+    }
+  }
+
+  return best;
+}
+
+// Overlap of the children of the object split
+static float calc_overlap(const sbvh_bld *x, const bvh_node *n, split sp)
+{
+  aabb box_l = aabb_init();
+  aabb box_r = aabb_init();
+  const prim_cache *c = &x->refs.c;
+  for(size_t i=n->start_idx; i<n->start_idx + n->obj_cnt; i++)
+    grow_by_prim(c->center[sp.axis][i] < sp.pos ? &box_l : &box_r, c, i);
+
+  aabb overlap = intersect_boxes(box_l, box_r);
+  return is_empty(overlap) ? 0.0f : aabb_calc_area(overlap);
+}
+
+// Returns the reference count of the left side, see partition_node
+static size_t partition_object(sbvh_bld *x, const bvh_node *n, split sp)
+{
+  const float *centers = x->refs.c.center[sp.axis];
+  size_t l = n->start_idx;
+  size_t r = n->start_idx + n->obj_cnt;
+  while(l < r) {
+    if(centers[l] < sp.pos)
+      l++;
+    else
+      swap_refs(&x->refs, l, --r);
+  }
+
+  return l - n->start_idx;
+}
+
+static size_t partition_median(sbvh_bld *x, const bvh_node *n)
+{
+  aabb cb = calc_center_bounds(&x->refs.c, n->start_idx, n->obj_cnt);
+  vec3 ext = vec3_sub(cb.max, cb.min);
+  uint8_t axis = (ext.x > ext.y && ext.x > ext.z) ? 0 : ((ext.y > ext.z) ? 1 : 2);
+
+  // Quickselect, left half ends up with the smaller centers
+  const float *centers = x->refs.c.center[axis];
+  int64_t lo = n->start_idx;
+  int64_t hi = n->start_idx + n->obj_cnt - 1;
+  int64_t k = n->start_idx + n->obj_cnt / 2;
+  while(lo < hi) {
+    float pivot = centers[lo + (hi - lo) / 2];
+    int64_t l = lo;
+    int64_t r = hi;
+    while(l <= r) {
+      while(centers[l] < pivot)
+        l++;
+      while(centers[r] > pivot)
+        r--;
+      if(l <= r)
+        swap_refs(&x->refs, l++, r--);
+    }
+    if(k <= r)
+      hi = r;
+    else if(k >= l)
+      lo = l;
+    else
+      break;
+  }
+
+  return n->obj_cnt / 2;
+}
+
+// Left side stays in place, the right side is collected in tmp and copied
+// after it. Returns the reference count of the left side.
+static size_t partition_spatial(sbvh_bld *x, const bvh_node *n,
+    const spatial_split *sp, size_t *right_cnt)
+{
+  uint32_t bin_cnt = x->b->opts.interval_cnt;
+  float area_l = aabb_calc_area(sp->left);
+  float area_r = aabb_calc_area(sp->right);
+  float cnt_l = sp->left_cnt;
+  float cnt_r = sp->right_cnt;
+
+  size_t start = n->start_idx;
+  size_t l = start;
+  size_t r = 0;
+  for(size_t i=start; i<start + n->obj_cnt; i++) {
+    uint32_t id = x->refs.ids[i];
+    aabb box = get_ref_box(&x->refs, i);
+    uint32_t first = get_bin(sp, vec3_get(box.min, sp->axis), bin_cnt);
+    uint32_t last = get_bin(sp, vec3_get(box.max, sp->axis), bin_cnt);
+    if(last <= sp->bin) {
+      set_ref(&x->refs, l++, id, box);
+      continue;
+    }
+    if(first > sp->bin) {
+      set_ref(&x->tmp, r++, id, box);
+      continue;
+    }
+
+    // Straddler, l <= i, i.e. writing left never overwrites unread refs
+    aabb box_l = clip_ref(x->s, id, box, sp->axis, sp->pos, true);
+    aabb box_r = clip_ref(x->s, id, box, sp->axis, sp->pos, false);
+    if(is_empty(box_l) || is_empty(box_r)) {
+      if(is_empty(box_r))
+        set_ref(&x->refs, l++, id, box_l);
+      else
+        set_ref(&x->tmp, r++, id, box_r);
+      continue;
+    }
+
+    // Unsplitting, keep the whole reference on one side if cheaper
+    float cost_dup = area_l * cnt_l + area_r * cnt_r;
+    float cost_l = aabb_calc_area(aabb_combine(sp->left, box)) * cnt_l +
+      area_r * (cnt_r - 1);
+    float cost_r = area_l * (cnt_l - 1) +
+      aabb_calc_area(aabb_combine(sp->right, box)) * cnt_r;
+    bool full = x->ref_cnt >= x->ref_cap;
+    if(!full && cost_dup < cost_l && cost_dup < cost_r) {
+      set_ref(&x->refs, l++, id, box_l);
+      set_ref(&x->tmp, r++, id, box_r);
+      x->ref_cnt++;
+    } else if(cost_l <= cost_r) {
+      set_ref(&x->refs, l++, id, box);
+    } else {
+      set_ref(&x->tmp, r++, id, box);
+    }
+  }
+
+  for(size_t i=0; i<r; i++)
+    copy_ref(&x->refs, l + i, &x->tmp, i);
+
+  *right_cnt = r;
+  return l - start;
+}
+
+// Returns the reference count of the left side and sets the one of the
+// right side, 0 if n should stay a leaf
+static size_t split_ref_node(sbvh_bld *x, const bvh_node *n, uint32_t depth,
+    size_t *right_cnt)
+{
+  const bvh_opts *o = &x->b->opts;
+  if(depth >= o->max_depth || n->obj_cnt <= o->min_leaf_cnt)
+    return 0;
+
+  // Binned object split
+  aabb center_bounds =
+    calc_center_bounds(&x->refs.c, n->start_idx, n->obj_cnt);
+  interval_set is;
+  init_intervals(&is, o->interval_cnt);
+  bin_prims(&is, &x->refs.c, n->start_idx, n->obj_cnt, center_bounds);
+  split sp = find_best_interval_split(&is, center_bounds);
+
+  // Spatial split if the object split children overlap noticeably
+  uint32_t depth_left = o->max_depth - depth - 1;
+  spatial_split ssp = { .cost = FLT_MAX };
+  if(x->ref_cnt < x->ref_cap &&
+      (sp.cost == FLT_MAX || calc_overlap(x, n, sp) > x->min_overlap)) {
+    ssp = find_spatial_split(x, n);
+    if(max(ssp.left_cnt, ssp.right_cnt) > ((uint64_t)1 << depth_left))
+      ssp.cost = FLT_MAX;
+  }
+
+  bool force = n->obj_cnt > o->max_leaf_cnt;
+  float best_cost = min(sp.cost, ssp.cost);
+  size_t left_cnt = 0;
+  if(best_cost == FLT_MAX) {
+    if(!force)
+      return 0;
+    left_cnt = partition_median(x, n);
+    *right_cnt = n->obj_cnt - left_cnt;
+    return left_cnt;
+  }
+
+  float area = aabb_calc_area((aabb){ n->min, n->max });
+  float leaf_cost = o->isect_cost * n->obj_cnt * area;
+  float split_cost = o->trav_cost * area + o->isect_cost * best_cost;
+  if(!force && leaf_cost <= split_cost)
+    return 0;
+
+  if(ssp.cost < sp.cost) {
+    left_cnt = partition_spatial(x, n, &ssp, right_cnt);
+    if(left_cnt > 0 && *right_cnt > 0)
+      return left_cnt;
+    // All references ended up on one side, none was duplicated
+    if(sp.cost == FLT_MAX)
+      return force ? partition_median(x, n) : 0;
+  }
+
+  left_cnt = partition_object(x, n, sp);
+  if(left_cnt == 0 || left_cnt == n->obj_cnt) {
+    if(!force)
+      return 0;
+    left_cnt = partition_median(x, n);
+  }
+
+  size_t max_child_cnt = max(left_cnt, n->obj_cnt - left_cnt);
+  if(max_child_cnt > ((uint64_t)1 << depth_left))
+    left_cnt = partition_median(x, n);
+
+  *right_cnt = n->obj_cnt - left_cnt;
+  return left_cnt;
+}
+
+static void emit_leaf(sbvh_bld *x, bvh_node *n)
+{
+  bvh *b = x->b;
+  for(size_t i=0; i<n->obj_cnt; i++)
+    b->indices[b->idx_cnt + i] = x->refs.ids[n->start_idx + i];
+  n->start_idx = b->idx_cnt;
+  b->idx_cnt += n->obj_cnt;
+}
+
+void build_sbvh(bvh *b, const scn *s)
+{
+  reserve_nodes(b);
+  b->node_cnt = 0;
+  b->depth = 0;
+  b->refit_ready = false;
+  b->leaf_order = false;
+
+  for(size_t i=0; i<s->obj_cnt; i++)
+    b->indices[i] = i;
+
+  // Leaves overwrite the indices, the huge objects are appended at the end
+  size_t cnt = separate_huge_objs(b, s, NULL, s->obj_cnt);
+  uint32_t huge_ids[BVH_MAX_HUGE];
+  for(size_t i=0; i<b->huge_cnt; i++)
+    huge_ids[i] = b->indices[cnt + i];
+
+  sbvh_bld x = { .b = b, .s = s, .ref_cnt = cnt,
+    .ref_cap = b->idx_cap - b->huge_cnt };
+  init_ref_stack(&x.refs, x.ref_cap);
+  init_ref_stack(&x.tmp, x.ref_cap);
+
+  for(size_t i=0; i<cnt; i++)
+    set_ref(&x.refs, i, b->indices[i], get_obj_aabb(b, s, i));
+  b->idx_cnt = 0;
+
+  // Pending nodes address their references on the stack
+  bvh_node *root = &b->nodes[b->node_cnt++];
+  root->start_idx = 0;
+  root->obj_cnt = cnt;
+  update_node_bounds(&x.refs.c, root);
+  x.min_overlap = OVERLAP_RATIO * aabb_calc_area((aabb){ root->min, root->max });
+
+  bld_item stack[BVH_MAX_DEPTH + 1];
+  uint32_t stack_cnt = 0;
+  stack[stack_cnt++] = (bld_item){ 0, 0 };
+
+  while(stack_cnt > 0) {
+    bld_item item = stack[--stack_cnt];
+    bvh_node *n = &b->nodes[item.node_idx];
+    size_t right_cnt;
+    size_t left_cnt = split_ref_node(&x, n, item.depth, &right_cnt);
+    if(left_cnt == 0) {
+      emit_leaf(&x, n);
+      b->depth = max(b->depth, item.depth);
+      continue;
+    }
+
+    uint32_t child_idx = b->node_cnt;
+    b->node_cnt += 2;
+
+    bvh_node *left_child = &b->nodes[child_idx];
+    left_child->start_idx = n->start_idx;
+    left_child->obj_cnt = left_cnt;
+    update_node_bounds(&x.refs.c, left_child);
+
+    bvh_node *right_child = &b->nodes[child_idx + 1];
+    right_child->start_idx = n->start_idx + left_cnt;
+    right_child->obj_cnt = right_cnt;
+    update_node_bounds(&x.refs.c, right_child);
+
+    n->start_idx = child_idx; // Right child implicitly + 1
+    n->obj_cnt = 0; // No leaf
+
+    // Right child on top, it owns the top of the reference stack
+    stack[stack_cnt++] = (bld_item){ child_idx, item.depth + 1 };
+    stack[stack_cnt++] = (bld_item){ child_idx + 1, item.depth + 1 };
+  }
+
+  for(size_t i=0; i<b->huge_cnt; i++)
+    b->indices[b->idx_cnt + i] = huge_ids[i];
+  init_huge_node(b, s, NULL);
+
+  release_ref_stack(&x.tmp);
+  release_ref_stack(&x.refs);
+}
@@ -0,0 +1,212 @@
+#include "cbvh.h"
+#include <stdbool.h>
+#include "sutil.h"
+#include "bvh.h"
+#include "scn.h"
+#include "ray.h"
+
+#define MIN_EXP -126 // Normal floats only
+#define MAX_EXP 127
+
+typedef struct entry {
+  uint32_t  node_idx;
+  vec3      min; // Decoded bounds of the node
+} entry;
+
+// Offsets times a power of two are exact, i.e. decoding rounds only once
+// and gives the same result wherever it is done
+static float get_scale(int32_t e)
+{
+  union { float f; uint32_t u; } v = { .u = (uint32_t)(e + 127) << 23 };
+  return v.f;
+}
+
+// Smallest exponent whose 255 steps reach ext
+static int32_t calc_exp(float ext)
+{
+  union { float f; uint32_t u; } v = { .f = ext / 255.0f };
+  if(v.f <= 0.0f)
+    return MIN_EXP;
+  int32_t e = (int32_t)((v.u >> 23) & 0xff) - 127;
+  if(v.u & 0x7fffff)
+    e++; // Round up if not a power of two
+  return e < MIN_EXP ? MIN_EXP : (e > MAX_EXP ? MAX_EXP : e);
+}
+
+static float decode(float lo, uint8_t q, float scale)
+{
+  return lo + q * scale;
+}
+
+// Quantizes [cmin, cmax] conservatively, false if 255 steps do not reach cmax
+static bool quantize(float lo, float scale, float cmin, float cmax,
+    uint8_t *qmin, uint8_t *qmax)
+{
+  float a = (cmin - lo) / scale;
+  int32_t q = a <= 0.0f ? 0 : (a >= 255.0f ? 255 : (int32_t)a);
+  while(q > 0 && decode(lo, q, scale) > cmin)
+    q--;
+  *qmin = q;
+
+  float b = (cmax - lo) / scale;
+  q = b <= 0.0f ? 0 : (b >= 255.0f ? 255 : (int32_t)b);
+  while(q < 255 && decode(lo, q, scale) < cmax)
+    q++;
+  *qmax = q;
+
+  return decode(lo, q, scale) >= cmax;
+}
+
+// Quantizes both children of binary node bn relative to the decoded bounds
+// of bn (lo, hi) and writes their decoded bounds
+static void encode_node(cbvh_node *n, const bvh *b, const bvh_node *bn,
+    vec3 lo, vec3 hi, vec3 *child_min, vec3 *child_max)
+{
+  const bvh_node *children = &b->nodes[bn->start_idx];
+  for(uint8_t a=0; a<3; a++) {
+    float l = vec3_get(lo, a);
+    int32_t e = calc_exp(vec3_get(hi, a) - l);
+    for(;; e++) {
+      float scale = get_scale(e);
+      bool ok = true;
+      for(uint8_t i=0; i<2; i++)
+        ok &= quantize(l, scale, vec3_get(children[i].min, a),
+            vec3_get(children[i].max, a), &n->qmin[i][a], &n->qmax[i][a]);
+      if(ok || e == MAX_EXP)
+        break;
+    }
+    n->exp[a] = e;
+  }
+  n->pad = 0;
+
+  for(uint8_t i=0; i<2; i++) {
+    vec3 scale = { get_scale(n->exp[0]), get_scale(n->exp[1]),
+      get_scale(n->exp[2]) };
+    child_min[i] = (vec3){ decode(lo.x, n->qmin[i][0], scale.x),
+      decode(lo.y, n->qmin[i][1], scale.y), decode(lo.z, n->qmin[i][2], scale.z) };
+    child_max[i] = (vec3){ decode(lo.x, n->qmax[i][0], scale.x),
+      decode(lo.y, n->qmax[i][1], scale.y), decode(lo.z, n->qmax[i][2], scale.z) };
+  }
+}
+
+cbvh *cbvh_create(const bvh *b)
+{
+  // Interior nodes of the binary tree
+  size_t max_node_cnt = b->node_cnt / 2;
+
+  cbvh *c = malloc(sizeof(*c));
+  c->nodes = malloc(max_node_cnt * sizeof(*c->nodes));
+  c->min = b->nodes[0].min;
+  c->max = b->nodes[0].max;
+  c->indices = b->indices;
+  c->root_start = b->nodes[0].start_idx;
+  c->root_cnt = b->nodes[0].obj_cnt;
+  c->huge_start = b->nodes[b->node_cnt].start_idx;
+  c->huge_cnt = b->nodes[b->node_cnt].obj_cnt;
+  c->node_cnt = 0;
+  if(c->root_cnt > 0)
+    return c;
+
+  // Binary node and its decoded bounds per compressed node, breadth first
+  uint32_t *src = malloc(max_node_cnt * sizeof(*src));
+  vec3 *mins = malloc(2 * max_node_cnt * sizeof(*mins));
+  vec3 *maxs = mins + max_node_cnt;
+  src[0] = 0;
+  mins[0] = c->min;
+  maxs[0] = c->max;
+  c->node_cnt = 1;
+
+  for(size_t i=0; i<c->node_cnt; i++) {
+    cbvh_node *n = &c->nodes[i];
+    const bvh_node *bn = &b->nodes[src[i]];
+    vec3 child_min[2], child_max[2];
+    encode_node(n, b, bn, mins[i], maxs[i], child_min, child_max);
+
+    for(uint8_t j=0; j<2; j++) {
+      const bvh_node *child = &b->nodes[bn->start_idx + j];
+      n->obj_cnt[j] = child->obj_cnt;
+      if(child->obj_cnt > 0) {
+        n->start_idx[j] = child->start_idx;
+      } else {
+        src[c->node_cnt] = bn->start_idx + j;
+        mins[c->node_cnt] = child_min[j];
+        maxs[c->node_cnt] = child_max[j];
+        n->start_idx[j] = c->node_cnt++;
+      }
+    }
+  }
+
+  free(mins);
+  free(src);
+
+  return c;
+}
+
+void cbvh_release(cbvh *c)
+{
+  free(c->nodes);
+  free(c);
+}
+
+void cbvh_intersect(const cbvh *c, const scn *s, ray *r, uint32_t *obj_idx)
+{
+  // Huge objects first, their hits shorten the ray for the tree
+  scn_intersect_objs(s, c->indices, c->huge_start, c->huge_cnt & BVH_CNT_MASK,
+      c->huge_cnt >> BVH_TYPE_SHIFT, r, obj_idx);
+
+  if(c->node_cnt == 0) {
+    scn_intersect_objs(s, c->indices, c->root_start, c->root_cnt & BVH_CNT_MASK,
+        c->root_cnt >> BVH_TYPE_SHIFT, r, obj_idx);
+    return;
+  }
+
+  // Same traversal as bvh_intersect, the stack holds the decoded min corner
+  // of the pushed nodes
+  entry stack[BVH_MAX_DEPTH];
+  uint32_t stack_idx = 0;
+  entry e = { 0, c->min };
+
+  while(true) {
+    const cbvh_node *n = &c->nodes[e.node_idx];
+    vec3 scale = { get_scale(n->exp[0]), get_scale(n->exp[1]),
+      get_scale(n->exp[2]) };
+
+    float dist[2];
+    vec3 child_min[2];
+    for(uint8_t i=0; i<2; i++) {
+      child_min[i] = (vec3){ decode(e.min.x, n->qmin[i][0], scale.x),
+        decode(e.min.y, n->qmin[i][1], scale.y),
+        decode(e.min.z, n->qmin[i][2], scale.z) };
+      vec3 child_max = { decode(e.min.x, n->qmax[i][0], scale.x),
+        decode(e.min.y, n->qmax[i][1], scale.y),
+        decode(e.min.z, n->qmax[i][2], scale.z) };
+      dist[i] = ray_intersect_aabb(r, child_min[i], child_max);
+    }
+
+    // Leaf children are tested right away, near one first
+    uint8_t near = dist[0] > dist[1];
+    uint32_t next_cnt = 0;
+    entry next[2];
+    for(uint8_t k=0; k<2; k++) {
+      uint8_t i = k == 0 ? near : 1 - near;
+      if(dist[i] >= r->t)
+        continue; // Missed or behind a closer hit
+      if(n->obj_cnt[i] > 0)
+        scn_intersect_objs(s, c->indices, n->start_idx[i],
+            n->obj_cnt[i] & BVH_CNT_MASK, n->obj_cnt[i] >> BVH_TYPE_SHIFT, r,
+            obj_idx);
+      else
+        next[next_cnt++] = (entry){ n->start_idx[i], child_min[i] };
+    }
+
+    if(next_cnt == 2)
+      stack[stack_idx++] = next[1];
+    if(next_cnt > 0) {
+      e = next[0];
+    } else {
+      if(stack_idx == 0)
+        break;
+      e = stack[--stack_idx];
+    }
+  }
+}
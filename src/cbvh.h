@@ -0,0 +1,48 @@
+#ifndef CBVH_H
+#define CBVH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vec3.h"
+
+// Compressed BVH for CPU traversal, converted from a binary bvh. Every node
+// is an interior node of the binary tree holding both children. Child bounds
+// are 8-bit offsets from the min corner of the node's own (decoded) bounds
+// in power of two steps per axis. Leaf children are stored inline.
+
+typedef struct bvh bvh;
+typedef struct scn scn;
+typedef struct ray ray;
+
+typedef struct cbvh_node {
+  uint8_t   qmin[2][3]; // Per child, rounded down
+  uint8_t   qmax[2][3]; // Per child, rounded up
+  int8_t    exp[3];     // Per axis, offsets are in units of 2^exp
+  uint8_t   pad;
+  uint32_t  start_idx[2]; // obj start or node index
+  uint32_t  obj_cnt[2];   // 0 = interior node, as in bvh_node
+} cbvh_node;
+
+typedef struct cbvh {
+  size_t          node_cnt; // 0 if the binary root is a leaf
+  cbvh_node       *nodes;
+  vec3            min;      // Root bounds, not quantized
+  vec3            max;
+  const uint32_t  *indices; // Of the binary bvh
+  // Binary root if it is a leaf and the huge objects leaf, counts as in
+  // bvh_node obj_cnt
+  uint32_t        root_start;
+  uint32_t        root_cnt;
+  uint32_t        huge_start;
+  uint32_t        huge_cnt;
+} cbvh;
+
+// The binary bvh needs to outlive the compressed one
+cbvh  *cbvh_create(const bvh *b);
+void  cbvh_release(cbvh *c);
+
+// Decoded bounds enclose the original ones, i.e. hits are the same as the
+// ones of bvh_intersect
+void  cbvh_intersect(const cbvh *c, const scn *s, ray *r, uint32_t *obj_idx);
+
+#endif
@@ -0,0 +1,393 @@
+#include "fmath.h"
+#include <stdint.h>
+#if defined(__SSE2__)
+  #include <immintrin.h>
+#elif defined(__wasm_simd128__)
+  #include <wasm_simd128.h>
+#endif
+
+// Polynomials are the minimax ones of Cephes. Trig functions reduce x to
+// r in [-pi/4, pi/4] with x = r + k * pi/2 and select sin or cos of r by the
+// quadrant k & 3. The reduction is done in double precision, a float
+// Cody-Waite split of pi/2 would be folded back into one constant by
+// -ffast-math. pow is exp2(y * log2(x)). The code
+// is branch free where the branch would depend on the value, e.g. the
+// quadrant, which makes it vectorizable and keeps random inputs fast.
+
+#define PIO2      1.570796327f
+#define PIO2_D    1.57079632679489661923
+#define PIO4      0.785398163f
+#define SQRT1_2   0x3f3504f3    // Bits of sqrt(0.5)
+#define TWO_O_PI  0.636619772f
+#define LOG2E     1.442695041f
+#define EXP2_MIN  -126.0f
+#define EXP2_MAX  127.999f
+
+#define SIN_C0    -1.6666654611e-1f
+#define SIN_C1    8.3321608736e-3f
+#define SIN_C2    -1.9515295891e-4f
+
+#define COS_C0    4.166664568e-2f
+#define COS_C1    -1.388731625e-3f
+#define COS_C2    2.443315712e-5f
+
+#define EXP2_C0   6.931472028550421e-1f
+#define EXP2_C1   2.402264791363012e-1f
+#define EXP2_C2   5.550332471162809e-2f
+#define EXP2_C3   9.618437357674640e-3f
+#define EXP2_C4   1.339887440266574e-3f
+#define EXP2_C5   1.535336188319500e-4f
+
+typedef union bits {
+  float     f;
+  uint32_t  u;
+} bits;
+
+static float sin_poly(float r, float z)
+{
+  return r + r * z * (SIN_C0 + z * (SIN_C1 + z * SIN_C2));
+}
+
+static float cos_poly(float z)
+{
+  return 1.0f - 0.5f * z + z * z * (COS_C0 + z * (COS_C1 + z * COS_C2));
+}
+
+// Reduces x to r, returns the quadrant
+static int32_t reduce(float x, float *r)
+{
+  float k = __builtin_rintf(x * TWO_O_PI);
+  *r = (float)((double)x - (double)k * PIO2_D);
+  return (int32_t)k;
+}
+
+// Quadrant q of sin, cos is q + 1
+static float sin_quadrant(float r, int32_t q)
+{
+  float z = r * r;
+  float s = sin_poly(r, z);
+  float c = cos_poly(z);
+  bits v = { .f = (q & 1) ? c : s };
+  v.u ^= (uint32_t)(q & 2) << 30;
+  return v.f;
+}
+
+// asin for |x| <= 0.5
+static float asin_poly(float x)
+{
+  float z = x * x;
+  return x + x * z * (1.6666752422e-1f + z * (7.4953002686e-2f +
+        z * (4.5470025998e-2f + z * (2.4181311049e-2f + z * 4.2163199048e-2f))));
+}
+
+// atan for x in [0, 1]
+static float atan_poly(float x)
+{
+  float ofs = 0.0f;
+  if(x > 0.4142135624f) {
+    ofs = PIO4;
+    x = (x - 1.0f) / (x + 1.0f);
+  }
+  float z = x * x;
+  return ofs + x + x * z * (-3.33329491539e-1f + z * (1.99777106478e-1f +
+        z * (-1.38776856032e-1f + z * 8.05374449538e-2f)));
+}
+
+// x > 0, normal
+static float log2_pos(float x)
+{
+  // x = m * 2^e with m in [sqrt(0.5), sqrt(2))
+  bits b = { .f = x };
+  int32_t e = (int32_t)(b.u - SQRT1_2) >> 23;
+  b.u -= (uint32_t)e << 23;
+  float m = b.f;
+
+  // ln(m) = 2 atanh(t), t in [-0.172, 0.172]
+  float t = (m - 1.0f) / (m + 1.0f);
+  float z = t * t;
+  float ln = 2.0f * t * (1.0f + z * (1.0f / 3.0f + z * (1.0f / 5.0f +
+          z * (1.0f / 7.0f + z * (1.0f / 9.0f)))));
+  return (float)e + ln * LOG2E;
+}
+
+static float exp2_clamped(float v)
+{
+  v = v < EXP2_MIN ? EXP2_MIN : (v > EXP2_MAX ? EXP2_MAX : v);
+  float nf = __builtin_rintf(v);
+  int32_t n = (int32_t)nf;
+  float f = v - nf;
+  float p = 1.0f + f * (EXP2_C0 + f * (EXP2_C1 + f * (EXP2_C2 +
+          f * (EXP2_C3 + f * (EXP2_C4 + f * EXP2_C5)))));
+  bits s = { .u = (uint32_t)(n + 127) << 23 };
+  return p * s.f;
+}
+
+float fmath_sqrt(float x)
+{
+  return __builtin_sqrtf(x);
+}
+
+float fmath_sin(float x)
+{
+  float r;
+  int32_t q = reduce(x, &r);
+  return sin_quadrant(r, q);
+}
+
+float fmath_cos(float x)
+{
+  float r;
+  int32_t q = reduce(x, &r);
+  return sin_quadrant(r, q + 1);
+}
+
+float fmath_tan(float x)
+{
+  float r;
+  int32_t q = reduce(x, &r);
+  float z = r * r;
+  float s = sin_poly(r, z);
+  float c = cos_poly(z);
+  float n = (q & 1) ? -c : s;
+  float d = (q & 1) ? s : c;
+  return n / d;
+}
+
+float fmath_acos(float x)
+{
+  if(x > 0.5f)
+    return 2.0f * asin_poly(fmath_sqrt(0.5f * (1.0f - x)));
+  if(x < -0.5f)
+    return 2.0f * (PIO2 - asin_poly(fmath_sqrt(0.5f * (1.0f + x))));
+  return PIO2 - asin_poly(x);
+}
+
+float fmath_atan2(float y, float x)
+{
+  float ax = x < 0.0f ? -x : x;
+  float ay = y < 0.0f ? -y : y;
+  if(ax == 0.0f && ay == 0.0f)
+    return x < 0.0f ? (y < 0.0f ? -2.0f * PIO2 : 2.0f * PIO2) : y;
+
+  float a = ay <= ax ? atan_poly(ay / ax) : PIO2 - atan_poly(ax / ay);
+  if(x < 0.0f)
+    a = 2.0f * PIO2 - a;
+  return y < 0.0f ? -a : a;
+}
+
+float fmath_pow(float x, float y)
+{
+  if(x > 0.0f)
+    return exp2_clamped(y * log2_pos(x));
+
+  if(x == 0.0f)
+    return y > 0.0f ? 0.0f : (y == 0.0f ? 1.0f : 1.0f / x);
+
+  // Negative base, defined for integer exponents only. Floats from 2^24 on
+  // are even integers, smaller ones convert exactly.
+  if(__builtin_floorf(y) != y)
+    return __builtin_nanf("");
+  float v = exp2_clamped(y * log2_pos(-x));
+  float ay = y < 0.0f ? -y : y;
+  return (ay < 16777216.0f && ((int32_t)y & 1)) ? -v : v;
+}
+
+#if defined(__SSE2__) || defined(__wasm_simd128__)
+
+#if defined(__SSE2__)
+  typedef __m128  v4f;
+  typedef __m128i v4i;
+  #define v4_set1(a)      _mm_set1_ps(a)
+  #define v4_load(p)      _mm_loadu_ps(p)
+  #define v4_store(p, v)  _mm_storeu_ps(p, v)
+  #define v4_add(a, b)    _mm_add_ps(a, b)
+  #define v4_sub(a, b)    _mm_sub_ps(a, b)
+  #define v4_mul(a, b)    _mm_mul_ps(a, b)
+  #define v4_div(a, b)    _mm_div_ps(a, b)
+  #define v4_sqrt(a)      _mm_sqrt_ps(a)
+  #define v4_min(a, b)    _mm_min_ps(a, b)
+  #define v4_max(a, b)    _mm_max_ps(a, b)
+  #define v4_gt(a, b)     _mm_cmpgt_ps(a, b)
+  #define v4_and(a, b)    _mm_and_ps(a, b)
+  #define v4_xor(a, b)    _mm_xor_ps(a, b)
+  #define v4_sel(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+  #define v4_rint(a)      _mm_cvtepi32_ps(_mm_cvtps_epi32(a))
+  #define v4_to_i(a)      _mm_cvttps_epi32(a)
+  #define v4_from_i(a)    _mm_cvtepi32_ps(a)
+  #define v4_as_i(a)      _mm_castps_si128(a)
+  #define v4_as_f(a)      _mm_castsi128_ps(a)
+  #define v4i_set1(a)     _mm_set1_epi32(a)
+  #define v4i_add(a, b)   _mm_add_epi32(a, b)
+  #define v4i_sub(a, b)   _mm_sub_epi32(a, b)
+  #define v4i_and(a, b)   _mm_and_si128(a, b)
+  #define v4i_shl(a, n)   _mm_slli_epi32(a, n)
+  #define v4i_sra(a, n)   _mm_srai_epi32(a, n)
+  #define v4i_eq(a, b)    _mm_cmpeq_epi32(a, b)
+
+// x - k * pi/2 in double precision
+static v4f reduce4(v4f x, v4f k)
+{
+  __m128d c = _mm_set1_pd(PIO2_D);
+  __m128d lo = _mm_sub_pd(_mm_cvtps_pd(x), _mm_mul_pd(_mm_cvtps_pd(k), c));
+  __m128d hi = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)),
+      _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(k, k)), c));
+  return _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi));
+}
+#else
+  typedef v128_t  v4f;
+  typedef v128_t  v4i;
+  #define v4_set1(a)      wasm_f32x4_splat(a)
+  #define v4_load(p)      wasm_v128_load(p)
+  #define v4_store(p, v)  wasm_v128_store(p, v)
+  #define v4_add(a, b)    wasm_f32x4_add(a, b)
+  #define v4_sub(a, b)    wasm_f32x4_sub(a, b)
+  #define v4_mul(a, b)    wasm_f32x4_mul(a, b)
+  #define v4_div(a, b)    wasm_f32x4_div(a, b)
+  #define v4_sqrt(a)      wasm_f32x4_sqrt(a)
+  #define v4_min(a, b)    wasm_f32x4_min(a, b)
+  #define v4_max(a, b)    wasm_f32x4_max(a, b)
+  #define v4_gt(a, b)     wasm_f32x4_gt(a, b)
+  #define v4_and(a, b)    wasm_v128_and(a, b)
+  #define v4_xor(a, b)    wasm_v128_xor(a, b)
+  #define v4_sel(m, a, b) wasm_v128_bitselect(a, b, m)
+  #define v4_rint(a)      wasm_f32x4_nearest(a)
+  #define v4_to_i(a)      wasm_i32x4_trunc_sat_f32x4(a)
+  #define v4_from_i(a)    wasm_f32x4_convert_i32x4(a)
+  #define v4_as_i(a)      (a)
+  #define v4_as_f(a)      (a)
+  #define v4i_set1(a)     wasm_i32x4_splat(a)
+  #define v4i_add(a, b)   wasm_i32x4_add(a, b)
+  #define v4i_sub(a, b)   wasm_i32x4_sub(a, b)
+  #define v4i_and(a, b)   wasm_v128_and(a, b)
+  #define v4i_shl(a, n)   wasm_i32x4_shl(a, n)
+  #define v4i_sra(a, n)   wasm_i32x4_shr(a, n)
+  #define v4i_eq(a, b)    wasm_i32x4_eq(a, b)
+
+// x - k * pi/2 in double precision
+static v4f reduce4(v4f x, v4f k)
+{
+  v128_t c = wasm_f64x2_splat(PIO2_D);
+  v128_t lo = wasm_f64x2_sub(wasm_f64x2_promote_low_f32x4(x),
+      wasm_f64x2_mul(wasm_f64x2_promote_low_f32x4(k), c));
+  v128_t hi = wasm_f64x2_sub(
+      wasm_f64x2_promote_low_f32x4(wasm_i32x4_shuffle(x, x, 2, 3, 0, 1)),
+      wasm_f64x2_mul(
+        wasm_f64x2_promote_low_f32x4(wasm_i32x4_shuffle(k, k, 2, 3, 0, 1)), c));
+  return wasm_i32x4_shuffle(wasm_f32x4_demote_f64x2_zero(lo),
+      wasm_f32x4_demote_f64x2_zero(hi), 0, 1, 4, 5);
+}
+#endif
+
+static v4f sin4(v4f x, int32_t q_ofs)
+{
+  v4f kf = v4_rint(v4_mul(x, v4_set1(TWO_O_PI)));
+  v4i k = v4_to_i(kf);
+  v4f r = reduce4(x, kf);
+  v4f z = v4_mul(r, r);
+
+  v4f s = v4_add(r, v4_mul(v4_mul(r, z), v4_add(v4_set1(SIN_C0),
+          v4_mul(z, v4_add(v4_set1(SIN_C1), v4_mul(z, v4_set1(SIN_C2)))))));
+  v4f c = v4_add(v4_sub(v4_set1(1.0f), v4_mul(v4_set1(0.5f), z)),
+      v4_mul(v4_mul(z, z), v4_add(v4_set1(COS_C0), v4_mul(z,
+            v4_add(v4_set1(COS_C1), v4_mul(z, v4_set1(COS_C2)))))));
+
+  v4i q = v4i_add(k, v4i_set1(q_ofs));
+  v4f odd = v4_as_f(v4i_eq(v4i_and(q, v4i_set1(1)), v4i_set1(1)));
+  v4f sign = v4_as_f(v4i_shl(v4i_and(q, v4i_set1(2)), 30));
+  return v4_xor(v4_sel(odd, c, s), sign);
+}
+
+static v4f pow4(v4f x, v4f y)
+{
+  // log2
+  v4i u = v4_as_i(x);
+  v4i ei = v4i_sra(v4i_sub(u, v4i_set1(SQRT1_2)), 23);
+  v4f e = v4_from_i(ei);
+  v4f m = v4_as_f(v4i_sub(u, v4i_shl(ei, 23)));
+
+  v4f t = v4_div(v4_sub(m, v4_set1(1.0f)), v4_add(m, v4_set1(1.0f)));
+  v4f z = v4_mul(t, t);
+  v4f ln = v4_mul(v4_mul(v4_set1(2.0f), t), v4_add(v4_set1(1.0f),
+        v4_mul(z, v4_add(v4_set1(1.0f / 3.0f), v4_mul(z, v4_add(v4_set1(1.0f / 5.0f),
+                v4_mul(z, v4_add(v4_set1(1.0f / 7.0f),
+                    v4_mul(z, v4_set1(1.0f / 9.0f))))))))));
+  v4f v = v4_mul(y, v4_add(e, v4_mul(ln, v4_set1(LOG2E))));
+
+  // exp2
+  v = v4_min(v4_max(v, v4_set1(EXP2_MIN)), v4_set1(EXP2_MAX));
+  v4f nf = v4_rint(v);
+  v4i n = v4_to_i(nf);
+  v4f f = v4_sub(v, nf);
+  v4f p = v4_add(v4_set1(1.0f), v4_mul(f, v4_add(v4_set1(EXP2_C0),
+          v4_mul(f, v4_add(v4_set1(EXP2_C1), v4_mul(f, v4_add(v4_set1(EXP2_C2),
+                  v4_mul(f, v4_add(v4_set1(EXP2_C3), v4_mul(f,
+                        v4_add(v4_set1(EXP2_C4), v4_mul(f, v4_set1(EXP2_C5)))))))))))));
+  v4f s = v4_as_f(v4i_shl(v4i_add(n, v4i_set1(127)), 23));
+
+  // x = 0 (or negative) gives 0
+  return v4_and(v4_mul(p, s), v4_gt(x, v4_set1(0.0f)));
+}
+
+void fmath_sqrt_n(float *dst, const float *x, size_t cnt)
+{
+  size_t i = 0;
+  for(; i + 4 <= cnt; i += 4)
+    v4_store(dst + i, v4_sqrt(v4_load(x + i)));
+  for(; i<cnt; i++)
+    dst[i] = fmath_sqrt(x[i]);
+}
+
+void fmath_sin_n(float *dst, const float *x, size_t cnt)
+{
+  size_t i = 0;
+  for(; i + 4 <= cnt; i += 4)
+    v4_store(dst + i, sin4(v4_load(x + i), 0));
+  for(; i<cnt; i++)
+    dst[i] = fmath_sin(x[i]);
+}
+
+void fmath_cos_n(float *dst, const float *x, size_t cnt)
+{
+  size_t i = 0;
+  for(; i + 4 <= cnt; i += 4)
+    v4_store(dst + i, sin4(v4_load(x + i), 1));
+  for(; i<cnt; i++)
+    dst[i] = fmath_cos(x[i]);
+}
+
+void fmath_pow_n(float *dst, const float *x, float y, size_t cnt)
+{
+  size_t i = 0;
+  for(; i + 4 <= cnt; i += 4)
+    v4_store(dst + i, pow4(v4_load(x + i), v4_set1(y)));
+  for(; i<cnt; i++)
+    dst[i] = x[i] > 0.0f ? fmath_pow(x[i], y) : 0.0f;
+}
+
+#else
+
+void fmath_sqrt_n(float *dst, const float *x, size_t cnt)
+{
+  for(size_t i=0; i<cnt; i++)
+    dst[i] = fmath_sqrt(x[i]);
+}
+
+void fmath_sin_n(float *dst, const float *x, size_t cnt)
+{
+  for(size_t i=0; i<cnt; i++)
+    dst[i] = fmath_sin(x[i]);
+}
+
+void fmath_cos_n(float *dst, const float *x, size_t cnt)
+{
+  for(size_t i=0; i<cnt; i++)
+    dst[i] = fmath_cos(x[i]);
+}
+
+void fmath_pow_n(float *dst, const float *x, float y, size_t cnt)
+{
+  for(size_t i=0; i<cnt; i++)
+    dst[i] = x[i] > 0.0f ? fmath_pow(x[i], y) : 0.0f;
+}
+
+#endif
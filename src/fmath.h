@@ -0,0 +1,28 @@
+#ifndef FMATH_H
+#define FMATH_H
+
+#include <stddef.h>
+
+// In-module float math, provides sqrtf, sinf etc. of the wasm version (see
+// sutil.c) instead of importing them from JS. Max errors are measured
+// against double precision (raynin -A), in ulp of the float result or
+// relative for pow. Near the zeros of sin, cos and tan the absolute error
+// of the reduction by multiples of pi/2 dominates, i.e. some more ulp.
+
+float fmath_sqrt(float x);            // Exact, f32.sqrt / sqrtss
+float fmath_sin(float x);             // 1.5 ulp |x| <= pi, 25 ulp |x| <= 1e4
+float fmath_cos(float x);             // 1.5 ulp |x| <= pi, 25 ulp |x| <= 1e4
+float fmath_tan(float x);             // 3.5 ulp |x| <= 1.5, 20 ulp |x| <= 1e4
+float fmath_acos(float x);            // 2 ulp
+float fmath_atan2(float y, float x);  // 3.5 ulp
+float fmath_pow(float x, float y);    // 1e-6 rel for |y log2(x)| <= 16
+
+// Batch variants, 4 at a time with SSE2 or simd128, else scalar. Results
+// are within a few ulp of the scalar ones, which may use FMA contraction.
+// pow_n takes one exponent for all bases, bases <= 0 give 0.
+void  fmath_sqrt_n(float *dst, const float *x, size_t cnt);
+void  fmath_sin_n(float *dst, const float *x, size_t cnt);
+void  fmath_cos_n(float *dst, const float *x, size_t cnt);
+void  fmath_pow_n(float *dst, const float *x, float y, size_t cnt);
+
+#endif
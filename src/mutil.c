@@ -10,13 +10,13 @@ static pcg32_random_t pcg32_global = { 0x853c49e6748fea9bULL, 0xda3e39cb94b95bdb
 
 float fabsf(float v)
 {
-  return v > 0 ? -v : v;
+  return v < 0 ? -v : v;
 }
 
 float floorf(float v)
 {
   float t = (float)(int)v;
-  return (t != v) ? (t - 1.0f) : t;
+  return (v < t) ? (t - 1.0f) : t;
 }
 
 float truncf(float v)
@@ -58,13 +58,63 @@ uint32_t rand()
   return pcg32_random_r(&pcg32_global);
 }
 
+// Upper 24 bits, all exactly representable
+static float to_unit(uint32_t v)
+{
+  return (v >> 8) * (1.0f / 16777216.0f);
+}
+
 float randf()
 {
-  // ldexp(rand(), -32);
-  return rand() / (double)UINT32_MAX;
+  return to_unit(rand());
 }
 
 float randf_rng(float start, float end)
 {
   return start + randf() * (end - start);
 }
+
+// splitmix64 finalizer
+static uint64_t mix64(uint64_t v)
+{
+  v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+  return v ^ (v >> 31);
+}
+
+crand crand_init(uint64_t seed, uint64_t stream)
+{
+  // Squares wants keys with well mixed bits, odd ones keep ctr * key a
+  // bijection
+  uint64_t key = mix64(seed + mix64(stream + 0x9e3779b97f4a7c15ULL)) | 1;
+  return (crand){ key, 0 };
+}
+
+uint32_t crand_at(const crand *c, uint64_t idx)
+{
+  uint64_t x = idx * c->key;
+  uint64_t y = x;
+  uint64_t z = y + c->key;
+  x = x * x + y;
+  x = (x >> 32) | (x << 32);
+  x = x * x + z;
+  x = (x >> 32) | (x << 32);
+  x = x * x + y;
+  x = (x >> 32) | (x << 32);
+  return (x * x + z) >> 32;
+}
+
+uint32_t crand_next(crand *c)
+{
+  return crand_at(c, c->idx++);
+}
+
+float crand_nextf(crand *c)
+{
+  return to_unit(crand_next(c));
+}
+
+float crand_nextf_rng(crand *c, float start, float end)
+{
+  return start + crand_nextf(c) * (end - start);
+}
@@ -11,7 +11,7 @@
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 
-// Imported
+// libm in the native version, fmath in the wasm one (sutil.c)
 extern float sqrtf(float a);
 extern float sinf(float a);
 extern float cosf(float a);
@@ -25,9 +25,24 @@ float     floorf(float v);
 float     truncf(float v);
 float     fmodf(float x, float y);
 
+// Global pcg32 generator, serial use only
 void      srand(uint64_t seed, uint64_t seq);
 uint32_t  rand(void);
-float     randf(void);
+float     randf(void); // [0, 1)
 float     randf_rng(float start, float end);
 
+// Counter-based generator (Squares, https://arxiv.org/abs/2004.06278). Value
+// idx of a stream is a pure function of (seed, stream, idx), i.e. work split
+// by stream or index gives the same values in any order and on any thread.
+typedef struct crand {
+  uint64_t  key; // Of seed and stream
+  uint64_t  idx; // Of the next value
+} crand;
+
+crand     crand_init(uint64_t seed, uint64_t stream);
+uint32_t  crand_at(const crand *c, uint64_t idx); // Ignores and keeps c->idx
+uint32_t  crand_next(crand *c);
+float     crand_nextf(crand *c); // [0, 1)
+float     crand_nextf_rng(crand *c, float start, float end);
+
 #endif
@@ -0,0 +1,1004 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "sutil.h"
+#include "mutil.h"
+#include "fmath.h"
+#include "sys.h"
+#include "cfg.h"
+#include "scn.h"
+#include "scns.h"
+#include "obj.h"
+#include "shape.h"
+#include "bvh.h"
+#include "wbvh.h"
+#include "cbvh.h"
+#include "tlas.h"
+#include "pack.h"
+#include "tfm.h"
+#include "mat.h"
+#include "cam.h"
+#include "view.h"
+#include "rend.h"
+#include "ray.h"
+
+// Native CPU reference renderer. Renders a scene on all cores and writes
+// the accumulated image to a PPM (gamma corrected) or PFM (linear) file.
+
+#define TILE_SIZE     16
+#define REFIT_FRAMES  100
+#define INST_SPACING  3.0f
+#define INST_MOVED    100
+#define MATH_RUNS     10
+#define GAMMA         0.4545f
+
+typedef struct job {
+  rend        *rend;
+  uint32_t    tiles_x;
+  uint32_t    tile_cnt;
+  uint32_t    seed;
+  uint32_t    smpl_idx;
+  atomic_uint next_tile;
+} job;
+
+typedef struct opts {
+  const char  *scn_name;
+  const char  *out_path;
+  const char  *pack_in;
+  const char  *pack_out;
+  uint32_t    width;
+  uint32_t    height;
+  uint32_t    spp;
+  uint32_t    passes;
+  uint32_t    bounces;
+  uint32_t    thread_cnt;
+  uint32_t    bld_thread_cnt;
+  uint32_t    grid;
+  uint32_t    bench_runs;
+  uint32_t    refit_moved;
+  bool        scaling;
+  bool        wide;
+  bool        compressed;
+  bool        leaf_order;
+  bool        lbvh;
+  bool        lazy;
+  uint32_t    trav_rays;
+  uint32_t    math_cnt;
+  uint32_t    sampler_ref_spp;
+  bool        sobol;
+  bool        baked;
+  float       opt_secs;
+  bvh_opts    bvh;
+} opts;
+
+// Instances of one model on a grid over a shared ground
+typedef struct inst_scn {
+  scn   *model;
+  bvh   *model_bvh;
+  scn   *ground;
+  bvh   *ground_bvh;
+  tlas  *tlas;
+} inst_scn;
+
+static void render_tiles(void *ctx, uint32_t thread_idx)
+{
+  job *j = ctx;
+  uint32_t t;
+  while((t = atomic_fetch_add(&j->next_tile, 1)) < j->tile_cnt)
+    rend_tile(j->rend, (t % j->tiles_x) * TILE_SIZE, (t / j->tiles_x) * TILE_SIZE,
+        TILE_SIZE, TILE_SIZE, j->seed, j->smpl_idx);
+}
+
+// Returns time in seconds it took to render all passes
+static double render(rend *r, uint32_t passes, uint32_t thread_cnt)
+{
+  job j = { .rend = r,
+    .tiles_x = (r->cfg.width + TILE_SIZE - 1) / TILE_SIZE };
+  j.tile_cnt = j.tiles_x * ((r->cfg.height + TILE_SIZE - 1) / TILE_SIZE);
+
+  double start = sys_time();
+  for(uint32_t i=0; i<passes; i++) {
+    j.seed = rand();
+    j.smpl_idx = i * r->cfg.spp;
+    atomic_store(&j.next_tile, 0);
+    sys_run_threads(thread_cnt, render_tiles, &j);
+  }
+
+  return sys_time() - start;
+}
+
+static double calc_rmse(const vec3 *acc, const vec3 *ref, size_t cnt,
+    uint32_t spp, uint32_t ref_spp)
+{
+  double sum = 0.0;
+  for(size_t i=0; i<cnt; i++) {
+    vec3 d = vec3_sub(vec3_scale(acc[i], 1.0f / spp),
+        vec3_scale(ref[i], 1.0f / ref_spp));
+    sum += vec3_dot(d, d);
+  }
+  return __builtin_sqrt(sum / (3 * cnt));
+}
+
+// RMSE over render time of PCG and the scrambled Sobol sampler at doubling
+// sample counts. The reference is a PCG render with ref_spp samples per
+// pixel and seeds of its own.
+static void bench_sampler(rend *r, uint32_t ref_spp, uint32_t thread_cnt)
+{
+  size_t cnt = r->cfg.width * r->cfg.height;
+  size_t size = cnt * sizeof(*r->acc);
+  uint32_t spp = r->cfg.spp;
+
+  r->sobol = false;
+  r->cfg.spp = min(ref_spp, 16u);
+  memset(r->acc, 0, size);
+  double secs = render(r, ref_spp / r->cfg.spp, thread_cnt);
+  ref_spp = ref_spp / r->cfg.spp * r->cfg.spp;
+  printf("sampler reference: %u spp, %.3f s\n", ref_spp, secs);
+
+  vec3 *ref = malloc(size);
+  memcpy(ref, r->acc, size);
+
+  for(uint32_t n=1; n<=ref_spp / 8; n*=2) {
+    double t[2], rmse[2];
+    for(uint8_t i=0; i<2; i++) {
+      r->sobol = i == 1;
+      r->cfg.spp = n;
+      memset(r->acc, 0, size);
+      t[i] = render(r, 1, thread_cnt);
+      rmse[i] = calc_rmse(r->acc, ref, cnt, n, ref_spp);
+    }
+    printf("sampler: %5u spp, pcg %.3f s rmse %.5f, sobol %.3f s rmse %.5f "
+        "(%.2fx lower)\n", n, t[0], rmse[0], t[1], rmse[1], rmse[0] / rmse[1]);
+  }
+
+  free(ref);
+  r->cfg.spp = spp;
+}
+
+// Treelet passes until the time budget is used up or gains drop below 0.1%
+// Bottom up refit needs children stored after their parent
+static bool check_node_order(const bvh *b)
+{
+  for(size_t i=0; i<b->node_cnt; i++) {
+    const bvh_node *n = &b->nodes[i];
+    if(n->obj_cnt == 0 && n->start_idx <= i)
+      return false;
+  }
+  return true;
+}
+
+static void optimize_bvh(bvh *b, float secs)
+{
+  float sah_start = bvh_calc_stats(b).sah_cost;
+  float sah = sah_start;
+  uint32_t passes = 0;
+  double start = sys_time();
+  while(sys_time() - start < secs) {
+    float prev = sah;
+    sah = bvh_optimize_pass(b);
+    passes++;
+    if(sah > prev * 0.999f)
+      break;
+  }
+
+  double total_secs = sys_time() - start;
+
+  printf("bvh optimize: sah %.2f -> %.2f (-%.1f%%), %u passes, %.1f ms,"
+      " max depth %u, %s\n",
+      sah_start, sah, (1.0f - sah / sah_start) * 100.0f, passes,
+      total_secs * 1000.0, b->depth,
+      check_node_order(b) ? "node order ok" : "CHILDREN BEFORE PARENT");
+}
+
+static void create_bvh(bvh *b, const scn *s, const opts *o)
+{
+  if(o->lbvh)
+    bvh_create_lbvh(b, s);
+  else if(o->bld_thread_cnt > 0)
+    bvh_create_par(b, s, o->bld_thread_cnt);
+  else
+    bvh_create(b, s);
+
+  if(o->opt_secs > 0.0f)
+    optimize_bvh(b, o->opt_secs);
+}
+
+static const char *get_builder_name(const opts *o)
+{
+  static char name[32];
+  if(o->lbvh)
+    return "lbvh";
+  if(o->bvh.spatial_splits)
+    return "sbvh";
+  if(o->bld_thread_cnt == 0)
+    return "serial";
+  snprintf(name, sizeof(name), "%u threads", o->bld_thread_cnt);
+  return name;
+}
+
+static void print_scn_stats(const scn *s)
+{
+  scn_stats st = scn_calc_stats(s);
+  printf("scn: %zu objs, objs %zu of %zu bytes, shapes %zu of %zu bytes,"
+      " mats %zu of %zu bytes, %u reallocations\n", st.obj_cnt, st.obj_bytes,
+      st.obj_cap, st.shape_bytes, st.shape_cap, st.mat_bytes, st.mat_cap,
+      st.grow_cnt);
+}
+
+static void print_bvh_stats(const bvh *b)
+{
+  bvh_stats st = bvh_calc_stats(b);
+  printf("bvh stats: %zu nodes, %zu leaves (%zu typed), %zu objs, %zu huge,"
+      " depth max %u avg %.2f, sah %.2f, wasted %.1f%%\n", st.node_cnt,
+      st.leaf_cnt, st.typed_leaf_cnt, st.obj_cnt, st.huge_cnt, st.max_depth,
+      st.avg_depth, st.sah_cost, st.wasted_ratio * 100.0f);
+  printf("bvh leaf objs:");
+  for(uint32_t i=0; i<BVH_HIST_CNT; i++) {
+    uint32_t lo = i < 2 ? i + 1 : (1u << (i - 1)) + 1;
+    if(i == BVH_HIST_CNT - 1)
+      printf(" %u+: %u\n", lo, st.leaf_hist[i]);
+    else if(lo == 1u << i)
+      printf(" %u: %u,", lo, st.leaf_hist[i]);
+    else
+      printf(" %u-%u: %u,", lo, 1u << i, st.leaf_hist[i]);
+  }
+}
+
+static void bench_bvh(const scn *s, const opts *o)
+{
+  bvh *b = bvh_init(s->obj_cnt, &o->bvh);
+  uint32_t runs = o->bench_runs;
+
+  double min_secs = 1e30;
+  double total_secs = 0.0;
+  for(uint32_t i=0; i<runs; i++) {
+    double start = sys_time();
+    create_bvh(b, s, o);
+    double secs = sys_time() - start;
+    min_secs = min(min_secs, secs);
+    total_secs += secs;
+  }
+
+  printf("bvh build (%s): %zu objs, %zu nodes, max depth %u,"
+      " min %.3f ms, avg %.3f ms, %.1f ns/obj\n",
+      get_builder_name(o), s->obj_cnt, b->node_cnt, b->depth, min_secs * 1000.0,
+      total_secs / runs * 1000.0, min_secs * 1e9 / s->obj_cnt);
+  print_bvh_stats(b);
+
+  bvh_release(b);
+}
+
+// Moves some spheres per frame and refits the bvh incrementally
+static void bench_refit(scn *s, const opts *o)
+{
+  bvh *b = bvh_init(s->obj_cnt, &o->bvh);
+  create_bvh(b, s, o);
+  uint32_t moved = o->refit_moved;
+
+  double start = sys_time();
+  bvh_mark_obj(b, 0);
+  double init_secs = sys_time() - start;
+  bvh_refit_dirty(b, s);
+
+  double total_secs = 0.0;
+  for(uint32_t f=0; f<REFIT_FRAMES; f++) {
+    for(uint32_t i=0; i<moved; i++) {
+      uint32_t idx = rand() % s->obj_cnt;
+      obj *ob = scn_get_obj(s, idx);
+      if(ob->shape_type != SPHERE)
+        continue;
+      sphere *sp = scn_get_shape(s, ob->shape_ofs);
+      sp->center = vec3_add(sp->center, vec3_rand_rng(-0.05f, 0.05f));
+      bvh_mark_obj(b, idx);
+    }
+    start = sys_time();
+    bvh_refit_dirty(b, s);
+    total_secs += sys_time() - start;
+  }
+
+  // Full refit needs to give the same bounds
+  size_t size = b->node_cnt * sizeof(*b->nodes);
+  bvh_node *nodes = malloc(size);
+  memcpy(nodes, b->nodes, size);
+  start = sys_time();
+  bvh_refit(b, s);
+  double full_secs = sys_time() - start;
+
+  printf("bvh refit: %zu objs, %u moved per frame, maps %.3f ms,"
+      " dirty refit %.3f us/frame, full refit %.3f ms, %s\n",
+      s->obj_cnt, moved, init_secs * 1000.0, total_secs / REFIT_FRAMES * 1e6,
+      full_secs * 1000.0,
+      memcmp(nodes, b->nodes, size) == 0 ? "bounds match" : "BOUNDS DIFFER");
+
+  free(nodes);
+  bvh_release(b);
+}
+
+static size_t calc_scn_bytes(const scn *s)
+{
+  return s->obj_cnt * sizeof(*s->objs) + s->shape_buf_size + s->mat_buf_size;
+}
+
+static size_t calc_bvh_bytes(const bvh *b)
+{
+  return b->node_cnt * sizeof(*b->nodes) + b->idx_cnt * sizeof(*b->indices);
+}
+
+static aabb calc_obj_aabb(const scn *s, const obj *ob)
+{
+  switch(ob->shape_type) {
+    case SPHERE:
+      return sphere_get_aabb(scn_get_shape(s, ob->shape_ofs));
+    default:
+      // Quads, baked ones start like a quad
+      return quad_get_aabb(scn_get_shape(s, ob->shape_ofs));
+  }
+}
+
+// Checks that the box of each instance covers all objects of its blas, i.e.
+// renders do not depend on the bvh options of the blases (e.g. -H)
+static bool check_inst_bounds(const tlas *t)
+{
+  for(size_t i=0; i<t->inst_cnt; i++) {
+    const inst *in = &t->insts[i];
+    const scn *s = t->blases[in->blas_idx].scn;
+    aabb box = aabb_init();
+    for(size_t j=0; j<s->obj_cnt; j++)
+      box = aabb_combine(box, calc_obj_aabb(s, scn_get_obj(s, j)));
+    box = tfm_aabb(&in->obj_to_world, box);
+    aabb ib = t->boxes[i];
+    if(box.min.x < ib.min.x || box.min.y < ib.min.y || box.min.z < ib.min.z ||
+        box.max.x > ib.max.x || box.max.y > ib.max.y || box.max.z > ib.max.z)
+      return false;
+  }
+  return true;
+}
+
+static void create_inst_scn(inst_scn *is, uint32_t grid, const bvh_opts *bo,
+    cam *c)
+{
+  // Box with a few spheres on top
+  scn *m = scn_init(9, scn_calc_shape_buf_size(3, 6), scn_calc_mat_buf_size(2, 1, 1));
+  add_box(m, (vec3){ -0.5f, 0.0f, -0.5f }, (vec3){ 0.5f, 1.0f, 0.5f }, LAMBERT,
+      scn_add_mat(m, &(basic){ .albedo = { 0.6f, 0.3f, 0.2f } }, sizeof(basic)));
+  scn_add_obj(m, &(obj){ SPHERE,
+      scn_add_shape(m, &(sphere){ { -0.25f, 1.3f, 0.0f }, 0.3f }, sizeof(sphere)),
+      METAL, scn_add_mat(m, &(metal){ { 0.8f, 0.8f, 0.9f }, 0.1f }, sizeof(metal)) });
+  scn_add_obj(m, &(obj){ SPHERE,
+      scn_add_shape(m, &(sphere){ { 0.25f, 1.3f, 0.0f }, 0.3f }, sizeof(sphere)),
+      GLASS, scn_add_mat(m, &(glass){ { 1.0f, 1.0f, 1.0f }, 1.5f }, sizeof(glass)) });
+  scn_add_obj(m, &(obj){ SPHERE,
+      scn_add_shape(m, &(sphere){ { 0.0f, 1.9f, 0.0f }, 0.3f }, sizeof(sphere)),
+      LAMBERT, scn_add_mat(m, &(basic){ .albedo = { 0.2f, 0.5f, 0.3f } }, sizeof(basic)) });
+
+  scn *g = scn_init(1, scn_calc_shape_buf_size(1, 0), scn_calc_mat_buf_size(1, 0, 0));
+  scn_add_obj(g, &(obj){ SPHERE,
+      scn_add_shape(g, &(sphere){ { 0.0f, -1000.0f, 0.0f }, 1000.0f }, sizeof(sphere)),
+      LAMBERT, scn_add_mat(g, &(basic){ .albedo = { 0.5f, 0.5f, 0.5f } }, sizeof(basic)) });
+
+  is->model = m;
+  is->model_bvh = bvh_init(m->obj_cnt, bo);
+  bvh_create(is->model_bvh, m);
+  is->ground = g;
+  is->ground_bvh = bvh_init(g->obj_cnt, bo);
+  bvh_create(is->ground_bvh, g);
+
+  is->tlas = tlas_init(2, grid * grid + 1);
+  uint32_t model_idx = tlas_add_blas(is->tlas, m, is->model_bvh);
+  tlas_add_inst(is->tlas, tlas_add_blas(is->tlas, g, is->ground_bvh),
+      tfm_identity());
+
+  float ofs = 0.5f * INST_SPACING * (grid - 1);
+  for(uint32_t j=0; j<grid; j++) {
+    for(uint32_t i=0; i<grid; i++) {
+      vec3 pos = { i * INST_SPACING - ofs, 0.0f, j * INST_SPACING - ofs };
+      tfm t = tfm_mul(tfm_translate(pos),
+          tfm_mul(tfm_rot_y(randf_rng(0.0f, TWO_PI)),
+            tfm_scale(randf_rng(0.5f, 1.2f))));
+      tlas_add_inst(is->tlas, model_idx, t);
+    }
+  }
+
+  tlas_build(is->tlas);
+
+  *c = (cam){ .vert_fov = 30.0f, .foc_dist = 10.0f, .foc_angle = 0.0f };
+  cam_set(c, (vec3){ 0.0f, 8.0f, ofs + 12.0f }, (vec3){ 0.0f, 0.0f, ofs - 10.0f });
+}
+
+static void release_inst_scn(inst_scn *is)
+{
+  tlas_release(is->tlas);
+  bvh_release(is->ground_bvh);
+  scn_release(is->ground);
+  bvh_release(is->model_bvh);
+  scn_release(is->model);
+}
+
+static void print_inst_scn(inst_scn *is)
+{
+  tlas *t = is->tlas;
+  size_t model_bytes = calc_scn_bytes(is->model) +
+    calc_bvh_bytes(is->model_bvh);
+  size_t tlas_bytes = t->inst_cnt * (sizeof(*t->insts) + sizeof(*t->boxes)) +
+    calc_bvh_bytes(t->bvh);
+
+  // Estimate of the same scene with every instance copied into one bvh
+  size_t flat_obj_cnt = (t->inst_cnt - 1) * is->model->obj_cnt;
+  size_t flat_bytes = (t->inst_cnt - 1) * calc_scn_bytes(is->model) +
+    (2 * flat_obj_cnt - 1) * sizeof(bvh_node) + flat_obj_cnt * sizeof(uint32_t);
+
+  printf("tlas: %zu insts, model %zu objs %zu bytes, tlas %zu bytes,"
+      " flattened ~%zu bytes\n", t->inst_cnt, is->model->obj_cnt, model_bytes,
+      tlas_bytes, flat_bytes);
+
+  // Move some instances, only the top level is rebuilt
+  double start = sys_time();
+  for(uint32_t i=0; i<INST_MOVED; i++) {
+    uint32_t idx = 1 + rand() % (t->inst_cnt - 1);
+    tfm m = tfm_mul(tfm_translate((vec3){ 0.0f, 0.01f, 0.0f }),
+        t->insts[idx].obj_to_world);
+    tlas_set_tfm(t, idx, m);
+  }
+  tlas_build(t);
+  double secs = sys_time() - start;
+  printf("tlas: moved %u insts and rebuilt in %.3f ms, %s\n", INST_MOVED,
+      secs * 1000.0, check_inst_bounds(t) ?
+      "inst bounds cover objs" : "INST BOUNDS MISS OBJS");
+}
+
+// Traces rays through c if given, else through b. Returns ns per ray,
+// writes cache misses per ray or -1.
+static double trace_rays(const bvh *b, const cbvh *c, const scn *s,
+    const ray *rays, float *dists, uint32_t cnt, double *misses)
+{
+  int fd = sys_cache_misses_open();
+  uint64_t start_misses = sys_cache_misses_read(fd);
+  double start = sys_time();
+  for(uint32_t i=0; i<cnt; i++) {
+    ray r = rays[i];
+    uint32_t obj_idx;
+    if(c)
+      cbvh_intersect(c, s, &r, &obj_idx);
+    else
+      bvh_intersect(b, s, &r, &obj_idx);
+    dists[i] = r.t;
+  }
+  double secs = sys_time() - start;
+  *misses = fd >= 0 ?
+    (double)(sys_cache_misses_read(fd) - start_misses) / cnt : -1.0;
+  sys_cache_misses_close(fd);
+  return secs * 1e9 / cnt;
+}
+
+static void print_trav(const char *name, double ns, double misses)
+{
+  if(misses >= 0.0)
+    printf("bvh traversal (%s): %.1f ns/ray, %.2f cache misses/ray\n",
+        name, ns, misses);
+  else
+    printf("bvh traversal (%s): %.1f ns/ray, cache misses n/a\n", name, ns);
+}
+
+// Incoherent rays starting at random objects, traced before and after
+// moving the scene into leaf order
+static void bench_trav(scn *s, const opts *o)
+{
+  bvh *b = bvh_init(s->obj_cnt, &o->bvh);
+  create_bvh(b, s, o);
+  uint32_t cnt = o->trav_rays;
+
+  ray *rays = malloc(cnt * sizeof(*rays));
+  float *dists = malloc(2 * cnt * sizeof(*dists));
+  for(uint32_t i=0; i<cnt; i++) {
+    aabb box = calc_obj_aabb(s, scn_get_obj(s, rand() % s->obj_cnt));
+    vec3 ori = vec3_scale(vec3_add(box.min, box.max), 0.5f);
+    vec3 dir = vec3_unit(vec3_rand_rng(-1.0f, 1.0f));
+    ray_create(&rays[i], ori, dir, RAY_EPSILON, MAX_DISTANCE);
+  }
+
+  double misses;
+  double ns = trace_rays(b, NULL, s, rays, dists, cnt, &misses);
+  print_trav("indices", ns, misses);
+
+  bvh_reorder_scn(b, s);
+  ns = trace_rays(b, NULL, s, rays, dists + cnt, cnt, &misses);
+  print_trav("leaf order", ns, misses);
+
+  printf("bvh traversal: %u rays, hits %s\n", cnt,
+      memcmp(dists, dists + cnt, cnt * sizeof(*dists)) == 0 ? "match" : "DIFFER");
+
+  if(o->compressed) {
+    cbvh *c = cbvh_create(b);
+    ns = trace_rays(b, c, s, rays, dists + cnt, cnt, &misses);
+    print_trav("compressed, leaf order", ns, misses);
+    printf("bvh traversal: compressed %zu bytes (binary %zu bytes), hits %s\n",
+        c->node_cnt * sizeof(*c->nodes), (b->node_cnt + 1) * sizeof(*b->nodes),
+        memcmp(dists, dists + cnt, cnt * sizeof(*dists)) == 0 ? "match" : "DIFFER");
+    cbvh_release(c);
+  }
+
+  free(dists);
+  free(rays);
+  bvh_release(b);
+}
+
+// One function of fmath checked against libm and double precision. Two
+// argument functions have y in [ylo, yhi].
+typedef struct math_case {
+  const char  *name;
+  float       lo;
+  float       hi;
+  float       ylo;
+  float       yhi;
+  float       (*fn)(float, float);
+  float       (*lib)(float, float);
+  double      (*ref)(double, double);
+  void        (*batch)(float *, const float *, size_t); // Optional
+} math_case;
+
+static float fm_sqrt(float x, float y) { return fmath_sqrt(x); }
+static float fm_sin(float x, float y) { return fmath_sin(x); }
+static float fm_cos(float x, float y) { return fmath_cos(x); }
+static float fm_tan(float x, float y) { return fmath_tan(x); }
+static float fm_acos(float x, float y) { return fmath_acos(x); }
+static float fm_atan2(float x, float y) { return fmath_atan2(y, x); }
+static float fm_pow(float x, float y) { return fmath_pow(x, y); }
+
+static float lib_sqrt(float x, float y) { return sqrtf(x); }
+static float lib_sin(float x, float y) { return sinf(x); }
+static float lib_cos(float x, float y) { return cosf(x); }
+static float lib_tan(float x, float y) { return tanf(x); }
+static float lib_acos(float x, float y) { return acosf(x); }
+static float lib_atan2(float x, float y) { return atan2f(y, x); }
+static float lib_pow(float x, float y) { return powf(x, y); }
+
+static double ref_sqrt(double x, double y) { return __builtin_sqrt(x); }
+static double ref_sin(double x, double y) { return __builtin_sin(x); }
+static double ref_cos(double x, double y) { return __builtin_cos(x); }
+static double ref_tan(double x, double y) { return __builtin_tan(x); }
+static double ref_acos(double x, double y) { return __builtin_acos(x); }
+static double ref_atan2(double x, double y) { return __builtin_atan2(y, x); }
+static double ref_pow(double x, double y) { return __builtin_pow(x, y); }
+
+static void pow_gamma_n(float *dst, const float *x, size_t cnt)
+{
+  fmath_pow_n(dst, x, GAMMA, cnt);
+}
+
+static double calc_ulp(double v)
+{
+  union { float f; uint32_t u; } b = { .f = (float)(v < 0.0 ? -v : v) };
+  float f = b.f;
+  b.u++;
+  return (double)b.f - f;
+}
+
+static double bench_math_fn(const math_case *m, bool lib, const float *x,
+    const float *y, uint32_t cnt)
+{
+  volatile float sink = 0.0f;
+  double min_secs = 1e30;
+  for(uint32_t r=0; r<MATH_RUNS; r++) {
+    float sum = 0.0f;
+    double start = sys_time();
+    for(uint32_t i=0; i<cnt; i++)
+      sum += lib ? m->lib(x[i], y[i]) : m->fn(x[i], y[i]);
+    min_secs = min(min_secs, sys_time() - start);
+    sink += sum;
+  }
+  return min_secs * 1e9 / cnt;
+}
+
+static double bench_math_batch(const math_case *m, const float *x, float *v,
+    uint32_t cnt)
+{
+  double min_secs = 1e30;
+  for(uint32_t r=0; r<MATH_RUNS; r++) {
+    double start = sys_time();
+    m->batch(v, x, cnt);
+    min_secs = min(min_secs, sys_time() - start);
+  }
+  return min_secs * 1e9 / cnt;
+}
+
+// Max errors of fmath and libm against double precision and ns per value
+static void bench_math(uint32_t cnt)
+{
+  const math_case cases[] = {
+    { "sqrt", 0.0f, 1e4f, 0.0f, 0.0f, fm_sqrt, lib_sqrt, ref_sqrt, fmath_sqrt_n },
+    { "sin", -PI, PI, 0.0f, 0.0f, fm_sin, lib_sin, ref_sin, fmath_sin_n },
+    { "sin", -1e4f, 1e4f, 0.0f, 0.0f, fm_sin, lib_sin, ref_sin, fmath_sin_n },
+    { "cos", -PI, PI, 0.0f, 0.0f, fm_cos, lib_cos, ref_cos, fmath_cos_n },
+    { "cos", -1e4f, 1e4f, 0.0f, 0.0f, fm_cos, lib_cos, ref_cos, fmath_cos_n },
+    { "tan", -1.5f, 1.5f, 0.0f, 0.0f, fm_tan, lib_tan, ref_tan, NULL },
+    { "tan", -1e4f, 1e4f, 0.0f, 0.0f, fm_tan, lib_tan, ref_tan, NULL },
+    { "acos", -1.0f, 1.0f, 0.0f, 0.0f, fm_acos, lib_acos, ref_acos, NULL },
+    { "atan2", -10.0f, 10.0f, -10.0f, 10.0f, fm_atan2, lib_atan2, ref_atan2, NULL },
+    { "pow", 0.0f, 1.0f, GAMMA, GAMMA, fm_pow, lib_pow, ref_pow, pow_gamma_n },
+    { "pow", 0.1f, 10.0f, -4.0f, 4.0f, fm_pow, lib_pow, ref_pow, NULL } };
+
+  float *x = malloc(3 * cnt * sizeof(*x));
+  float *y = x + cnt;
+  float *v = y + cnt;
+
+  for(uint32_t c=0; c<sizeof(cases) / sizeof(*cases); c++) {
+    const math_case *m = &cases[c];
+    for(uint32_t i=0; i<cnt; i++) {
+      x[i] = randf_rng(m->lo, m->hi);
+      y[i] = randf_rng(m->ylo, m->yhi);
+    }
+
+    // ulp of the float result, relative error for pow
+    double err[2] = { 0.0, 0.0 };
+    double abs_err = 0.0;
+    for(uint32_t i=0; i<cnt; i++) {
+      double ref = m->ref(x[i], y[i]);
+      for(uint32_t l=0; l<2; l++) {
+        double d = (l ? m->lib(x[i], y[i]) : m->fn(x[i], y[i])) - ref;
+        d = d < 0.0 ? -d : d;
+        err[l] = max(err[l], m->fn == fm_pow ?
+            (ref != 0.0 ? d / (ref < 0.0 ? -ref : ref) : d) : d / calc_ulp(ref));
+        if(l == 0)
+          abs_err = max(abs_err, d);
+      }
+    }
+
+    printf("fmath %s [%g, %g]: max err %.3g %s (libm %.3g), abs %.3g,"
+        " %.2f ns (libm %.2f ns)", m->name, m->lo, m->hi, err[0],
+        m->fn == fm_pow ? "rel" : "ulp", err[1], abs_err,
+        bench_math_fn(m, false, x, y, cnt), bench_math_fn(m, true, x, y, cnt));
+
+    if(m->batch) {
+      double ns = bench_math_batch(m, x, v, cnt);
+      double diff = 0.0;
+      for(uint32_t i=0; i<cnt; i++) {
+        float s = m->fn(x[i], y[i]);
+        diff = max(diff, (v[i] < s ? s - v[i] : v[i] - s) / calc_ulp(s));
+      }
+      printf(", batch %.2f ns, %.3g ulp from scalar", ns, diff);
+    }
+    printf("\n");
+  }
+
+  free(x);
+}
+
+static bool write_img(const char *path, const vec3 *acc, uint32_t width,
+    uint32_t height, uint32_t spp)
+{
+  FILE *f = fopen(path, "wb");
+  if(!f)
+    return false;
+
+  size_t len = strlen(path);
+  bool pfm = len > 4 && strcmp(path + len - 4, ".pfm") == 0;
+  float inv_spp = 1.0f / spp;
+
+  if(pfm) {
+    // Linear float data, bottom to top, negative scale means little endian
+    fprintf(f, "PF\n%u %u\n-1.0\n", width, height);
+    for(int32_t j=height - 1; j>=0; j--) {
+      for(uint32_t i=0; i<width; i++) {
+        vec3 c = vec3_scale(acc[width * j + i], inv_spp);
+        fwrite(&c, sizeof(c), 1, f);
+      }
+    }
+  } else {
+    fprintf(f, "P6\n%u %u\n255\n", width, height);
+    for(uint32_t i=0; i<width * height; i++) {
+      vec3 c = vec3_scale(acc[i], inv_spp);
+      unsigned char rgb[3] = {
+        255.0f * min(powf(c.x, 0.4545f), 1.0f),
+        255.0f * min(powf(c.y, 0.4545f), 1.0f),
+        255.0f * min(powf(c.z, 0.4545f), 1.0f) };
+      fwrite(rgb, sizeof(rgb), 1, f);
+    }
+  }
+
+  fclose(f);
+  return true;
+}
+
+static scn *create_scn(const char *name, uint32_t grid, cam *c)
+{
+  if(strcmp(name, "spheres") == 0)
+    return create_scn_spheres(c);
+  if(strcmp(name, "quads") == 0)
+    return create_scn_quads(c);
+  if(strcmp(name, "emitter") == 0)
+    return create_scn_emitter(c);
+  if(strcmp(name, "riow") == 0)
+    return grid > 0 ? create_scn_riow_grid(c, grid) : create_scn_riow(c);
+  return NULL;
+}
+
+static bool parse_opts(opts *o, int argc, char *argv[])
+{
+  for(int i=1; i<argc; i++) {
+    const char *a = argv[i];
+    if(strcmp(a, "-c") == 0) {
+      o->scaling = true;
+      continue;
+    }
+    if(strcmp(a, "-M") == 0) {
+      o->lbvh = true;
+      continue;
+    }
+    if(strcmp(a, "-z") == 0) {
+      o->lazy = true;
+      continue;
+    }
+    if(strcmp(a, "-O") == 0) {
+      o->leaf_order = true;
+      continue;
+    }
+    if(strcmp(a, "-Q") == 0) {
+      o->compressed = true;
+      continue;
+    }
+    if(strcmp(a, "-W") == 0) {
+      o->wide = true;
+      continue;
+    }
+    if(strcmp(a, "-Y") == 0) {
+      o->bvh.typed_leaves = true;
+      continue;
+    }
+    if(strcmp(a, "-F") == 0) {
+      o->bvh.full_sweep = true;
+      continue;
+    }
+    if(strcmp(a, "-q") == 0) {
+      o->sobol = true;
+      continue;
+    }
+    if(strcmp(a, "-K") == 0) {
+      o->baked = true;
+      continue;
+    }
+    if(i + 1 >= argc || a[0] != '-' || strlen(a) != 2)
+      return false;
+    const char *v = argv[++i];
+    switch(a[1]) {
+      case 's': o->scn_name = v; break;
+      case 'o': o->out_path = v; break;
+      case 'f': o->pack_in = v; break;
+      case 'e': o->pack_out = v; break;
+      case 'w': if(sscanf(v, "%u", &o->width) != 1) return false; break;
+      case 'h': if(sscanf(v, "%u", &o->height) != 1) return false; break;
+      case 'p': if(sscanf(v, "%u", &o->spp) != 1) return false; break;
+      case 'n': if(sscanf(v, "%u", &o->passes) != 1) return false; break;
+      case 'b': if(sscanf(v, "%u", &o->bounces) != 1) return false; break;
+      case 't': if(sscanf(v, "%u", &o->thread_cnt) != 1) return false; break;
+      case 'j': if(sscanf(v, "%u", &o->bld_thread_cnt) != 1) return false; break;
+      case 'g': if(sscanf(v, "%u", &o->grid) != 1) return false; break;
+      case 'B': if(sscanf(v, "%u", &o->bench_runs) != 1) return false; break;
+      case 'R': if(sscanf(v, "%u", &o->refit_moved) != 1) return false; break;
+      case 'P': if(sscanf(v, "%u", &o->trav_rays) != 1) return false; break;
+      case 'A': if(sscanf(v, "%u", &o->math_cnt) != 1) return false; break;
+      case 'k': if(sscanf(v, "%u", &o->sampler_ref_spp) != 1) return false; break;
+      case 'I': if(sscanf(v, "%u", &o->bvh.interval_cnt) != 1) return false; break;
+      case 'T': if(sscanf(v, "%f", &o->bvh.trav_cost) != 1) return false; break;
+      case 'X': if(sscanf(v, "%f", &o->bvh.isect_cost) != 1) return false; break;
+      case 'l': if(sscanf(v, "%u", &o->bvh.min_leaf_cnt) != 1) return false; break;
+      case 'L': if(sscanf(v, "%u", &o->bvh.max_leaf_cnt) != 1) return false; break;
+      case 'D': if(sscanf(v, "%u", &o->bvh.max_depth) != 1) return false; break;
+      case 'Z': if(sscanf(v, "%f", &o->opt_secs) != 1) return false; break;
+      case 'H': if(sscanf(v, "%f", &o->bvh.huge_ratio) != 1) return false; break;
+      case 'S':
+        if(sscanf(v, "%f", &o->bvh.dup_budget) != 1) return false;
+        o->bvh.spatial_splits = true;
+        break;
+      default: return false;
+    }
+  }
+
+  return o->width > 0 && o->height > 0 && o->spp > 0 && o->passes > 0 &&
+    o->thread_cnt > 0;
+}
+
+int main(int argc, char *argv[])
+{
+  opts o = { .scn_name = "riow", .out_path = "out.ppm", .width = 800,
+    .height = 500, .spp = 5, .passes = 4, .bounces = 5,
+    .thread_cnt = sys_cpu_cnt(), .bld_thread_cnt = sys_cpu_cnt(),
+    .bvh = bvh_default_opts() };
+
+  if(!parse_opts(&o, argc, argv)) {
+    fprintf(stderr, "Usage: %s [-s spheres|quads|emitter|riow|inst] [-o out.ppm|out.pfm]"
+        " [-w width] [-h height] [-p spp per pass] [-n passes] [-b bounces]"
+        " [-t threads] [-c (thread scaling)] [-W (wide bvh traversal)]"
+        " [-Q (compressed bvh traversal)]"
+        " [-g riow grid size or inst grid size]"
+        " [-B bvh build benchmark runs] [-j bvh build threads (0 = serial)]"
+        " [-R bvh refit benchmark, objs moved per frame]"
+        " [-P bvh traversal benchmark rays] [-O (objs in bvh leaf order)]"
+        " [-M (morton lbvh build)] [-z (lazy bvh build while rendering)]"
+        " [-I bvh bins] [-F (bvh full sweep)] [-Y (bvh leaves of one shape type)]"
+        " [-T bvh traversal cost]"
+        " [-X bvh intersection cost] [-l bvh min leaf objs]"
+        " [-L bvh max leaf objs] [-D bvh max depth]"
+        " [-S bvh spatial splits, extra refs per obj (e.g. 0.3)]"
+        " [-H bvh huge obj area ratio (0 = off)]"
+        " [-Z bvh treelet optimization time budget in s]"
+        " [-e write scene and bvh to file] [-f load scene and bvh from file]"
+        " [-A fmath accuracy and benchmark, values per function]"
+        " [-q (scrambled sobol sampler)]"
+        " [-k sampler rmse benchmark, reference spp]"
+        " [-K (baked quad records)]\n",
+        argv[0]);
+    return 1;
+  }
+
+  // Only the binned SAH builds tag leaves with their shape type
+  if(o.bvh.typed_leaves && (o.lbvh || o.bvh.spatial_splits)) {
+    fprintf(stderr, "-Y is not supported by the lbvh (-M) and spatial split"
+        " (-S) builds\n");
+    return 1;
+  }
+
+  // A loaded scene is read-only and comes with its bvh
+  if(o.pack_in && (o.trav_rays > 0 || o.refit_moved > 0 || o.bench_runs > 0 ||
+        o.lazy || o.pack_out)) {
+    fprintf(stderr, "-f renders the loaded scene only\n");
+    return 1;
+  }
+
+  srand(42u, 303u);
+
+  if(o.math_cnt > 0) {
+    bench_math(o.math_cnt);
+    return 0;
+  }
+
+  cam c;
+  inst_scn is = { 0 };
+  scn *s = NULL;
+  pack *pk = NULL;
+  if(o.pack_in) {
+    double start = sys_time();
+    if(!(pk = pack_load(o.pack_in))) {
+      fprintf(stderr, "Failed to load '%s'\n", o.pack_in);
+      return 1;
+    }
+    s = pk->scn;
+    c = pk->cam;
+    printf("pack: loaded %zu objs, %zu nodes, %zu bytes mapped, %.3f ms\n",
+        s->obj_cnt, pk->bvh->node_cnt, pk->size, (sys_time() - start) * 1000.0);
+  } else if(strcmp(o.scn_name, "inst") == 0) {
+    create_inst_scn(&is, o.grid > 0 ? o.grid : 100, &o.bvh, &c);
+    print_inst_scn(&is);
+  } else if(!(s = create_scn(o.scn_name, o.grid, &c))) {
+    fprintf(stderr, "Unknown scene '%s'\n", o.scn_name);
+    return 1;
+  } else {
+    if(o.baked)
+      scn_bake(s);
+    print_scn_stats(s);
+  }
+
+  if(s && o.trav_rays > 0) {
+    bench_trav(s, &o);
+    scn_release(s);
+    return 0;
+  }
+
+  if(s && o.refit_moved > 0) {
+    bench_refit(s, &o);
+    scn_release(s);
+    return 0;
+  }
+
+  if(s && o.bench_runs > 0) {
+    bench_bvh(s, &o);
+    scn_release(s);
+    return 0;
+  }
+
+  bvh *b = NULL;
+  bvh_lazy *lazy = NULL;
+  if(pk) {
+    b = pk->bvh;
+  } else if(s && o.lazy) {
+    double start = sys_time();
+    b = bvh_init(s->obj_cnt, &o.bvh);
+    lazy = bvh_lazy_init(b, s);
+    printf("bvh: %zu objs, lazy, %.3f ms\n", s->obj_cnt,
+        (sys_time() - start) * 1000.0);
+  } else if(s) {
+    double start = sys_time();
+    b = bvh_init(s->obj_cnt, &o.bvh);
+    create_bvh(b, s, &o);
+    printf("bvh: %zu objs, %zu nodes, max depth %u, %.3f ms\n",
+        s->obj_cnt, b->node_cnt, b->depth, (sys_time() - start) * 1000.0);
+    print_bvh_stats(b);
+    if(o.leaf_order)
+      bvh_reorder_scn(b, s);
+
+    size_t alloc_bytes = (b->node_cap + 1) * sizeof(*b->nodes);
+    bvh_shrink(b);
+    printf("bvh shrink: %zu node bytes allocated, %zu after shrinking\n",
+        alloc_bytes, (b->node_cap + 1) * sizeof(*b->nodes));
+
+    if(o.pack_out) {
+      start = sys_time();
+      if(!pack_write(o.pack_out, s, b, &c)) {
+        fprintf(stderr, "Failed to write '%s'\n", o.pack_out);
+        return 1;
+      }
+      printf("pack: wrote '%s', %.3f ms\n", o.pack_out,
+          (sys_time() - start) * 1000.0);
+    }
+  }
+
+  wbvh *w = NULL;
+  if(b && o.wide && !lazy) {
+    double start = sys_time();
+    w = wbvh_create(b);
+    printf("wbvh: %u wide, %zu nodes, %zu bytes (binary %zu bytes), %.3f ms\n",
+        WBVH_WIDTH, w->node_cnt, w->node_cnt * sizeof(*w->nodes),
+        b->node_cnt * sizeof(*b->nodes), (sys_time() - start) * 1000.0);
+  }
+
+  cbvh *cb = NULL;
+  if(b && o.compressed && !lazy) {
+    double start = sys_time();
+    cb = cbvh_create(b);
+    printf("cbvh: %zu nodes, %zu bytes (binary %zu bytes), %.3f ms\n",
+        cb->node_cnt, cb->node_cnt * sizeof(*cb->nodes),
+        (b->node_cnt + 1) * sizeof(*b->nodes), (sys_time() - start) * 1000.0);
+  }
+
+  view v;
+  view_calc(&v, o.width, o.height, &c);
+
+  size_t acc_size = o.width * o.height * sizeof(vec3);
+  rend r = { .cfg = { o.width, o.height, o.spp, o.bounces }, .scn = s,
+    .bvh = b, .wbvh = w, .cbvh = cb, .lazy = lazy, .tlas = is.tlas, .cam = &c, .view = &v, .bg_col = { 0.7f, 0.8f, 1.0f },
+    .sobol = o.sobol, .acc = malloc(acc_size) };
+
+  if(o.sampler_ref_spp > 0) {
+    bench_sampler(&r, o.sampler_ref_spp, o.thread_cnt);
+    free(r.acc);
+    return 0;
+  }
+
+  // Thread counts to run, either just the requested one or doubling up to it
+  uint32_t first = o.scaling ? 1 : o.thread_cnt;
+  for(uint32_t t=first; t<=o.thread_cnt; t=(t < o.thread_cnt) ? min(2 * t, o.thread_cnt) : t + 1) {
+    memset(r.acc, 0, acc_size);
+    double secs = render(&r, o.passes, t);
+    double smpls = (double)o.width * o.height * o.spp * o.passes;
+    printf("render: %u threads, %.3f s, %.3f Msamples/s, %.3f Msamples/s/thread\n",
+        t, secs, smpls / secs * 1e-6, smpls / secs * 1e-6 / t);
+  }
+
+  if(lazy) {
+    size_t pending_cnt = bvh_lazy_finish(lazy);
+    printf("bvh lazy: %zu nodes built, %zu of %zu objs in unbuilt nodes\n",
+        b->node_cnt, pending_cnt, b->idx_cnt);
+    print_bvh_stats(b);
+  }
+
+  if(!write_img(o.out_path, r.acc, o.width, o.height, o.spp * o.passes)) {
+    fprintf(stderr, "Failed to write '%s'\n", o.out_path);
+    return 1;
+  }
+
+  free(r.acc);
+  if(cb)
+    cbvh_release(cb);
+  if(w)
+    wbvh_release(w);
+  if(pk) {
+    pack_release(pk);
+  } else if(s) {
+    bvh_release(b);
+    scn_release(s);
+  } else {
+    release_inst_scn(&is);
+  }
+
+  return 0;
+}
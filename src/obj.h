@@ -9,6 +9,7 @@ typedef enum shape_type {
   CYLINDER,
   QUAD,
   MESH,
+  QUAD_BAKED, // See scn_bake, at most 7 (BVH_TYPE_SHIFT)
 } shape_type;
 
 typedef enum mat_type {
@@ -21,9 +22,9 @@ typedef enum mat_type {
 
 typedef struct obj {
   shape_type  shape_type;
-  size_t      shape_ofs;
+  uint32_t    shape_ofs;
   mat_type    mat_type;
-  size_t      mat_ofs;
+  uint32_t    mat_ofs;
 } obj;
 
 #endif
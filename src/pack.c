@@ -0,0 +1,176 @@
+#include "pack.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "sutil.h"
+#include "sys.h"
+#include "scn.h"
+#include "obj.h"
+#include "bvh.h"
+
+#define PACK_MAGIC 0x4b504e52 // "RNPK"
+
+enum pack_sec {
+  SEC_OBJS,
+  SEC_SHAPES,
+  SEC_MATS,
+  SEC_NODES,
+  SEC_INDICES,
+  SEC_CNT
+};
+
+typedef struct section {
+  uint64_t  ofs;  // From the start of the file
+  uint64_t  size;
+} section;
+
+typedef struct pack_hdr {
+  uint32_t  magic;
+  uint32_t  version;
+  uint32_t  obj_size;   // Layout checks
+  uint32_t  node_size;
+  uint64_t  obj_cnt;
+  uint64_t  node_cnt;   // Without the huge objects leaf
+  uint64_t  idx_cnt;
+  uint64_t  huge_cnt;
+  uint64_t  bvh_obj_cnt;
+  uint32_t  depth;
+  uint32_t  leaf_order;
+  bvh_opts  opts;
+  cam       cam;
+  section   secs[SEC_CNT];
+} pack_hdr;
+
+static uint64_t align_ofs(uint64_t ofs)
+{
+  return (ofs + PACK_ALIGN - 1) & ~(uint64_t)(PACK_ALIGN - 1);
+}
+
+bool pack_write(const char *path, const scn *s, const bvh *b, const cam *c)
+{
+  const void *data[SEC_CNT] = {
+    s->objs, s->shape_buf, s->mat_buf, b->nodes, b->indices };
+
+  pack_hdr h;
+  memset(&h, 0, sizeof(h)); // No undefined padding in the file
+  h.magic = PACK_MAGIC;
+  h.version = PACK_VERSION;
+  h.obj_size = sizeof(*s->objs);
+  h.node_size = sizeof(*b->nodes);
+  h.obj_cnt = s->obj_cnt;
+  h.node_cnt = b->node_cnt;
+  h.idx_cnt = b->idx_cnt;
+  h.huge_cnt = b->huge_cnt;
+  h.bvh_obj_cnt = b->obj_cnt;
+  h.depth = b->depth;
+  h.leaf_order = b->leaf_order;
+  h.opts = b->opts;
+  h.cam = *c;
+
+  uint64_t sizes[SEC_CNT] = {
+    s->obj_cnt * sizeof(*s->objs), s->shape_buf_size, s->mat_buf_size,
+    (b->node_cnt + 1) * sizeof(*b->nodes),
+    (b->idx_cnt + b->huge_cnt) * sizeof(*b->indices) };
+
+  uint64_t ofs = align_ofs(sizeof(h));
+  for(uint32_t i=0; i<SEC_CNT; i++) {
+    h.secs[i] = (section){ ofs, sizes[i] };
+    ofs = align_ofs(ofs + sizes[i]);
+  }
+
+  FILE *f = fopen(path, "wb");
+  if(!f)
+    return false;
+
+  static const uint8_t zeros[PACK_ALIGN] = { 0 };
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  uint64_t pos = sizeof(h);
+  for(uint32_t i=0; i<SEC_CNT && ok; i++) {
+    size_t pad = h.secs[i].ofs - pos;
+    ok = fwrite(zeros, 1, pad, f) == pad &&
+      fwrite(data[i], 1, sizes[i], f) == sizes[i];
+    pos = h.secs[i].ofs + sizes[i];
+  }
+
+  return fclose(f) == 0 && ok;
+}
+
+static bool check_hdr(const pack_hdr *h, size_t size)
+{
+  if(h->magic != PACK_MAGIC || h->version != PACK_VERSION ||
+      h->obj_size != sizeof(obj) || h->node_size != sizeof(bvh_node))
+    return false;
+
+  uint64_t sizes[SEC_CNT] = {
+    h->obj_cnt * sizeof(obj), h->secs[SEC_SHAPES].size,
+    h->secs[SEC_MATS].size, (h->node_cnt + 1) * sizeof(bvh_node),
+    (h->idx_cnt + h->huge_cnt) * sizeof(uint32_t) };
+
+  for(uint32_t i=0; i<SEC_CNT; i++) {
+    const section *sec = &h->secs[i];
+    if(sec->size != sizes[i] || sec->ofs % PACK_ALIGN != 0 ||
+        sec->ofs > size || sec->size > size - sec->ofs)
+      return false;
+  }
+
+  return true;
+}
+
+pack *pack_load(const char *path)
+{
+  size_t size = 0;
+  void *addr = sys_map_file(path, &size);
+  if(!addr)
+    return NULL;
+
+  const pack_hdr *h = addr;
+  if(size < sizeof(*h) || !check_hdr(h, size)) {
+    sys_unmap_file(addr, size);
+    return NULL;
+  }
+
+  // Mapped read-only, writes through these pointers fault
+  uint8_t *base = addr;
+  pack *p = malloc(sizeof(*p));
+  p->addr = addr;
+  p->size = size;
+  p->cam = h->cam;
+
+  scn *s = malloc(sizeof(*s));
+  *s = (scn){
+    .objs = (obj *)(base + h->secs[SEC_OBJS].ofs),
+    .obj_cnt = h->obj_cnt,
+    .obj_cap = h->obj_cnt,
+    .shape_buf = (float *)(base + h->secs[SEC_SHAPES].ofs),
+    .shape_buf_size = h->secs[SEC_SHAPES].size,
+    .shape_buf_cap = h->secs[SEC_SHAPES].size,
+    .mat_buf = (float *)(base + h->secs[SEC_MATS].ofs),
+    .mat_buf_size = h->secs[SEC_MATS].size,
+    .mat_buf_cap = h->secs[SEC_MATS].size };
+  p->scn = s;
+
+  bvh *b = malloc(sizeof(*b));
+  *b = (bvh){
+    .node_cnt = h->node_cnt,
+    .node_cap = h->node_cnt,
+    .nodes = (bvh_node *)(base + h->secs[SEC_NODES].ofs),
+    .indices = (uint32_t *)(base + h->secs[SEC_INDICES].ofs),
+    .obj_cnt = h->bvh_obj_cnt,
+    .idx_cnt = h->idx_cnt,
+    .huge_cnt = h->huge_cnt,
+    .idx_cap = h->idx_cnt + h->huge_cnt,
+    .opts = h->opts,
+    .depth = h->depth,
+    .leaf_order = h->leaf_order };
+  p->bvh = b;
+
+  return p;
+}
+
+void pack_release(pack *p)
+{
+  free(p->bvh);
+  free(p->scn);
+  sys_unmap_file(p->addr, p->size);
+  free(p);
+}
@@ -0,0 +1,38 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "cam.h"
+
+// Binary container of a scene with its bvh and camera, native build only.
+// Sections hold the objects, shape buffer, material buffer, bvh nodes (incl.
+// the huge objects leaf) and indices as they are in memory. Each starts at a
+// multiple of PACK_ALIGN, i.e. can be uploaded as a GPU buffer as is. The
+// layout is the one of the writing machine, the header records the version
+// and struct sizes to reject others.
+
+#define PACK_VERSION  1
+#define PACK_ALIGN    256 // WebGPU minStorageBufferOffsetAlignment
+
+typedef struct scn scn;
+typedef struct bvh bvh;
+
+typedef struct pack {
+  scn     *scn;
+  bvh     *bvh;
+  cam     cam;
+  void    *addr; // Mapping of the file
+  size_t  size;
+} pack;
+
+bool  pack_write(const char *path, const scn *s, const bvh *b, const cam *c);
+
+// Maps the file and points scn and bvh at its sections without copying.
+// Both are read-only, i.e. not for builds, refits or reordering, and are
+// released by pack_release only. Processes loading the same file share its
+// pages. NULL if the file is missing or does not match.
+pack  *pack_load(const char *path);
+void  pack_release(pack *p);
+
+#endif
@@ -0,0 +1,132 @@
+#include "pool.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "sys.h"
+
+#define DEQUE_INIT_CAP 64
+
+typedef struct task {
+  pool_fn fn;
+  void    *ctx;
+  size_t  arg;
+} task;
+
+// Ring buffer, top is the steal end, bottom the owner end
+typedef struct deque {
+  pthread_mutex_t mtx;
+  task            *tasks;
+  size_t          cap;
+  size_t          top;
+  size_t          cnt;
+} deque;
+
+struct pool {
+  uint32_t      thread_cnt;
+  deque         *deques;
+  atomic_size_t pending; // Pushed but not yet finished tasks
+};
+
+pool *pool_init(uint32_t thread_cnt)
+{
+  pool *p = malloc(sizeof(*p));
+  p->thread_cnt = thread_cnt > 0 ? thread_cnt : 1;
+  p->deques = malloc(p->thread_cnt * sizeof(*p->deques));
+  for(uint32_t i=0; i<p->thread_cnt; i++) {
+    deque *d = &p->deques[i];
+    pthread_mutex_init(&d->mtx, NULL);
+    d->tasks = malloc(DEQUE_INIT_CAP * sizeof(*d->tasks));
+    d->cap = DEQUE_INIT_CAP;
+    d->top = 0;
+    d->cnt = 0;
+  }
+  atomic_init(&p->pending, 0);
+
+  return p;
+}
+
+void pool_release(pool *p)
+{
+  for(uint32_t i=0; i<p->thread_cnt; i++) {
+    pthread_mutex_destroy(&p->deques[i].mtx);
+    free(p->deques[i].tasks);
+  }
+  free(p->deques);
+  free(p);
+}
+
+void pool_push(pool *p, uint32_t worker_idx, pool_fn fn, void *ctx, size_t arg)
+{
+  deque *d = &p->deques[worker_idx];
+  atomic_fetch_add(&p->pending, 1);
+
+  pthread_mutex_lock(&d->mtx);
+  if(d->cnt == d->cap) {
+    // Grow and unwrap the ring
+    task *tasks = malloc(2 * d->cap * sizeof(*tasks));
+    for(size_t i=0; i<d->cnt; i++)
+      tasks[i] = d->tasks[(d->top + i) % d->cap];
+    free(d->tasks);
+    d->tasks = tasks;
+    d->cap *= 2;
+    d->top = 0;
+  }
+  d->tasks[(d->top + d->cnt++) % d->cap] = (task){ fn, ctx, arg };
+  pthread_mutex_unlock(&d->mtx);
+}
+
+static bool pop(deque *d, task *t)
+{
+  bool found = false;
+  pthread_mutex_lock(&d->mtx);
+  if(d->cnt > 0) {
+    *t = d->tasks[(d->top + --d->cnt) % d->cap];
+    found = true;
+  }
+  pthread_mutex_unlock(&d->mtx);
+  return found;
+}
+
+static bool steal(deque *d, task *t)
+{
+  bool found = false;
+  if(pthread_mutex_trylock(&d->mtx) != 0)
+    return false;
+  if(d->cnt > 0) {
+    *t = d->tasks[d->top];
+    d->top = (d->top + 1) % d->cap;
+    d->cnt--;
+    found = true;
+  }
+  pthread_mutex_unlock(&d->mtx);
+  return found;
+}
+
+static void worker(void *ctx, uint32_t worker_idx)
+{
+  pool *p = ctx;
+  uint32_t victim = worker_idx;
+  while(atomic_load(&p->pending) > 0) {
+    task t;
+    bool found = pop(&p->deques[worker_idx], &t);
+    for(uint32_t i=1; !found && i<p->thread_cnt; i++) {
+      victim = (victim + 1) % p->thread_cnt;
+      if(victim != worker_idx)
+        found = steal(&p->deques[victim], &t);
+    }
+
+    if(found) {
+      t.fn(t.ctx, t.arg, worker_idx);
+      atomic_fetch_sub(&p->pending, 1);
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+void pool_run(pool *p)
+{
+  sys_run_threads(p->thread_cnt, worker, p);
+}
@@ -0,0 +1,24 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Work-stealing task pool of the native build. Every worker owns a deque.
+// It pushes and pops tasks at the bottom and steals from the top of the
+// deques of other workers when its own one runs empty.
+
+typedef struct pool pool;
+
+typedef void (*pool_fn)(void *ctx, size_t arg, uint32_t worker_idx);
+
+pool  *pool_init(uint32_t thread_cnt);
+void  pool_release(pool *p);
+
+// Can be called before pool_run or by a running task with its worker_idx
+void  pool_push(pool *p, uint32_t worker_idx, pool_fn fn, void *ctx, size_t arg);
+
+// Runs until all pushed tasks (including the ones they push) are done
+void  pool_run(pool *p);
+
+#endif
@@ -0,0 +1,34 @@
+#include "ray.h"
+#include "mutil.h"
+
+void ray_create(ray *r, vec3 ori, vec3 dir, float tmin, float tmax)
+{
+  r->ori = ori;
+  r->dir = dir;
+  r->inv_dir = (vec3){ 1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z };
+  r->tmin = tmin;
+  r->t = tmax;
+}
+
+vec3 ray_at(const ray *r, float t)
+{
+  return vec3_add(r->ori, vec3_scale(r->dir, t));
+}
+
+float ray_intersect_aabb(const ray *r, vec3 min_ext, vec3 max_ext)
+{
+  return ray_intersect_aabb4(r, vec4_load(&r->ori.x), vec4_load(&r->inv_dir.x),
+      vec4_from_vec3(min_ext), vec4_from_vec3(max_ext));
+}
+
+float ray_intersect_aabb4(const ray *r, vec4 ori, vec4 inv_dir,
+    vec4 min_ext, vec4 max_ext)
+{
+  vec4 t0 = vec4_mul(vec4_sub(min_ext, ori), inv_dir);
+  vec4 t1 = vec4_mul(vec4_sub(max_ext, ori), inv_dir);
+
+  float tmin = vec4_max3(vec4_min(t0, t1));
+  float tmax = vec4_min3(vec4_max(t0, t1));
+
+  return (tmin <= tmax && tmin < r->t && tmax > r->tmin) ? tmin : MAX_DISTANCE;
+}
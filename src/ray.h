@@ -0,0 +1,36 @@
+#ifndef RAY_H
+#define RAY_H
+
+#include <stdint.h>
+#include "vec3.h"
+#include "vec4.h"
+
+#define RAY_EPSILON   0.001f
+#define MAX_DISTANCE  3.402823466e+38f
+
+typedef struct ray {
+  vec3  ori;
+  vec3  dir;
+  vec3  inv_dir;
+  float tmin;
+  float t;
+} ray;
+
+typedef struct hit {
+  vec3      pos;
+  vec3      nrm;
+  uint32_t  mat_type;
+  uint32_t  mat_ofs;
+} hit;
+
+void  ray_create(ray *r, vec3 ori, vec3 dir, float tmin, float tmax);
+vec3  ray_at(const ray *r, float t);
+float ray_intersect_aabb(const ray *r, vec3 min_ext, vec3 max_ext);
+
+// Same test with the bounds in the xyz lanes. Takes the ray origin and
+// inverse direction as vec4_load(&r->ori.x) and vec4_load(&r->inv_dir.x),
+// so traversal loops can keep them in registers.
+float ray_intersect_aabb4(const ray *r, vec4 ori, vec4 inv_dir,
+        vec4 min_ext, vec4 max_ext);
+
+#endif
@@ -0,0 +1,235 @@
+#include "rend.h"
+#include <stdbool.h>
+#include "mutil.h"
+#include "scn.h"
+#include "obj.h"
+#include "mat.h"
+#include "bvh.h"
+#include "wbvh.h"
+#include "cbvh.h"
+#include "tlas.h"
+#include "cam.h"
+#include "view.h"
+#include "ray.h"
+#include "smpl.h"
+
+// CPU port of computeMain/render/intersectScene/evalMaterial in visual.wgsl
+
+// Random numbers of one path. PCG draws them in order like computeMain,
+// the sampler by dimension (see smpl.h).
+typedef struct path_rng {
+  uint32_t  pcg; // State
+  uint32_t  seed; // Scramble seed of the pixel
+  uint32_t  idx; // Sample index within the pixel
+  bool      sobol;
+} path_rng;
+
+// PCG from https://jcgt.org/published/0009/03/02/
+static float rand_pcg(uint32_t *state)
+{
+  *state = *state * 747796405u + 2891336453u;
+  uint32_t word = ((*state >> ((*state >> 28u) + 4u)) ^ *state) * 277803737u;
+  return ((word >> 22u) ^ word) / (float)0xffffffffu;
+}
+
+static void rand2(path_rng *p, uint32_t dim, float *x, float *y)
+{
+  if(p->sobol) {
+    smpl_get2(p->seed, p->idx, dim, x, y);
+  } else {
+    *x = rand_pcg(&p->pcg);
+    *y = rand_pcg(&p->pcg);
+  }
+}
+
+static float rand1(path_rng *p, uint32_t dim)
+{
+  return p->sobol ? smpl_get1(p->seed, p->idx, dim) : rand_pcg(&p->pcg);
+}
+
+// https://mathworld.wolfram.com/SpherePointPicking.html
+static vec3 rand3_unit_sphere(path_rng *p, uint32_t dim)
+{
+  float u, v;
+  rand2(p, dim, &u, &v);
+  u = 2.0f * u - 1.0f;
+  float theta = TWO_PI * v;
+  float r = sqrtf(1.0f - u * u);
+  return (vec3){ r * cosf(theta), r * sinf(theta), u };
+}
+
+// https://mathworld.wolfram.com/DiskPointPicking.html
+static void rand2_disk(path_rng *p, uint32_t dim, float *x, float *y)
+{
+  float u, v;
+  rand2(p, dim, &u, &v);
+  float r = sqrtf(u);
+  float theta = TWO_PI * v;
+  *x = r * cosf(theta);
+  *y = r * sinf(theta);
+}
+
+static vec3 reflect(vec3 i, vec3 n)
+{
+  return vec3_sub(i, vec3_scale(n, 2.0f * vec3_dot(n, i)));
+}
+
+// Returns zero vector in case of total internal reflection (like WGSL)
+static vec3 refract(vec3 i, vec3 n, float eta)
+{
+  float d = vec3_dot(n, i);
+  float k = 1.0f - eta * eta * (1.0f - d * d);
+  if(k < 0.0f)
+    return (vec3){ 0.0f, 0.0f, 0.0f };
+  return vec3_sub(vec3_scale(i, eta), vec3_scale(n, eta * d + sqrtf(k)));
+}
+
+static float schlick_reflectance(float cos_theta, float refr_idx_ratio)
+{
+  float r0 = (1.0f - refr_idx_ratio) / (1.0f + refr_idx_ratio);
+  r0 = r0 * r0;
+  return r0 + (1.0f - r0) * powf(1.0f - cos_theta, 5.0f);
+}
+
+static bool eval_mat(const scn *s, const ray *in, const hit *h, path_rng *rng,
+    uint32_t bounce, vec3 *att, vec3 *emit, vec3 *dir)
+{
+  uint32_t dim = SMPL_DIM_BSDF + 2 * bounce;
+  // All material types start with albedo, followed by an optional float
+  const float *data = scn_get_mat(s, h->mat_ofs);
+  vec3 albedo = { data[0], data[1], data[2] };
+  bool inside = vec3_dot(in->dir, h->nrm) > 0.0f;
+  vec3 nrm = inside ? vec3_neg(h->nrm) : h->nrm;
+
+  switch(h->mat_type) {
+    case LAMBERT: {
+      vec3 d = vec3_add(nrm, rand3_unit_sphere(rng, dim));
+      bool degen = fabsf(d.x) < RAY_EPSILON && fabsf(d.y) < RAY_EPSILON &&
+        fabsf(d.z) < RAY_EPSILON;
+      *dir = degen ? nrm : vec3_unit(d);
+      *att = albedo;
+      return true;
+    }
+    case METAL: {
+      vec3 d = reflect(in->dir, nrm);
+      *dir = vec3_unit(vec3_add(d, vec3_scale(rand3_unit_sphere(rng, dim), data[3])));
+      *att = albedo;
+      return vec3_dot(*dir, nrm) > 0.0f;
+    }
+    case GLASS: {
+      float ratio = inside ? data[3] : 1.0f / data[3];
+      float cos_theta = min(vec3_dot(vec3_neg(in->dir), nrm), 1.0f);
+      vec3 d = refract(in->dir, nrm, ratio);
+      if((d.x == 0.0f && d.y == 0.0f && d.z == 0.0f) ||
+          schlick_reflectance(cos_theta, ratio) > rand1(rng, dim + 1))
+        d = reflect(in->dir, nrm);
+      *dir = d;
+      *att = albedo;
+      return true;
+    }
+    case ISOTROPIC:
+      *dir = rand3_unit_sphere(rng, dim);
+      *att = albedo;
+      return true;
+    case EMITTER:
+      *emit = albedo;
+      return false;
+    default:
+      // Error material
+      *emit = (vec3){ 99999.0f, 0.0f, 0.0f };
+      return false;
+  }
+}
+
+// Sets the scene holding the material of the hit
+static bool intersect_scn(const rend *r, ray *ry, hit *h, const scn **mat_scn)
+{
+  if(r->tlas)
+    return tlas_intersect(r->tlas, ry, h, mat_scn);
+
+  *mat_scn = r->scn;
+  uint32_t obj_idx;
+  if(r->lazy)
+    bvh_lazy_intersect(r->lazy, r->scn, ry, &obj_idx);
+  else if(r->cbvh)
+    cbvh_intersect(r->cbvh, r->scn, ry, &obj_idx);
+  else if(r->wbvh)
+    wbvh_intersect(r->wbvh, r->scn, ry, &obj_idx);
+  else
+    bvh_intersect(r->bvh, r->scn, ry, &obj_idx);
+  if(ry->t < MAX_DISTANCE)
+    return scn_complete_hit(r->scn, obj_idx, ry, h);
+
+  return false;
+}
+
+static vec3 render(const rend *r, ray *ry, path_rng *rng)
+{
+  vec3 col = { 1.0f, 1.0f, 1.0f };
+  for(uint32_t bounce=0; bounce<r->cfg.bounces; bounce++) {
+    hit h;
+    const scn *mat_scn;
+    if(!intersect_scn(r, ry, &h, &mat_scn))
+      return vec3_mul(col, r->bg_col);
+
+    vec3 att, emit, dir;
+    if(!eval_mat(mat_scn, ry, &h, rng, bounce, &att, &emit, &dir))
+      return vec3_mul(col, emit);
+
+    col = vec3_mul(col, att);
+    ray_create(ry, h.pos, dir, RAY_EPSILON, MAX_DISTANCE);
+  }
+
+  return col;
+}
+
+static void create_primary_ray(const rend *r, ray *ry, float x, float y,
+    path_rng *rng)
+{
+  const view *v = r->view;
+  const cam *c = r->cam;
+
+  float jx, jy;
+  rand2(rng, SMPL_DIM_PIX, &jx, &jy);
+  jx -= 0.5f;
+  jy -= 0.5f;
+  vec3 pix_smpl = vec3_add(v->pix_top_left, vec3_add(
+        vec3_scale(v->pix_delta_x, x + jx), vec3_scale(v->pix_delta_y, y + jy)));
+
+  vec3 eye_smpl = c->eye;
+  if(c->foc_angle > 0.0f) {
+    float foc_radius = c->foc_dist * tanf(0.5f * c->foc_angle * PI / 180.0f);
+    float dx, dy;
+    rand2_disk(rng, SMPL_DIM_LENS, &dx, &dy);
+    eye_smpl = vec3_add(eye_smpl, vec3_scale(vec3_add(
+            vec3_scale(c->right, dx), vec3_scale(c->up, dy)), foc_radius));
+  }
+
+  ray_create(ry, eye_smpl, vec3_unit(vec3_sub(pix_smpl, eye_smpl)),
+      RAY_EPSILON, MAX_DISTANCE);
+}
+
+void rend_tile(const rend *r, uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+    uint32_t seed, uint32_t smpl_idx)
+{
+  uint32_t x_end = min(x + w, r->cfg.width);
+  uint32_t y_end = min(y + h, r->cfg.height);
+
+  for(uint32_t j=y; j<y_end; j++) {
+    for(uint32_t i=x; i<x_end; i++) {
+      uint32_t idx = r->cfg.width * j + i;
+      path_rng rng = { .pcg = idx ^ seed, .seed = smpl_seed(idx),
+        .sobol = r->sobol };
+
+      vec3 col = { 0.0f, 0.0f, 0.0f };
+      for(uint32_t k=0; k<r->cfg.spp; k++) {
+        ray ry;
+        rng.idx = smpl_idx + k;
+        create_primary_ray(r, &ry, (float)i, (float)j, &rng);
+        col = vec3_add(col, render(r, &ry, &rng));
+      }
+
+      r->acc[idx] = vec3_add(r->acc[idx], col);
+    }
+  }
+}
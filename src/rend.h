@@ -0,0 +1,39 @@
+#ifndef REND_H
+#define REND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "vec3.h"
+#include "cfg.h"
+
+typedef struct scn scn;
+typedef struct bvh bvh;
+typedef struct bvh_lazy bvh_lazy;
+typedef struct wbvh wbvh;
+typedef struct cbvh cbvh;
+typedef struct tlas tlas;
+typedef struct cam cam;
+typedef struct view view;
+
+typedef struct rend {
+  cfg         cfg;
+  const scn   *scn;
+  const bvh   *bvh;
+  const wbvh  *wbvh; // Traversed instead of bvh if set
+  const cbvh  *cbvh; // Traversed instead of bvh if set
+  bvh_lazy    *lazy; // Traversed instead of bvh if set, builds on demand
+  const tlas  *tlas; // Traced instead of scn if set
+  const cam   *cam;
+  const view  *view;
+  vec3        bg_col;
+  bool        sobol; // Scrambled Sobol samples (smpl.h) instead of PCG
+  vec3        *acc; // Sum of all samples per pixel
+} rend;
+
+// Renders cfg.spp samples for each pixel of the given tile and adds them to
+// acc. PCG streams start from seed, sampler indices from smpl_idx, i.e. the
+// sample count of the previous passes.
+void rend_tile(const rend *r, uint32_t x, uint32_t y, uint32_t w, uint32_t h,
+    uint32_t seed, uint32_t smpl_idx);
+
+#endif
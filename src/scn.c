@@ -3,8 +3,12 @@
 #include "obj.h"
 #include "shape.h"
 #include "mat.h"
+#include "ray.h"
+#include "log.h"
 
 #define BUF_LINE_SIZE 4
+#define NO_OFS        0xffffffff
+#define BUF_MIN_CAP   256 // Bytes of the first allocation of a growing buffer
 
 size_t scn_calc_shape_buf_size(size_t sphere_cnt, size_t quad_cnt)
 {
@@ -24,12 +28,17 @@ scn *scn_init(size_t obj_cnt, size_t shape_buf_size, size_t mat_buf_size)
 
   s->objs = malloc(obj_cnt * sizeof(*s->objs));
   s->obj_cnt = 0;
+  s->obj_cap = obj_cnt;
   
   s->shape_buf = malloc(shape_buf_size);
   s->shape_buf_size = 0;
+  s->shape_buf_cap = shape_buf_size;
   
   s->mat_buf = malloc(mat_buf_size);
   s->mat_buf_size = 0;
+  s->mat_buf_cap = mat_buf_size;
+
+  s->grow_cnt = 0;
   
   return s;
 }
@@ -42,14 +51,44 @@ void scn_release(scn *s)
   free(s);
 }
 
+// Returns buf with room for at least need bytes. Doubles the capacity so
+// that adding n items moves O(n) bytes in total.
+void *reserve_buf(scn *s, void *buf, size_t size, size_t *cap, size_t need)
+{
+  if(need <= *cap)
+    return buf;
+
+  size_t new_cap = *cap > BUF_MIN_CAP ? *cap : BUF_MIN_CAP;
+  while(new_cap < need)
+    new_cap *= 2;
+
+  void *new_buf = malloc(new_cap);
+  memcpy(new_buf, buf, size);
+  free(buf);
+
+  *cap = new_cap;
+  s->grow_cnt++;
+  return new_buf;
+}
+
 size_t scn_add_obj(scn *s, const obj *obj)
 {
+  if(s->obj_cnt == s->obj_cap) {
+    size_t cap = s->obj_cap * sizeof(*s->objs);
+    s->objs = reserve_buf(s, s->objs, s->obj_cnt * sizeof(*s->objs), &cap,
+        (s->obj_cnt + 1) * sizeof(*s->objs));
+    s->obj_cap = cap / sizeof(*s->objs);
+  }
+
   memcpy(s->objs + s->obj_cnt, obj, sizeof(*obj));
   return s->obj_cnt++;
 }
 
 size_t scn_add_shape(scn *s, const void *shape, size_t size)
 {
+  s->shape_buf = reserve_buf(s, s->shape_buf, s->shape_buf_size,
+      &s->shape_buf_cap, s->shape_buf_size + size);
+
   size_t ofs = s->shape_buf_size / (BUF_LINE_SIZE * sizeof(*s->shape_buf));
   memcpy(s->shape_buf + s->shape_buf_size / sizeof(*s->shape_buf), shape, size);
   s->shape_buf_size += size;
@@ -58,12 +97,143 @@ size_t scn_add_shape(scn *s, const void *shape, size_t size)
 
 size_t scn_add_mat(scn *s, const void *mat, size_t size)
 {
+  s->mat_buf = reserve_buf(s, s->mat_buf, s->mat_buf_size, &s->mat_buf_cap,
+      s->mat_buf_size + size);
+
   size_t ofs = s->mat_buf_size / (BUF_LINE_SIZE * sizeof(*s->mat_buf));
   memcpy(s->mat_buf + s->mat_buf_size / sizeof(*s->mat_buf), mat, size);
   s->mat_buf_size += size;
   return ofs;
 }
 
+size_t get_shape_size(shape_type type)
+{
+  switch(type) {
+    case SPHERE:
+      return sizeof(sphere);
+    case QUAD:
+      return sizeof(quad);
+    case QUAD_BAKED:
+      return sizeof(quad_baked);
+    default:
+      // Unsupported shapes are treated as one line of data
+      return BUF_LINE_SIZE * sizeof(float);
+  }
+}
+
+// Copies the data at ofs to dst unless already copied. Returns new offset.
+uint32_t copy_line_data(float *dst, size_t *dst_size, const float *src,
+    uint32_t *ofs_map, uint32_t ofs, size_t size)
+{
+  if(ofs_map[ofs] == NO_OFS) {
+    memcpy(dst + *dst_size / sizeof(*dst), src + ofs * BUF_LINE_SIZE, size);
+    ofs_map[ofs] = *dst_size / (BUF_LINE_SIZE * sizeof(*dst));
+    *dst_size += size;
+  }
+  return ofs_map[ofs];
+}
+
+void scn_reorder(scn *s, const uint32_t *order, size_t cnt)
+{
+  size_t line_size = BUF_LINE_SIZE * sizeof(float);
+  obj *objs = malloc(cnt * sizeof(*objs));
+  float *shape_buf = malloc(s->shape_buf_size);
+  float *mat_buf = malloc(s->mat_buf_size);
+
+  // New offsets per old offset, shared shapes and materials stay shared
+  size_t shape_lines = s->shape_buf_size / line_size;
+  size_t mat_lines = s->mat_buf_size / line_size;
+  uint32_t *shape_map = malloc((shape_lines + mat_lines) * sizeof(*shape_map));
+  uint32_t *mat_map = shape_map + shape_lines;
+  memset(shape_map, 0xff, (shape_lines + mat_lines) * sizeof(*shape_map));
+
+  size_t shape_size = 0;
+  size_t mat_size = 0;
+  for(size_t i=0; i<cnt; i++) {
+    obj o = s->objs[order[i]];
+    o.shape_ofs = copy_line_data(shape_buf, &shape_size, s->shape_buf,
+        shape_map, o.shape_ofs, get_shape_size(o.shape_type));
+    o.mat_ofs = copy_line_data(mat_buf, &mat_size, s->mat_buf,
+        mat_map, o.mat_ofs, line_size); // All materials are one line
+    objs[i] = o;
+  }
+
+  free(shape_map);
+  free(s->objs);
+  free(s->shape_buf);
+  free(s->mat_buf);
+
+  s->objs = objs;
+  s->obj_cnt = cnt;
+  s->obj_cap = cnt;
+  s->shape_buf = shape_buf;
+  s->shape_buf_cap = s->shape_buf_size;
+  s->shape_buf_size = shape_size;
+  s->mat_buf = mat_buf;
+  s->mat_buf_cap = s->mat_buf_size;
+  s->mat_buf_size = mat_size;
+}
+
+shape_type get_baked_type(shape_type type)
+{
+  switch(type) {
+    case QUAD:
+      return QUAD_BAKED;
+    default:
+      return type;
+  }
+}
+
+// Writes the baked record of a shape of the given type to dst. Returns the
+// record size.
+size_t bake_shape(float *dst, const float *src, shape_type type)
+{
+  switch(type) {
+    case QUAD:
+      *(quad_baked *)dst = quad_bake((const quad *)src);
+      break;
+    default:
+      // Already baked or nothing to bake
+      memcpy(dst, src, get_shape_size(type));
+  }
+  return get_shape_size(get_baked_type(type));
+}
+
+void scn_bake(scn *s)
+{
+  size_t line_size = BUF_LINE_SIZE * sizeof(float);
+
+  // New offsets per old offset, shared shapes stay shared
+  size_t lines = s->shape_buf_size / line_size;
+  uint32_t *shape_map = malloc(lines * sizeof(*shape_map));
+  memset(shape_map, 0xff, lines * sizeof(*shape_map));
+
+  // Baked quads are larger, the rest keep their size
+  size_t cap = s->shape_buf_size;
+  for(size_t i=0; i<s->obj_cnt; i++)
+    if(s->objs[i].shape_type == QUAD)
+      cap += sizeof(quad_baked) - sizeof(quad);
+  float *shape_buf = malloc(cap);
+  size_t shape_size = 0;
+  for(size_t i=0; i<s->obj_cnt; i++) {
+    obj *o = &s->objs[i];
+    if(shape_map[o->shape_ofs] == NO_OFS) {
+      shape_map[o->shape_ofs] = shape_size / line_size;
+      shape_size += bake_shape(shape_buf + shape_size / sizeof(*shape_buf),
+          s->shape_buf + o->shape_ofs * BUF_LINE_SIZE, o->shape_type);
+    }
+    o->shape_ofs = shape_map[o->shape_ofs];
+    o->shape_type = get_baked_type(o->shape_type);
+  }
+
+  free(shape_map);
+  free(s->shape_buf);
+
+  s->shape_buf = shape_buf;
+  s->shape_buf_cap = cap;
+  s->shape_buf_size = shape_size;
+}
+
 obj *scn_get_obj(const scn *s, size_t idx)
 {
   return s->objs + idx;
@@ -78,3 +248,109 @@ void *scn_get_mat(const scn *s, size_t ofs)
 {
   return s->mat_buf + ofs * BUF_LINE_SIZE;
 }
+
+scn_stats scn_calc_stats(const scn *s)
+{
+  return (scn_stats){
+    .obj_cnt = s->obj_cnt,
+    .obj_bytes = s->obj_cnt * sizeof(*s->objs),
+    .obj_cap = s->obj_cap * sizeof(*s->objs),
+    .shape_bytes = s->shape_buf_size,
+    .shape_cap = s->shape_buf_cap,
+    .mat_bytes = s->mat_buf_size,
+    .mat_cap = s->mat_buf_cap,
+    .grow_cnt = s->grow_cnt };
+}
+
+void scn_log_stats(const scn_stats *st)
+{
+  log("scn: %zu objs, objs %zu of %zu bytes, shapes %zu of %zu bytes, mats %zu of %zu bytes, %u reallocations",
+      st->obj_cnt, st->obj_bytes, st->obj_cap, st->shape_bytes, st->shape_cap,
+      st->mat_bytes, st->mat_cap, st->grow_cnt);
+}
+
+float scn_intersect_obj(const scn *s, uint32_t obj_idx, const ray *r)
+{
+  obj *o = scn_get_obj(s, obj_idx);
+  switch(o->shape_type) {
+    case SPHERE:
+      return sphere_intersect(scn_get_shape(s, o->shape_ofs), r);
+    case QUAD:
+      return quad_intersect(scn_get_shape(s, o->shape_ofs), r);
+    case QUAD_BAKED:
+      return quad_baked_intersect(scn_get_shape(s, o->shape_ofs), r);
+    default:
+      return r->t;
+  }
+}
+
+void scn_intersect_objs(const scn *s, const uint32_t *indices,
+    uint32_t start, uint32_t cnt, uint32_t shape_type, ray *r,
+    uint32_t *obj_idx)
+{
+  // Loop per shape type, no switch per object
+  switch(shape_type) {
+    case SPHERE:
+      for(uint32_t i=start; i<start + cnt; i++) {
+        uint32_t idx = indices ? indices[i] : i;
+        float t = sphere_intersect(scn_get_shape(s, s->objs[idx].shape_ofs), r);
+        if(t < r->t) {
+          r->t = t;
+          *obj_idx = idx;
+        }
+      }
+      break;
+    case QUAD:
+      for(uint32_t i=start; i<start + cnt; i++) {
+        uint32_t idx = indices ? indices[i] : i;
+        float t = quad_intersect(scn_get_shape(s, s->objs[idx].shape_ofs), r);
+        if(t < r->t) {
+          r->t = t;
+          *obj_idx = idx;
+        }
+      }
+      break;
+    case QUAD_BAKED:
+      for(uint32_t i=start; i<start + cnt; i++) {
+        uint32_t idx = indices ? indices[i] : i;
+        float t = quad_baked_intersect(
+            scn_get_shape(s, s->objs[idx].shape_ofs), r);
+        if(t < r->t) {
+          r->t = t;
+          *obj_idx = idx;
+        }
+      }
+      break;
+    default:
+      for(uint32_t i=start; i<start + cnt; i++) {
+        uint32_t idx = indices ? indices[i] : i;
+        float t = scn_intersect_obj(s, idx, r);
+        if(t < r->t) {
+          r->t = t;
+          *obj_idx = idx;
+        }
+      }
+  }
+}
+
+bool scn_complete_hit(const scn *s, uint32_t obj_idx, const ray *r, hit *h)
+{
+  obj *o = scn_get_obj(s, obj_idx);
+  h->pos = ray_at(r, r->t);
+  switch(o->shape_type) {
+    case SPHERE:
+      h->nrm = sphere_get_nrm(scn_get_shape(s, o->shape_ofs), h->pos);
+      break;
+    case QUAD:
+      h->nrm = quad_get_nrm(scn_get_shape(s, o->shape_ofs));
+      break;
+    case QUAD_BAKED:
+      h->nrm = quad_baked_get_nrm(scn_get_shape(s, o->shape_ofs));
+      break;
+    default:
+      return false;
+  }
+  h->mat_type = o->mat_type;
+  h->mat_ofs = o->mat_ofs;
+  return true;
+}
@@ -1,25 +1,49 @@
 #ifndef SCN_H
 #define SCN_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 typedef struct obj obj;
 typedef struct shape shape;
 typedef struct mat mat;
+typedef struct ray ray;
+typedef struct hit hit;
 
+// Objects, shapes and materials grow geometrically as they are added.
+// Shapes and materials are addressed by offsets in lines of BUF_LINE_SIZE
+// floats, which stay valid when the buffers grow.
 typedef struct scn {
   obj       *objs;
   size_t    obj_cnt;
+  size_t    obj_cap;
   float     *shape_buf;
   size_t    shape_buf_size;
+  size_t    shape_buf_cap;  // Bytes
   float     *mat_buf;
   size_t    mat_buf_size;
+  size_t    mat_buf_cap;    // Bytes
+  uint32_t  grow_cnt;       // Reallocations of any of the buffers
 } scn;
 
+// Capacity and usage of the scene buffers in bytes
+typedef struct scn_stats {
+  size_t    obj_cnt;
+  size_t    obj_bytes;
+  size_t    obj_cap;
+  size_t    shape_bytes;
+  size_t    shape_cap;
+  size_t    mat_bytes;
+  size_t    mat_cap;
+  uint32_t  grow_cnt;
+} scn_stats;
+
+// Exact buffer sizes for the given counts, e.g. as capacity for scn_init
 size_t    scn_calc_shape_buf_size(size_t sphere_cnt, size_t quad_cnt);
 size_t    scn_calc_mat_buf_size(size_t basic_cnt, size_t metal_cnt, size_t glass_cnt);
 
+// Initial capacities, 0 is fine if the counts are not known up front
 scn       *scn_init(size_t obj_cnt, size_t shape_buf_size, size_t mat_buf_size);
 void      scn_release(scn *s);
 
@@ -27,8 +51,33 @@ size_t    scn_add_obj(scn *s, const obj *o);
 size_t    scn_add_shape(scn *s, const void *shape, size_t size);
 size_t    scn_add_mat(scn *s, const void *mat, size_t size);
 
+// Rebuilds the objects so that new object i is old object order[i]. Order
+// may repeat objects (cnt > obj_cnt), repeated objects share their shape and
+// material. Shapes and materials are rewritten in order of first use.
+void      scn_reorder(scn *s, const uint32_t *order, size_t cnt);
+
+// Replaces quads by their baked records (shape.h), whose intersection test
+// skips the terms that depend on the quad only. Spheres stay, their only
+// such term is the squared radius, and the signed radius is needed for the
+// normal. Keeps the object order and shared shapes shared, i.e. a bvh
+// stays valid.
+void      scn_bake(scn *s);
+
 obj       *scn_get_obj(const scn *s, size_t idx);
 void      *scn_get_shape(const scn *s, size_t ofs);
 void      *scn_get_mat(const scn *s, size_t ofs);
 
+scn_stats scn_calc_stats(const scn *s);
+void      scn_log_stats(const scn_stats *st);
+
+float     scn_intersect_obj(const scn *s, uint32_t obj_idx, const ray *r);
+
+// Tests the objects at positions start to start + cnt - 1 of indices (or the
+// positions themselves if NULL), which are all of the given shape type or
+// of mixed type if 0. Shortens r and sets obj_idx on closer hits.
+void      scn_intersect_objs(const scn *s, const uint32_t *indices,
+            uint32_t start, uint32_t cnt, uint32_t shape_type, ray *r,
+            uint32_t *obj_idx);
+bool      scn_complete_hit(const scn *s, uint32_t obj_idx, const ray *r, hit *h);
+
 #endif
@@ -0,0 +1,273 @@
+#include "scns.h"
+#include "mutil.h"
+#include "scn.h"
+#include "obj.h"
+#include "shape.h"
+#include "mat.h"
+#include "cam.h"
+
+void add_box(scn *s, vec3 a, vec3 b, size_t mat_type, size_t mat_ofs)
+{
+  vec3 mi = { min(a.x, b.x), min(a.y, b.y), min(a.z, b.z) };
+  vec3 ma = { max(a.x, b.x), max(a.y, b.y), max(a.z, b.z) };
+
+  vec3 dx = { ma.x - mi.x, 0.0f, 0.0f };
+  vec3 dy = { 0.0f, ma.y - mi.y, 0.0f };
+  vec3 dz = { 0.0f, 0.0f, ma.z - mi.z };
+
+  scn_add_obj(s, &(obj){ QUAD,
+      scn_add_shape(s, &(quad){ .q = (vec3){ mi.x, mi.y, ma.z }, .u = dx, .v = dy }, sizeof(quad)),
+      mat_type, mat_ofs });
+  scn_add_obj(s, &(obj){ QUAD,
+      scn_add_shape(s, &(quad){ .q = (vec3){ ma.x, mi.y, ma.z }, .u = vec3_neg(dz), .v = dy }, sizeof(quad)),
+      mat_type, mat_ofs });
+  scn_add_obj(s, &(obj){ QUAD,
+      scn_add_shape(s, &(quad){ .q = (vec3){ ma.x, mi.y, mi.z }, .u = vec3_neg(dx), .v = dy }, sizeof(quad)),
+      mat_type, mat_ofs });
+  scn_add_obj(s, &(obj){ QUAD,
+      scn_add_shape(s, &(quad){ .q = (vec3){ mi.x, mi.y, mi.z }, .u = dz, .v = dy }, sizeof(quad)),
+      mat_type, mat_ofs });
+  scn_add_obj(s, &(obj){ QUAD,
+      scn_add_shape(s, &(quad){ .q = (vec3){ mi.x, ma.y, ma.z }, .u = dx, .v = vec3_neg(dz) }, sizeof(quad)),
+      mat_type, mat_ofs });
+  scn_add_obj(s, &(obj){ QUAD,
+      scn_add_shape(s, &(quad){ .q = (vec3){ mi.x, mi.y, mi.z }, .u = dx, .v = dz }, sizeof(quad)),
+      mat_type, mat_ofs });
+}
+
+scn *create_scn_spheres(cam *c)
+{
+  scn *s = scn_init(5, scn_calc_shape_buf_size(5, 0), scn_calc_mat_buf_size(2, 1, 1));
+
+  scn_add_obj(s, &(obj){ 
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ 0.0f, -100.5f, 0.0f }, 100.0f }, sizeof(sphere)),
+        LAMBERT, scn_add_mat(s,
+          &(basic){ .albedo = (vec3){ 0.5f, 0.5f, 0.5f } }, sizeof(basic)) });
+
+  scn_add_obj(s, &(obj){ 
+      SPHERE, scn_add_shape(s,
+        &(sphere){ (vec3){ -1.0f, 0.0f, 0.0f }, 0.5f }, sizeof(sphere)),
+      LAMBERT, scn_add_mat(s,
+        &(basic){ .albedo = (vec3){ 0.6f, 0.3f, 0.3f } }, sizeof(basic)) });
+
+  size_t glass_mat = scn_add_mat(s,
+      &(glass){ (vec3){ 1.0f, 1.0f, 1.0f }, 1.5f }, sizeof(glass));
+
+  scn_add_obj(s, &(obj){ SPHERE,
+      scn_add_shape(s,
+        &(sphere){ (vec3){ 0.0f, 0.0f, 0.0f }, 0.5f }, sizeof(sphere)),
+      GLASS, glass_mat });
+
+  scn_add_obj(s, &(obj){ 
+      SPHERE, scn_add_shape(s,
+        &(sphere){ (vec3){ 0.0f, 0.0f, 0.0f }, -0.45f }, sizeof(sphere)),
+      GLASS, glass_mat });
+
+  scn_add_obj(s, &(obj){ 
+      SPHERE, scn_add_shape(s,
+        &(sphere){ (vec3){ 1.0f, 0.0f, 0.0f }, 0.5f }, sizeof(sphere)),
+      METAL, scn_add_mat(s,
+        &(metal){ (vec3){ 0.3f, 0.3f, 0.6f }, 0.0f }, sizeof(metal)) });
+
+  *c = (cam){ .vert_fov = 60.0f, .foc_dist = 3.0f, .foc_angle = 0.0f };
+  cam_set(c, (vec3){ 0.0f, 0.0f, 2.0f }, (vec3){ 0.0f, 0.0f, 0.0f });
+
+  return s;
+}
+
+scn *create_scn_quads(cam *c)
+{
+  scn *s = scn_init(7, scn_calc_shape_buf_size(2, 5), scn_calc_mat_buf_size(6, 0, 1));
+
+  scn_add_obj(s, &(obj){ 
+        QUAD, scn_add_shape(s,
+          &(quad){
+            .q = (vec3){ -3.0f, -2.0f, 5.0f },
+            .u = (vec3){ 0.0f, 0.0f, -4.0f },
+            .v = (vec3){ 0.0f, 4.0f, 0.0f } }, sizeof(quad)),
+        LAMBERT, scn_add_mat(s,
+          &(basic){ .albedo = (vec3){ 1.0f, 0.2f, 0.2f } }, sizeof(basic)) });
+  
+  scn_add_obj(s, &(obj){ 
+        QUAD, scn_add_shape(s,
+          &(quad){
+            .q = (vec3){ -2.0f, -2.0f, 0.0f },
+            .u = (vec3){ 4.0f, 0.0f, 0.0f },
+            .v = (vec3){ 0.0f, 4.0f, 0.0f } }, sizeof(quad)),
+        LAMBERT, scn_add_mat(s,
+          &(basic){ .albedo = (vec3){ 0.2f, 1.0f, 0.2f } }, sizeof(basic)) });
+  
+  scn_add_obj(s, &(obj){ 
+        QUAD, scn_add_shape(s,
+          &(quad){
+            .q = (vec3){ 3.0f, -2.0f, 1.0f },
+            .u = (vec3){ 0.0f, 0.0f, 4.0f },
+            .v = (vec3){ 0.0f, 4.0f, 0.0f } }, sizeof(quad)),
+        LAMBERT, scn_add_mat(s,
+          &(basic){ .albedo = (vec3){ 0.2f, 0.2f, 1.0f } }, sizeof(basic)) });
+
+  scn_add_obj(s, &(obj){ 
+        QUAD, scn_add_shape(s,
+          &(quad){
+            .q = (vec3){ -2.0f, 3.0f, 1.0f }, 
+            .u = (vec3){ 4.0f, 0.0f, 0.0f }, 
+            .v = (vec3){ 0.0f, 0.0f, 4.0f } }, sizeof(quad)),
+        LAMBERT, scn_add_mat(s,
+          &(basic){ .albedo = (vec3){ 1.0f, 0.5f, 0.0f } }, sizeof(basic)) });
+  
+  scn_add_obj(s, &(obj){ 
+        QUAD, scn_add_shape(s,
+          &(quad){
+            .q = (vec3){ -2.0f, -3.0f, 5.0f },
+            .u = (vec3){ 4.0f, 0.0f, 0.0f },
+            .v = (vec3){ 0.0f, 0.0f, -4.0f } }, sizeof(quad)),
+        LAMBERT, scn_add_mat(s,
+          &(basic){ .albedo = (vec3){ 0.2f, 0.8f, 0.8f } }, sizeof(basic)) });
+
+  scn_add_obj(s, &(obj){ SPHERE,
+      scn_add_shape(s,
+        &(sphere){ (vec3){ 0.0f, 0.0f, 2.5f }, 1.5f }, sizeof(sphere)),
+      GLASS, scn_add_mat(s,
+        &(glass){ (vec3){ 1.0f, 1.0f, 1.0f }, 1.5f }, sizeof(glass)) });
+
+  scn_add_obj(s, &(obj){ 
+      SPHERE, scn_add_shape(s,
+        &(sphere){ (vec3){ 0.0f, 0.0f, 2.5f }, 1.0f }, sizeof(sphere)),
+      LAMBERT, scn_add_mat(s,
+        &(basic){ .albedo = (vec3){ 0.0f, 0.0f, 1.0f } }, sizeof(basic)) });
+
+  *c = (cam){ .vert_fov = 60.0f, .foc_dist = 3.0f, .foc_angle = 0.0f };
+  cam_set(c, (vec3){ 0.0f, 0.0f, 9.0f }, (vec3){ 0.0f, 0.0f, 0.0f });
+
+  return s;
+}
+
+scn *create_scn_emitter(cam *c)
+{
+  scn *s = scn_init(13, scn_calc_shape_buf_size(6, 7), scn_calc_mat_buf_size(4, 1, 1));
+
+  size_t lmat = scn_add_mat(s, &(basic){ .albedo = (vec3){ 0.5f, 0.5f, 0.5f } }, sizeof(basic));
+  scn_add_obj(s, &(obj){ 
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ 0.0f, -1000.0f, 0.0f }, 1000.0f }, sizeof(sphere)),
+        LAMBERT, lmat });
+ 
+  scn_add_obj(s, &(obj){
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ -5.0f, 3.0f, 3.0f }, 1.0f }, sizeof(sphere)),
+        LAMBERT, scn_add_mat(s, &(basic){ .albedo = (vec3){ 0.0f, 1.0f, 0.0f } }, sizeof(basic)) });
+ 
+  size_t mmat = scn_add_mat(s, &(metal){ (vec3){ 0.5f, 0.5f, 0.6f }, 0.0 }, sizeof(metal));
+  scn_add_obj(s, &(obj){
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ -5.0f, 4.0f, 0.0f }, 2.0f }, sizeof(sphere)),
+        METAL, mmat });
+ 
+  scn_add_obj(s, &(obj){
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ -5.0f, 3.0f, -3.0f }, 1.0f }, sizeof(sphere)),
+        LAMBERT, scn_add_mat(s, &(basic){ .albedo = (vec3){ 1.0f, 0.0f, 0.0f } }, sizeof(basic)) });
+  
+  size_t gmat = scn_add_mat(s, &(glass){ (vec3){ 1.0f, 1.0f, 1.0f }, 1.5f }, sizeof(glass));
+  scn_add_obj(s, &(obj){ 
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ 0.0f, 2.0f, 0.0f }, 2.0f }, sizeof(sphere)),
+        GLASS, gmat });
+
+  size_t emat = scn_add_mat(s, &(basic){ .albedo = (vec3){ 4.0f, 4.0f, 4.0f } }, sizeof(basic));
+  scn_add_obj(s, &(obj){ 
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ 0.0f, 7.0f, 0.0f }, 2.0f }, sizeof(sphere)),
+        EMITTER, emat });
+ 
+  scn_add_obj(s, &(obj){ 
+        QUAD, scn_add_shape(s, &(quad){ 
+          .q = (vec3){ 3.0f, 1.0f, -2.0f },
+          .u = (vec3){ 2.0f, 0.0f, 0.0f },
+          .v = (vec3){ 0.0f, 2.0f, 0.0f } }, sizeof(quad)),
+        EMITTER, emat });
+
+  add_box(s, (vec3){ -2.0f, 0.5f, 3.0f }, (vec3){ 2.0f, 2.5f, 3.5f }, METAL, mmat);
+  //add_box(s, (vec3){ -30.0f, -30.0f, -30.0f }, (vec3){ 30.0f, 30.5f, 30.0f }, METAL, mmat);
+
+  *c = (cam){ .vert_fov = 20.0f, .foc_dist = 3.0f, .foc_angle = 0.0f };
+  cam_set(c, (vec3){ 26.0f, 3.0f, 6.0f }, (vec3){ 0.0f, 2.0f, 0.0f });
+
+  return s;
+}
+
+scn *create_scn_riow_grid(cam *c, int32_t size)
+{
+  scn *s = scn_init(size * size + 4, scn_calc_shape_buf_size(size * size + 4, 0),
+      scn_calc_mat_buf_size(size * size + 4, 0, 0));
+
+  scn_add_obj(s, &(obj){ 
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ 0.0f, -1000.0f, 0.0f }, 1000.0f }, sizeof(sphere)),
+        LAMBERT, scn_add_mat(s,
+          &(basic){ .albedo = (vec3){ 0.5f, 0.5f, 0.5f } }, sizeof(basic)) });
+ 
+  scn_add_obj(s, &(obj){ 
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ 4.0f, 1.0f, 0.0f }, 1.0f }, sizeof(sphere)),
+        METAL, scn_add_mat(s,
+          &(metal){ (vec3){ 0.7f, 0.6f, 0.5f }, 0.0f }, sizeof(metal)) });
+
+  scn_add_obj(s, &(obj){ 
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ 0.0f, 1.0f, 0.0f }, 1.0f }, sizeof(sphere)),
+        GLASS, scn_add_mat(s,
+          &(glass){ (vec3){ 1.0f, 1.0f, 1.0f }, 1.5f }, sizeof(glass)) });
+  
+  scn_add_obj(s, &(obj){ 
+        SPHERE, scn_add_shape(s,
+          &(sphere){ (vec3){ -4.0f, 1.0f, 0.0f }, 1.0f }, sizeof(sphere)),
+        LAMBERT, scn_add_mat(s,
+          &(basic){ .albedo = (vec3){ 0.4f, 0.2f, 0.1f } }, sizeof(basic)) });
+  
+  // One random stream per grid cell, i.e. a cell does not depend on the
+  // others and could be generated on any thread
+  uint64_t seed = rand();
+  for(int a=-size/2; a<size/2; a++) {
+    for(int b=-size/2; b<size/2; b++) {
+      crand cr = crand_init(seed, (uint64_t)(a + size/2) * size + b + size/2);
+      float mat_p = crand_nextf(&cr);
+      float ofs_x = crand_nextf(&cr);
+      float ofs_z = crand_nextf(&cr);
+      vec3 center = { (float)a + 0.9f * ofs_x, 0.2f, (float)b + 0.9f * ofs_z };
+      if(vec3_len(vec3_add(center, (vec3){ -4.0f, -0.2f, 0.0f })) > 0.9f) {
+        size_t t, m;
+        if(mat_p < 0.8f) {
+          t = LAMBERT;
+          vec3 c0 = vec3_crand(&cr);
+          vec3 c1 = vec3_crand(&cr);
+          m = scn_add_mat(s,
+              &(basic){ .albedo = vec3_mul(c0, c1) }, sizeof(basic));
+        } else if(mat_p < 0.95f) {
+          t = METAL;
+          vec3 albedo = vec3_crand_rng(&cr, 0.5f, 1.0f);
+          m = scn_add_mat(s,
+              &(metal){ albedo, crand_nextf_rng(&cr, 0.0f, 0.5f) }, sizeof(metal));
+        } else {
+          t = GLASS;
+          m = scn_add_mat(s,
+              &(glass){ (vec3){ 1.0f, 1.0f, 1.0f }, 1.5f }, sizeof(glass));
+        }
+        scn_add_obj(s, &(obj){ 
+              SPHERE, scn_add_shape(s,
+                &(sphere){ center, 0.2f }, sizeof(sphere)), t, m });
+      }
+    }
+  }
+
+  *c = (cam){ .vert_fov = 20.0f, .foc_dist = 10.0f, .foc_angle = 0.6f };
+  cam_set(c, (vec3){ 13.0f, 2.0f, 3.0f }, (vec3){ 0.0f, 0.0f, 0.0f });
+
+  return s;
+}
+
+scn *create_scn_riow(cam *c)
+{
+  return create_scn_riow_grid(c, 22);
+}
@@ -0,0 +1,21 @@
+#ifndef SCNS_H
+#define SCNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vec3.h"
+
+typedef struct scn scn;
+typedef struct cam cam;
+
+void  add_box(scn *s, vec3 a, vec3 b, size_t mat_type, size_t mat_ofs);
+
+scn   *create_scn_spheres(cam *c);
+scn   *create_scn_quads(cam *c);
+scn   *create_scn_emitter(cam *c);
+scn   *create_scn_riow(cam *c);
+
+// Riow style scene with a grid of size x size small spheres
+scn   *create_scn_riow_grid(cam *c, int32_t size);
+
+#endif
@@ -1,4 +1,6 @@
 #include "shape.h"
+#include "mutil.h"
+#include "ray.h"
 
 aabb sphere_get_aabb(const sphere *s)
 {
@@ -22,3 +24,90 @@ vec3 quad_get_center(const quad *q)
   return vec3_add(
       vec3_add(q->q, vec3_scale(q->u, 0.5f)), vec3_scale(q->v, 0.5f));
 }
+
+float sphere_intersect(const sphere *s, const ray *r)
+{
+  vec3 oc = vec3_sub(r->ori, s->center);
+  float a = vec3_dot(r->dir, r->dir);
+  float b = vec3_dot(oc, r->dir); // Half
+  float c = vec3_dot(oc, oc) - s->radius * s->radius;
+
+  float d = b * b - a * c;
+  if(d < 0.0f)
+    return MAX_DISTANCE;
+
+  float sqrtd = sqrtf(d);
+  float t = (-b - sqrtd) / a;
+  if(t <= r->tmin || r->t <= t) {
+    t = (-b + sqrtd) / a;
+    if(t <= r->tmin || r->t <= t)
+      return MAX_DISTANCE;
+  }
+
+  return t;
+}
+
+vec3 sphere_get_nrm(const sphere *s, vec3 pos)
+{
+  return vec3_scale(vec3_sub(pos, s->center), 1.0f / s->radius);
+}
+
+float quad_intersect(const quad *q, const ray *r)
+{
+  vec3 n = vec3_cross(q->u, q->v);
+  vec3 nrm = vec3_unit(n);
+  float denom = vec3_dot(nrm, r->dir);
+  if(fabsf(denom) < RAY_EPSILON)
+    return MAX_DISTANCE;
+
+  float t = (vec3_dot(nrm, q->q) - vec3_dot(nrm, r->ori)) / denom;
+  if(t < r->tmin || t > r->t)
+    return MAX_DISTANCE;
+
+  vec3 w = vec3_scale(n, 1.0f / vec3_dot(n, n));
+  vec3 planar = vec3_sub(ray_at(r, t), q->q);
+  float a = vec3_dot(w, vec3_cross(planar, q->v));
+  float b = vec3_dot(w, vec3_cross(q->u, planar));
+
+  return (a < 0.0f || 1.0f < a || b < 0.0f || 1.0f < b) ? MAX_DISTANCE : t;
+}
+
+vec3 quad_get_nrm(const quad *q)
+{
+  return vec3_unit(vec3_cross(q->u, q->v));
+}
+
+quad_baked quad_bake(const quad *q)
+{
+  vec3 n = vec3_cross(q->u, q->v);
+  vec3 nrm = vec3_unit(n);
+  vec3 w = vec3_scale(n, 1.0f / vec3_dot(n, n));
+  // dot(w, cross(p, v)) = dot(p, cross(v, w)), likewise for u
+  vec3 wu = vec3_cross(q->v, w);
+  vec3 wv = vec3_cross(w, q->u);
+  return (quad_baked){
+    q->q, nrm.x, q->u, nrm.y, q->v, nrm.z, wu, vec3_dot(nrm, q->q), wv, 0.0f };
+}
+
+float quad_baked_intersect(const quad_baked *q, const ray *r)
+{
+  vec3 nrm = { q->nrm_x, q->nrm_y, q->nrm_z };
+  float denom = vec3_dot(nrm, r->dir);
+  if(fabsf(denom) < RAY_EPSILON)
+    return MAX_DISTANCE;
+
+  float t = (q->dist - vec3_dot(nrm, r->ori)) / denom;
+  if(t < r->tmin || t > r->t)
+    return MAX_DISTANCE;
+
+  vec3 planar = vec3_sub(ray_at(r, t), q->q);
+  float a = vec3_dot(planar, q->wu);
+  float b = vec3_dot(planar, q->wv);
+
+  return (a < 0.0f || 1.0f < a || b < 0.0f || 1.0f < b) ? MAX_DISTANCE : t;
+}
+
+vec3 quad_baked_get_nrm(const quad_baked *q)
+{
+  return (vec3){ q->nrm_x, q->nrm_y, q->nrm_z };
+}
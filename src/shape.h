@@ -4,6 +4,8 @@
 #include "vec3.h"
 #include "aabb.h"
 
+typedef struct ray ray;
+
 typedef struct sphere {
   vec3  center;
   float radius;
@@ -18,8 +20,35 @@ typedef struct quad {
   float pad2;
 } quad;
 
+// Record of scn_bake with the shape-only terms of the quad intersection
+// test precomputed. Starts like a quad, its normal takes the padding.
+// Points p on its plane are at q + a * u + b * v with a = dot(p - q, wu)
+// and b = dot(p - q, wv).
+typedef struct quad_baked {
+  vec3  q;
+  float nrm_x;
+  vec3  u;
+  float nrm_y;
+  vec3  v;
+  float nrm_z;
+  vec3  wu;
+  float dist; // Of the plane, dot(nrm, q)
+  vec3  wv;
+  float pad;
+} quad_baked;
+
 aabb sphere_get_aabb(const sphere *s);
 aabb quad_get_aabb(const quad *q);
 vec3 quad_get_center(const quad *q);
 
+float sphere_intersect(const sphere *s, const ray *r);
+vec3  sphere_get_nrm(const sphere *s, vec3 pos);
+float quad_intersect(const quad *q, const ray *r);
+vec3  quad_get_nrm(const quad *q);
+
+quad_baked quad_bake(const quad *q);
+
+float quad_baked_intersect(const quad_baked *q, const ray *r);
+vec3  quad_baked_get_nrm(const quad_baked *q);
+
 #endif
@@ -0,0 +1,83 @@
+#include "smpl.h"
+
+static uint32_t reverse_bits(uint32_t v)
+{
+  v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+  v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+  v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+  v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+  return (v >> 16) | (v << 16);
+}
+
+// https://nullprogram.com/blog/2018/07/31/ (lowbias32)
+static uint32_t hash(uint32_t v)
+{
+  v ^= v >> 16;
+  v *= 0x7feb352du;
+  v ^= v >> 15;
+  v *= 0x846ca68bu;
+  return v ^ (v >> 16);
+}
+
+static uint32_t hash_combine(uint32_t seed, uint32_t v)
+{
+  return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// Laine-Karras style permutation, each bit only depends on the bits below it
+static uint32_t lk_permute(uint32_t v, uint32_t seed)
+{
+  v += seed;
+  v ^= v * 0x6c50b47cu;
+  v ^= v * 0xb82f1e52u;
+  v ^= v * 0xc7afe638u;
+  v ^= v * 0x8d22f6e6u;
+  return v;
+}
+
+// Owen scramble of a binary fraction, i.e. the permutation on its reversed
+// bits
+static uint32_t owen_scramble(uint32_t v, uint32_t seed)
+{
+  return reverse_bits(lk_permute(reverse_bits(v), seed));
+}
+
+// Binary fractions of the first two Sobol dimensions are reverse_bits(idx)
+// and reverse_bits(pascal(idx)). pascal multiplies by the Pascal matrix mod
+// 2, i.e. maps the bits of a(z) to those of a(z + 1), by applying
+// (z + 1)^h = z^h + 1 to halves of doubling size h.
+static uint32_t pascal(uint32_t v)
+{
+  v ^= (v & 0xaaaaaaaau) >> 1;
+  v ^= (v & 0xccccccccu) >> 2;
+  v ^= (v & 0xf0f0f0f0u) >> 4;
+  v ^= (v & 0xff00ff00u) >> 8;
+  return v ^ ((v & 0xffff0000u) >> 16);
+}
+
+// Upper 24 bits, all exactly representable
+static float to_unit(uint32_t v)
+{
+  return (v >> 8) * (1.0f / 16777216.0f);
+}
+
+uint32_t smpl_seed(uint32_t pix_idx)
+{
+  return hash(pix_idx);
+}
+
+// The scrambles of the Sobol points cancel one reversal each
+void smpl_get2(uint32_t seed, uint32_t idx, uint32_t dim, float *x, float *y)
+{
+  uint32_t s = hash(hash_combine(seed, dim));
+  idx = owen_scramble(idx, hash_combine(s, 0));
+  *x = to_unit(reverse_bits(lk_permute(idx, hash_combine(s, 1))));
+  *y = to_unit(reverse_bits(lk_permute(pascal(idx), hash_combine(s, 2))));
+}
+
+float smpl_get1(uint32_t seed, uint32_t idx, uint32_t dim)
+{
+  uint32_t s = hash(hash_combine(seed, dim));
+  idx = owen_scramble(idx, hash_combine(s, 0));
+  return to_unit(reverse_bits(lk_permute(idx, hash_combine(s, 1))));
+}
@@ -0,0 +1,26 @@
+#ifndef SMPL_H
+#define SMPL_H
+
+#include <stdint.h>
+
+// Owen-scrambled Sobol sampler with hash-based scrambling and shuffling
+// (Burley, https://jcgt.org/published/0009/04/01/). Each dimension is a
+// 2D (0,2) sequence padded with the others by a per dimension shuffle of
+// the sample index, so the samples of a pixel are stratified in every
+// dimension. The scramble seed of a pixel decorrelates it from its
+// neighbours. Results are a pure function of (seed, idx, dim).
+
+// Dimensions of a path in the CPU renderer
+#define SMPL_DIM_PIX  0 // Pixel jitter
+#define SMPL_DIM_LENS 1 // Thin lens disk
+#define SMPL_DIM_BSDF 2 // Bounce b: 2 + 2 * b direction, 3 + 2 * b choice
+
+// Scramble seed of a pixel
+uint32_t  smpl_seed(uint32_t pix_idx);
+
+// Sample idx of dimension dim in [0, 1)^2 and [0, 1)
+void      smpl_get2(uint32_t seed, uint32_t idx, uint32_t dim, float *x,
+            float *y);
+float     smpl_get1(uint32_t seed, uint32_t idx, uint32_t dim);
+
+#endif
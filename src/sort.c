@@ -0,0 +1,41 @@
+#include "sort.h"
+
+#define RADIX_BITS  8
+#define RADIX_SIZE  (1 << RADIX_BITS)
+
+uint32_t sort_float_key(float f)
+{
+  union { float f; uint32_t u; } v = { .f = f };
+  return (v.u & 0x80000000) ? ~v.u : (v.u | 0x80000000);
+}
+
+void sort_radix(uint32_t *keys, uint32_t *vals, uint32_t *tmp_keys,
+    uint32_t *tmp_vals, size_t cnt)
+{
+  // Even number of passes, result ends up in keys/vals again
+  for(uint8_t shift=0; shift<32; shift+=RADIX_BITS) {
+    size_t ofs[RADIX_SIZE] = { 0 };
+    for(size_t i=0; i<cnt; i++)
+      ofs[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+
+    size_t sum = 0;
+    for(size_t i=0; i<RADIX_SIZE; i++) {
+      size_t c = ofs[i];
+      ofs[i] = sum;
+      sum += c;
+    }
+
+    for(size_t i=0; i<cnt; i++) {
+      size_t j = ofs[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+      tmp_keys[j] = keys[i];
+      tmp_vals[j] = vals[i];
+    }
+
+    uint32_t *t = keys;
+    keys = tmp_keys;
+    tmp_keys = t;
+    t = vals;
+    vals = tmp_vals;
+    tmp_vals = t;
+  }
+}
@@ -0,0 +1,15 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maps a float to an unsigned key of the same order
+uint32_t  sort_float_key(float f);
+
+// Stable LSD radix sort of keys and vals by keys. The tmp arrays need space
+// for cnt elements.
+void      sort_radix(uint32_t *keys, uint32_t *vals, uint32_t *tmp_keys,
+            uint32_t *tmp_vals, size_t cnt);
+
+#endif
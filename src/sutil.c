@@ -1,19 +1,278 @@
 #include "sutil.h"
+#include <stdint.h>
+#include "mutil.h"
+#include "fmath.h"
 
+// Heap of the wasm version. Blocks have a header with their size. Small
+// blocks are power of two sized and recycled via one free list per size
+// class. Large blocks are multiples of LARGE_GRAN and kept in a free list
+// sorted by address, neighbors are merged on free. New blocks are taken from
+// the top of the heap, the memory grows once the top reaches its end.
+
+#define PAGE_SIZE     65536
+#define ALIGN         16
+#define MIN_CLASS     5     // 32 bytes incl. header
+#define CLASS_CNT     12    // Up to 64 KB
+#define LARGE_GRAN    4096
+#define MIN_GROW      16    // Pages, i.e. 1 MB
+
+typedef struct block {
+  size_t        size; // Incl. header
+  uint32_t      cls;  // Size class, CLASS_CNT = large
+  struct block  *next; // Free blocks and arena chunks only
+} block;
+
+// Keeps payloads aligned to ALIGN
+#define HDR_SIZE ((sizeof(block) + ALIGN - 1) & ~(size_t)(ALIGN - 1))
+
+struct arena {
+  block   *chunks;  // Most recent first, linked via next of their header
+  size_t  chunk_size;
+  char    *pos;     // NULL until the first alloc
+  char    *end;
+};
+
+// Start of the heap, set by the linker. Overridden by the native heap test.
+#ifndef HEAP_BASE
 extern unsigned char __heap_base;
-static unsigned long heap_pos = (unsigned long)&__heap_base;
+#define HEAP_BASE ((uintptr_t)&__heap_base)
+#endif
 
-void *malloc(size_t size)
+static uintptr_t heap_pos = HEAP_BASE;
+
+static block *free_lists[CLASS_CNT];
+static block *free_large;
+
+static mem_stats stats;
+
+static size_t align(size_t v, size_t a)
 {
-  unsigned long curr = heap_pos;
+  return (v + a - 1) & ~(a - 1);
+}
+
+// Takes size bytes from the top of the heap, growing the memory if needed
+static block *take_top(size_t size)
+{
+  uintptr_t end = __builtin_wasm_memory_size(0) * PAGE_SIZE;
+  if(heap_pos + size > end) {
+    // Grow by at least MIN_GROW pages to keep the number of calls low
+    size_t pages = align(heap_pos + size - end, PAGE_SIZE) / PAGE_SIZE;
+    if(__builtin_wasm_memory_grow(0, pages < MIN_GROW ? MIN_GROW : pages) ==
+        (size_t)-1 && __builtin_wasm_memory_grow(0, pages) == (size_t)-1)
+      return NULL;
+    stats.grow_cnt++;
+  }
+
+  block *b = (block *)heap_pos;
   heap_pos += size;
-  return (void *)curr;
+  stats.heap = heap_pos - HEAP_BASE;
+  return b;
+}
+
+static uint32_t get_class(size_t size)
+{
+  uint32_t c = MIN_CLASS;
+  while(((size_t)1 << c) < size)
+    c++;
+  return c - MIN_CLASS;
+}
+
+static block *alloc_large(size_t size)
+{
+  // First fit, the rest of a larger block stays free
+  for(block **p=&free_large; *p; p=&(*p)->next) {
+    block *b = *p;
+    if(b->size < size)
+      continue;
+    if(b->size - size >= LARGE_GRAN) {
+      block *r = (block *)((char *)b + size);
+      r->size = b->size - size;
+      r->cls = CLASS_CNT;
+      r->next = b->next;
+      *p = r;
+      b->size = size;
+    } else {
+      *p = b->next;
+    }
+    return b;
+  }
+
+  block *b = take_top(size);
+  if(b) {
+    b->size = size;
+    b->cls = CLASS_CNT;
+  }
+  return b;
+}
+
+static void free_large_block(block *b)
+{
+  // Insert sorted by address, link points to the list entry of b
+  block **link = &free_large;
+  block **prev_link = NULL;
+  while(*link && *link < b) {
+    prev_link = link;
+    link = &(*link)->next;
+  }
+  b->next = *link;
+  *link = b;
+
+  // Merge with the neighbors
+  if(b->next && (char *)b + b->size == (char *)b->next) {
+    b->size += b->next->size;
+    b->next = b->next->next;
+  }
+  if(prev_link && (char *)*prev_link + (*prev_link)->size == (char *)b) {
+    (*prev_link)->size += b->size;
+    (*prev_link)->next = b->next;
+    link = prev_link;
+    b = *link;
+  }
+
+  // Hand a free block at the top back to the heap
+  if((uintptr_t)b + b->size == heap_pos) {
+    *link = NULL;
+    heap_pos = (uintptr_t)b;
+    stats.heap = heap_pos - HEAP_BASE;
+  }
+}
+
+void *malloc(size_t size)
+{
+  size_t total = size + HDR_SIZE;
+  block *b;
+  if(total <= (size_t)1 << (MIN_CLASS + CLASS_CNT - 1)) {
+    uint32_t c = get_class(total);
+    b = free_lists[c];
+    if(b) {
+      free_lists[c] = b->next;
+    } else {
+      b = take_top((size_t)1 << (c + MIN_CLASS));
+      if(!b)
+        return NULL;
+      b->size = (size_t)1 << (c + MIN_CLASS);
+      b->cls = c;
+    }
+  } else {
+    b = alloc_large(align(total, LARGE_GRAN));
+    if(!b)
+      return NULL;
+  }
+
+  stats.curr += b->size;
+  stats.peak = stats.curr > stats.peak ? stats.curr : stats.peak;
+  stats.alloc_cnt++;
+  return (char *)b + HDR_SIZE;
 }
 
-__attribute__((optnone))
 void free(void *p)
 {
-  // Empty but do not optimize away
+  if(!p)
+    return;
+
+  block *b = (block *)((char *)p - HDR_SIZE);
+  stats.curr -= b->size;
+  stats.free_cnt++;
+  if(b->cls < CLASS_CNT) {
+    b->next = free_lists[b->cls];
+    free_lists[b->cls] = b;
+  } else {
+    free_large_block(b);
+  }
+}
+
+mem_stats mem_get_stats(void)
+{
+  return stats;
+}
+
+arena *arena_init(size_t chunk_size)
+{
+  arena *a = malloc(sizeof(*a));
+  if(a)
+    *a = (arena){ .chunk_size = chunk_size };
+  return a;
+}
+
+void *arena_alloc(arena *a, size_t size)
+{
+  size = align(size, ALIGN);
+  // No pointer arithmetic on pos before there is a chunk
+  if(a->pos == NULL || size > (size_t)(a->end - a->pos)) {
+    size_t chunk_size = size > a->chunk_size ? size : a->chunk_size;
+    char *chunk = malloc(chunk_size);
+    if(!chunk)
+      return NULL;
+    block *b = (block *)(chunk - HDR_SIZE);
+    b->next = a->chunks;
+    a->chunks = b;
+    a->pos = chunk;
+    a->end = chunk + chunk_size;
+  }
+
+  void *p = a->pos;
+  a->pos += size;
+  return p;
+}
+
+void arena_reset(arena *a)
+{
+  // Keep the most recent chunk, release the others
+  block *b = a->chunks;
+  if(!b)
+    return;
+  block *next = b->next;
+  while(next) {
+    block *n = next->next;
+    free((char *)next + HDR_SIZE);
+    next = n;
+  }
+  b->next = NULL;
+  a->pos = (char *)b + HDR_SIZE;
+  a->end = (char *)b + b->size;
+}
+
+void arena_release(arena *a)
+{
+  arena_reset(a);
+  if(a->chunks)
+    free((char *)a->chunks + HDR_SIZE);
+  free(a);
+}
+
+float sqrtf(float a)
+{
+  return fmath_sqrt(a);
+}
+
+float sinf(float a)
+{
+  return fmath_sin(a);
+}
+
+float cosf(float a)
+{
+  return fmath_cos(a);
+}
+
+float tanf(float a)
+{
+  return fmath_tan(a);
+}
+
+float acosf(float a)
+{
+  return fmath_acos(a);
+}
+
+float atan2f(float y, float x)
+{
+  return fmath_atan2(y, x);
+}
+
+float powf(float base, float exp)
+{
+  return fmath_pow(base, exp);
 }
 
 void *memset(void *dest, int c, size_t cnt)
@@ -3,9 +3,29 @@
 
 #include <stddef.h>
 
+// Heap usage in bytes incl. block headers and size class rounding
+typedef struct mem_stats {
+  size_t  curr;       // Allocated blocks
+  size_t  peak;       // Max of curr
+  size_t  heap;       // Heap top above __heap_base, incl. free blocks
+  size_t  alloc_cnt;
+  size_t  free_cnt;
+  size_t  grow_cnt;   // Calls of memory.grow
+} mem_stats;
+
+// Allocations released all at once, e.g. per scene data
+typedef struct arena arena;
+
 void *malloc(size_t size);
 void free(void *ptr);
 
+mem_stats mem_get_stats(void);
+
+arena *arena_init(size_t chunk_size);
+void *arena_alloc(arena *a, size_t size);
+void arena_reset(arena *a);
+void arena_release(arena *a);
+
 void *memset(void *dest, int c, size_t cnt);
 void *memcpy(void *dest, const void *src, size_t cnt);
 
@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // syscall
+
+#include "sys.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+  #include <sys/syscall.h>
+  #include <linux/perf_event.h>
+#endif
+
+#define MAX_THREAD_CNT 256
+
+typedef struct thread_arg {
+  sys_thread_fn fn;
+  void          *ctx;
+  uint32_t      idx;
+} thread_arg;
+
+double sys_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+uint32_t sys_cpu_cnt(void)
+{
+  long cnt = sysconf(_SC_NPROCESSORS_ONLN);
+  return cnt > 0 ? cnt : 1;
+}
+
+void sys_yield(void)
+{
+  sched_yield();
+}
+
+static void *thread_main(void *p)
+{
+  thread_arg *a = p;
+  a->fn(a->ctx, a->idx);
+  return NULL;
+}
+
+void sys_run_threads(uint32_t cnt, sys_thread_fn fn, void *ctx)
+{
+  pthread_t threads[MAX_THREAD_CNT];
+  thread_arg args[MAX_THREAD_CNT];
+  bool started[MAX_THREAD_CNT];
+
+  cnt = cnt < 1 ? 1 : (cnt > MAX_THREAD_CNT ? MAX_THREAD_CNT : cnt);
+
+  for(uint32_t i=1; i<cnt; i++) {
+    args[i] = (thread_arg){ fn, ctx, i };
+    started[i] = pthread_create(&threads[i], NULL, thread_main, &args[i]) == 0;
+    if(!started[i])
+      fn(ctx, i); // Out of threads, do the work of slot i here
+  }
+
+  fn(ctx, 0);
+
+  for(uint32_t i=1; i<cnt; i++)
+    if(started[i])
+      pthread_join(threads[i], NULL);
+}
+
+void *sys_map_file(const char *path, size_t *size)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return NULL;
+
+  struct stat st;
+  void *addr = NULL;
+  if(fstat(fd, &st) == 0 && st.st_size > 0) {
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED)
+      addr = NULL;
+    *size = st.st_size;
+  }
+
+  // The mapping stays valid
+  close(fd);
+  return addr;
+}
+
+void sys_unmap_file(void *addr, size_t size)
+{
+  munmap(addr, size);
+}
+
+int sys_cache_misses_open(void)
+{
+#ifdef __linux__
+  struct perf_event_attr attr = {
+    .type = PERF_TYPE_HARDWARE, .size = sizeof(attr),
+    .config = PERF_COUNT_HW_CACHE_MISSES,
+    .exclude_kernel = 1, .exclude_hv = 1 };
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+uint64_t sys_cache_misses_read(int fd)
+{
+  uint64_t cnt = 0;
+  if(fd >= 0 && read(fd, &cnt, sizeof(cnt)) != sizeof(cnt))
+    cnt = 0;
+  return cnt;
+}
+
+void sys_cache_misses_close(int fd)
+{
+  if(fd >= 0)
+    close(fd);
+}
+
+// Output of log.c and printf.c
+void log_buf(char *addr, size_t len)
+{
+  fprintf(stderr, "%.*s\n", (int)len, addr);
+}
+
+void _putchar(char c)
+{
+  putchar(c);
+}
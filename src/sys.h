@@ -0,0 +1,27 @@
+#ifndef SYS_H
+#define SYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Platform layer of the native build (threads, timer, file mapping)
+
+typedef void (*sys_thread_fn)(void *ctx, uint32_t thread_idx);
+
+double    sys_time(void); // Seconds
+uint32_t  sys_cpu_cnt(void);
+void      sys_yield(void); // Lets other threads run, e.g. while spinning
+
+// Runs fn on cnt threads (calling thread is thread_idx 0) and joins them
+void      sys_run_threads(uint32_t cnt, sys_thread_fn fn, void *ctx);
+
+// Maps a file read-only and shared with other processes, NULL on failure
+void      *sys_map_file(const char *path, size_t *size);
+void      sys_unmap_file(void *addr, size_t size);
+
+// Hardware cache miss counter of the calling thread, -1 if not available
+int       sys_cache_misses_open(void);
+uint64_t  sys_cache_misses_read(int fd);
+void      sys_cache_misses_close(int fd);
+
+#endif
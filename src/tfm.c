@@ -0,0 +1,116 @@
+#include "tfm.h"
+#include "mutil.h"
+
+tfm tfm_identity()
+{
+  return (tfm){ {
+    { 1.0f, 0.0f, 0.0f, 0.0f },
+    { 0.0f, 1.0f, 0.0f, 0.0f },
+    { 0.0f, 0.0f, 1.0f, 0.0f } } };
+}
+
+tfm tfm_translate(vec3 t)
+{
+  return (tfm){ {
+    { 1.0f, 0.0f, 0.0f, t.x },
+    { 0.0f, 1.0f, 0.0f, t.y },
+    { 0.0f, 0.0f, 1.0f, t.z } } };
+}
+
+tfm tfm_rot_y(float angle)
+{
+  float s = sinf(angle);
+  float c = cosf(angle);
+  return (tfm){ {
+    { c,    0.0f, s,    0.0f },
+    { 0.0f, 1.0f, 0.0f, 0.0f },
+    { -s,   0.0f, c,    0.0f } } };
+}
+
+tfm tfm_scale(float s)
+{
+  return (tfm){ {
+    { s,    0.0f, 0.0f, 0.0f },
+    { 0.0f, s,    0.0f, 0.0f },
+    { 0.0f, 0.0f, s,    0.0f } } };
+}
+
+tfm tfm_mul(tfm a, tfm b)
+{
+  tfm r;
+  for(uint8_t i=0; i<3; i++) {
+    for(uint8_t j=0; j<4; j++) {
+      r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] +
+        a.m[i][2] * b.m[2][j];
+    }
+    r.m[i][3] += a.m[i][3];
+  }
+  return r;
+}
+
+tfm tfm_inv(tfm t)
+{
+  const float (*m)[4] = t.m;
+
+  // Inverse of the 3x3 part via cofactors
+  float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+  float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+  float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+  float inv_det = 1.0f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+  tfm r;
+  r.m[0][0] = c00 * inv_det;
+  r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+  r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+  r.m[1][0] = c01 * inv_det;
+  r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+  r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+  r.m[2][0] = c02 * inv_det;
+  r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+  r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+  // Translation is -inv(M) * t
+  for(uint8_t i=0; i<3; i++)
+    r.m[i][3] = -(r.m[i][0] * m[0][3] + r.m[i][1] * m[1][3] +
+        r.m[i][2] * m[2][3]);
+
+  return r;
+}
+
+vec3 tfm_point(const tfm *t, vec3 p)
+{
+  const float (*m)[4] = t->m;
+  return (vec3){
+    m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+    m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+    m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3] };
+}
+
+vec3 tfm_dir(const tfm *t, vec3 d)
+{
+  const float (*m)[4] = t->m;
+  return (vec3){
+    m[0][0] * d.x + m[0][1] * d.y + m[0][2] * d.z,
+    m[1][0] * d.x + m[1][1] * d.y + m[1][2] * d.z,
+    m[2][0] * d.x + m[2][1] * d.y + m[2][2] * d.z };
+}
+
+vec3 tfm_nrm(const tfm *inv, vec3 n)
+{
+  const float (*m)[4] = inv->m;
+  return vec3_unit((vec3){
+    m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+    m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+    m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z });
+}
+
+aabb tfm_aabb(const tfm *t, aabb a)
+{
+  aabb r = aabb_init();
+  for(uint8_t i=0; i<8; i++)
+    aabb_grow(&r, tfm_point(t, (vec3){
+          (i & 1) ? a.max.x : a.min.x,
+          (i & 2) ? a.max.y : a.min.y,
+          (i & 4) ? a.max.z : a.min.z }));
+  return r;
+}
@@ -0,0 +1,27 @@
+#ifndef TFM_H
+#define TFM_H
+
+#include "vec3.h"
+#include "aabb.h"
+
+// Affine transform, 3x4 matrix in row major order
+typedef struct tfm {
+  float m[3][4];
+} tfm;
+
+tfm   tfm_identity();
+tfm   tfm_translate(vec3 t);
+tfm   tfm_rot_y(float angle);
+tfm   tfm_scale(float s);
+
+// Applies b first, then a
+tfm   tfm_mul(tfm a, tfm b);
+tfm   tfm_inv(tfm t);
+
+vec3  tfm_point(const tfm *t, vec3 p);
+vec3  tfm_dir(const tfm *t, vec3 d);
+// Transforms a normal with the transpose of inv, i.e. by the inverse of inv
+vec3  tfm_nrm(const tfm *inv, vec3 n);
+aabb  tfm_aabb(const tfm *t, aabb a);
+
+#endif
@@ -0,0 +1,145 @@
+#include "tlas.h"
+#include "sutil.h"
+#include "mutil.h"
+#include "bvh.h"
+#include "scn.h"
+#include "ray.h"
+
+tlas *tlas_init(size_t blas_cnt, size_t inst_cnt)
+{
+  tlas *t = malloc(sizeof(*t));
+  t->blases = malloc(blas_cnt * sizeof(*t->blases));
+  t->blas_cnt = 0;
+  t->insts = malloc(inst_cnt * sizeof(*t->insts));
+  t->inst_cnt = 0;
+  t->boxes = malloc(inst_cnt * sizeof(*t->boxes));
+  t->bvh = bvh_init(inst_cnt, NULL);
+  return t;
+}
+
+void tlas_release(tlas *t)
+{
+  bvh_release(t->bvh);
+  free(t->boxes);
+  free(t->insts);
+  free(t->blases);
+  free(t);
+}
+
+uint32_t tlas_add_blas(tlas *t, const scn *s, const bvh *b)
+{
+  t->blases[t->blas_cnt] = (blas){ s, b };
+  return t->blas_cnt++;
+}
+
+uint32_t tlas_add_inst(tlas *t, uint32_t blas_idx, tfm obj_to_world)
+{
+  t->insts[t->inst_cnt].blas_idx = blas_idx;
+  tlas_set_tfm(t, t->inst_cnt, obj_to_world);
+  return t->inst_cnt++;
+}
+
+void tlas_set_tfm(tlas *t, uint32_t inst_idx, tfm obj_to_world)
+{
+  inst *in = &t->insts[inst_idx];
+  in->obj_to_world = obj_to_world;
+  in->world_to_obj = tfm_inv(obj_to_world);
+
+  // Huge objects are outside the tree of the blas, see bvh_intersect
+  const bvh *b = t->blases[in->blas_idx].bvh;
+  aabb box = { b->nodes[0].min, b->nodes[0].max };
+  if(b->huge_cnt > 0)
+    box = aabb_combine(box,
+        (aabb){ b->nodes[b->node_cnt].min, b->nodes[b->node_cnt].max });
+  t->boxes[inst_idx] = tfm_aabb(&obj_to_world, box);
+}
+
+void tlas_build(tlas *t)
+{
+  bvh_create_boxes(t->bvh, t->boxes, t->inst_cnt);
+}
+
+// Traces the object space ray of an instance, r->t is shared as the ray
+// parameter does not change with the transform
+static void intersect_inst(const tlas *t, uint32_t inst_idx, ray *r,
+    uint32_t *hit_inst, uint32_t *hit_obj)
+{
+  const inst *in = &t->insts[inst_idx];
+  const blas *bl = &t->blases[in->blas_idx];
+
+  ray oray;
+  ray_create(&oray, tfm_point(&in->world_to_obj, r->ori),
+      tfm_dir(&in->world_to_obj, r->dir), r->tmin, r->t);
+
+  uint32_t obj_idx;
+  bvh_intersect(bl->bvh, bl->scn, &oray, &obj_idx);
+  if(oray.t < r->t) {
+    r->t = oray.t;
+    *hit_inst = inst_idx;
+    *hit_obj = obj_idx;
+  }
+}
+
+bool tlas_intersect(const tlas *t, ray *r, hit *h, const scn **mat_scn)
+{
+  const bvh *b = t->bvh;
+  uint32_t hit_inst = 0;
+  uint32_t hit_obj = 0;
+
+  // Same traversal as bvh_intersect with instances at the leaves
+  const bvh_node *huge = &b->nodes[b->node_cnt];
+  for(uint32_t i=huge->start_idx; i<huge->start_idx + huge->obj_cnt; i++)
+    intersect_inst(t, b->indices[i], r, &hit_inst, &hit_obj);
+
+  uint32_t stack[BVH_MAX_DEPTH];
+  uint32_t stack_idx = 0;
+  const bvh_node *n = &b->nodes[0];
+
+  while(true) {
+    if(n->obj_cnt > 0) {
+      for(uint32_t i=n->start_idx; i<n->start_idx + n->obj_cnt; i++)
+        intersect_inst(t, b->indices[i], r, &hit_inst, &hit_obj);
+      if(stack_idx == 0)
+        break;
+      n = &b->nodes[stack[--stack_idx]];
+    } else {
+      uint32_t l = n->start_idx;
+      float dist_l = ray_intersect_aabb(r, b->nodes[l].min, b->nodes[l].max);
+      float dist_r = ray_intersect_aabb(r, b->nodes[l + 1].min, b->nodes[l + 1].max);
+
+      bool swap = dist_l > dist_r;
+      float near_dist = swap ? dist_r : dist_l;
+      float far_dist = swap ? dist_l : dist_r;
+      uint32_t near_idx = swap ? l + 1 : l;
+      uint32_t far_idx = swap ? l : l + 1;
+
+      if(near_dist < MAX_DISTANCE) {
+        n = &b->nodes[near_idx];
+        if(far_dist < MAX_DISTANCE)
+          stack[stack_idx++] = far_idx;
+      } else {
+        if(stack_idx == 0)
+          break;
+        n = &b->nodes[stack[--stack_idx]];
+      }
+    }
+  }
+
+  if(r->t >= MAX_DISTANCE)
+    return false;
+
+  // Complete the hit in object space and bring it back to world space
+  const inst *in = &t->insts[hit_inst];
+  const blas *bl = &t->blases[in->blas_idx];
+  ray oray;
+  ray_create(&oray, tfm_point(&in->world_to_obj, r->ori),
+      tfm_dir(&in->world_to_obj, r->dir), r->tmin, r->t);
+  if(!scn_complete_hit(bl->scn, hit_obj, &oray, h))
+    return false;
+
+  h->pos = ray_at(r, r->t);
+  h->nrm = tfm_nrm(&in->world_to_obj, h->nrm);
+  *mat_scn = bl->scn;
+
+  return true;
+}
@@ -0,0 +1,52 @@
+#ifndef TLAS_H
+#define TLAS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "aabb.h"
+#include "tfm.h"
+
+typedef struct scn scn;
+typedef struct bvh bvh;
+typedef struct ray ray;
+typedef struct hit hit;
+
+// Bottom level, geometry and bvh in object space shared by instances
+typedef struct blas {
+  const scn *scn;
+  const bvh *bvh;
+} blas;
+
+typedef struct inst {
+  tfm       obj_to_world;
+  tfm       world_to_obj;
+  uint32_t  blas_idx;
+} inst;
+
+// Top level bvh over instances of bottom level structures
+typedef struct tlas {
+  blas      *blases;
+  size_t    blas_cnt;
+  inst      *insts;
+  size_t    inst_cnt;
+  aabb      *boxes; // World bounds per instance
+  bvh       *bvh;
+} tlas;
+
+tlas      *tlas_init(size_t blas_cnt, size_t inst_cnt);
+// Does not release the scenes and bvhs of the bottom levels
+void      tlas_release(tlas *t);
+
+uint32_t  tlas_add_blas(tlas *t, const scn *s, const bvh *b);
+uint32_t  tlas_add_inst(tlas *t, uint32_t blas_idx, tfm obj_to_world);
+// Moves an instance, takes effect with the next tlas_build
+void      tlas_set_tfm(tlas *t, uint32_t inst_idx, tfm obj_to_world);
+
+void      tlas_build(tlas *t);
+
+// Finds the closest hit in world space. mat_scn receives the scene holding
+// the material of the hit.
+bool      tlas_intersect(const tlas *t, ray *r, hit *h, const scn **mat_scn);
+
+#endif
@@ -1,19 +1,15 @@
 #include "vec3.h"
-#include <stddef.h>
 #include "mutil.h"
 
+// x, y and z are consecutive floats, i.e. a plain indexed access
 void vec3_set(vec3 *v, uint8_t idx, float val)
 {
-  uint8_t ofs = ((idx == 0) ? offsetof(vec3, x) :
-    ((idx == 1) ? offsetof(vec3, y) : offsetof(vec3, z)));
-  *(float *)((unsigned char *)v + ofs) = val;
+  (&v->x)[idx] = val;
 }
 
 float vec3_get(vec3 v, uint8_t idx)
 {
-  uint8_t ofs = ((idx == 0) ? offsetof(vec3, x) :
-    ((idx == 1) ? offsetof(vec3, y) : offsetof(vec3, z)));
-  return *(float *)((unsigned char *)&v + ofs);
+  return (&v.x)[idx];
 }
 
 vec3 vec3_rand()
@@ -27,6 +23,21 @@ vec3 vec3_rand_rng(float start, float end)
   return (vec3){ start + randf() * d, start + randf() * d, start + randf() * d };
 }
 
+// Components drawn in x, y, z order
+vec3 vec3_crand(crand *c)
+{
+  float x = crand_nextf(c);
+  float y = crand_nextf(c);
+  return (vec3){ x, y, crand_nextf(c) };
+}
+
+vec3 vec3_crand_rng(crand *c, float start, float end)
+{
+  vec3 v = vec3_crand(c);
+  float d = end - start;
+  return (vec3){ start + v.x * d, start + v.y * d, start + v.z * d };
+}
+
 vec3 vec3_add(vec3 a, vec3 b)
 {
   return (vec3){ a.x + b.x, a.y + b.y, a.z + b.z };
@@ -52,6 +63,11 @@ vec3 vec3_scale(vec3 v, float s)
   return (vec3){ v.x * s, v.y * s, v.z * s };
 }
 
+float vec3_dot(vec3 a, vec3 b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
 vec3 vec3_cross(vec3 a, vec3 b)
 {
   return (vec3){
@@ -81,6 +97,11 @@ vec3 vec3_max(vec3 a, vec3 b)
   return (vec3){ max(a.x, b.x), max(a.y, b.y), max(a.z, b.z) };
 }
 
+bool vec3_eq(vec3 a, vec3 b)
+{
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
 vec3 vec3_spherical(float theta, float phi)
 {
   return (vec3){ -cosf(phi) * sinf(theta), -cosf(theta), sinf(phi) * sinf(theta) };
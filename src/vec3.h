@@ -1,8 +1,11 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+typedef struct crand crand;
+
 typedef struct vec3 {
   float x, y, z;
 } vec3;
@@ -12,6 +15,8 @@ float vec3_get(vec3 v, uint8_t idx);
 
 vec3  vec3_rand();
 vec3  vec3_rand_rng(float min, float max);
+vec3  vec3_crand(crand *c);
+vec3  vec3_crand_rng(crand *c, float min, float max);
 
 vec3  vec3_add(vec3 a, vec3 b);
 vec3  vec3_sub(vec3 a, vec3 b);
@@ -20,6 +25,7 @@ vec3  vec3_mul(vec3 a, vec3 b);
 vec3  vec3_neg(vec3 v);
 vec3  vec3_scale(vec3 v, float s);
 
+float vec3_dot(vec3 a, vec3 b);
 vec3  vec3_cross(vec3 a, vec3 b);
 vec3  vec3_unit(vec3 v);
 
@@ -28,6 +34,8 @@ float vec3_len(vec3 v);
 vec3  vec3_min(vec3 a, vec3 b);
 vec3  vec3_max(vec3 a, vec3 b);
 
+bool  vec3_eq(vec3 a, vec3 b);
+
 vec3  vec3_spherical(float theta, float phi);
 
 #endif
@@ -0,0 +1,263 @@
+#include "vec4.h"
+#if defined(__SSE__)
+  #include <xmmintrin.h>
+#endif
+
+// Without mutil.h, see vec4.h
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+
+#if defined(__SSE__)
+
+vec4 vec4_set(float x, float y, float z, float w)
+{
+  return _mm_set_ps(w, z, y, x);
+}
+
+vec4 vec4_set1(float v)
+{
+  return _mm_set1_ps(v);
+}
+
+vec4 vec4_load(const float *p)
+{
+  return _mm_loadu_ps(p);
+}
+
+void vec4_store(float *p, vec4 v)
+{
+  _mm_storeu_ps(p, v);
+}
+
+void vec4_store_int(int32_t *p, vec4 v)
+{
+  _mm_storeu_si128((__m128i *)p, _mm_cvttps_epi32(v));
+}
+
+vec4 vec4_add(vec4 a, vec4 b)
+{
+  return _mm_add_ps(a, b);
+}
+
+vec4 vec4_sub(vec4 a, vec4 b)
+{
+  return _mm_sub_ps(a, b);
+}
+
+vec4 vec4_mul(vec4 a, vec4 b)
+{
+  return _mm_mul_ps(a, b);
+}
+
+vec4 vec4_min(vec4 a, vec4 b)
+{
+  return _mm_min_ps(a, b);
+}
+
+vec4 vec4_max(vec4 a, vec4 b)
+{
+  return _mm_max_ps(a, b);
+}
+
+static float get_x(vec4 v)
+{
+  return _mm_cvtss_f32(v);
+}
+
+static float get_y(vec4 v)
+{
+  return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+}
+
+static float get_z(vec4 v)
+{
+  return _mm_cvtss_f32(_mm_movehl_ps(v, v));
+}
+
+// y, z, x, w
+static vec4 rotate(vec4 v)
+{
+  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+#elif defined(__wasm_simd128__)
+
+vec4 vec4_set(float x, float y, float z, float w)
+{
+  return wasm_f32x4_make(x, y, z, w);
+}
+
+vec4 vec4_set1(float v)
+{
+  return wasm_f32x4_splat(v);
+}
+
+vec4 vec4_load(const float *p)
+{
+  return wasm_v128_load(p);
+}
+
+void vec4_store(float *p, vec4 v)
+{
+  wasm_v128_store(p, v);
+}
+
+void vec4_store_int(int32_t *p, vec4 v)
+{
+  wasm_v128_store(p, wasm_i32x4_trunc_sat_f32x4(v));
+}
+
+vec4 vec4_add(vec4 a, vec4 b)
+{
+  return wasm_f32x4_add(a, b);
+}
+
+vec4 vec4_sub(vec4 a, vec4 b)
+{
+  return wasm_f32x4_sub(a, b);
+}
+
+vec4 vec4_mul(vec4 a, vec4 b)
+{
+  return wasm_f32x4_mul(a, b);
+}
+
+// pmin/pmax are the compare and select of min() and max(), i.e. no NaN
+// propagation and a single minps/maxps on x86 hosts
+vec4 vec4_min(vec4 a, vec4 b)
+{
+  return wasm_f32x4_pmin(b, a);
+}
+
+vec4 vec4_max(vec4 a, vec4 b)
+{
+  return wasm_f32x4_pmax(b, a);
+}
+
+static float get_x(vec4 v)
+{
+  return wasm_f32x4_extract_lane(v, 0);
+}
+
+static float get_y(vec4 v)
+{
+  return wasm_f32x4_extract_lane(v, 1);
+}
+
+static float get_z(vec4 v)
+{
+  return wasm_f32x4_extract_lane(v, 2);
+}
+
+static vec4 rotate(vec4 v)
+{
+  return wasm_i32x4_shuffle(v, v, 1, 2, 0, 3);
+}
+
+#else
+
+vec4 vec4_set(float x, float y, float z, float w)
+{
+  return (vec4){ x, y, z, w };
+}
+
+vec4 vec4_set1(float v)
+{
+  return (vec4){ v, v, v, v };
+}
+
+vec4 vec4_load(const float *p)
+{
+  return (vec4){ p[0], p[1], p[2], p[3] };
+}
+
+void vec4_store(float *p, vec4 v)
+{
+  p[0] = v.x;
+  p[1] = v.y;
+  p[2] = v.z;
+  p[3] = v.w;
+}
+
+void vec4_store_int(int32_t *p, vec4 v)
+{
+  p[0] = (int32_t)v.x;
+  p[1] = (int32_t)v.y;
+  p[2] = (int32_t)v.z;
+  p[3] = (int32_t)v.w;
+}
+
+vec4 vec4_add(vec4 a, vec4 b)
+{
+  return (vec4){ a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w };
+}
+
+vec4 vec4_sub(vec4 a, vec4 b)
+{
+  return (vec4){ a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w };
+}
+
+vec4 vec4_mul(vec4 a, vec4 b)
+{
+  return (vec4){ a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w };
+}
+
+vec4 vec4_min(vec4 a, vec4 b)
+{
+  return (vec4){ min(a.x, b.x), min(a.y, b.y), min(a.z, b.z), min(a.w, b.w) };
+}
+
+vec4 vec4_max(vec4 a, vec4 b)
+{
+  return (vec4){ max(a.x, b.x), max(a.y, b.y), max(a.z, b.z), max(a.w, b.w) };
+}
+
+static float get_x(vec4 v)
+{
+  return v.x;
+}
+
+static float get_y(vec4 v)
+{
+  return v.y;
+}
+
+static float get_z(vec4 v)
+{
+  return v.z;
+}
+
+static vec4 rotate(vec4 v)
+{
+  return (vec4){ v.y, v.z, v.x, v.w };
+}
+
+#endif
+
+vec4 vec4_from_vec3(vec3 v)
+{
+  return vec4_set(v.x, v.y, v.z, 0.0f);
+}
+
+vec3 vec4_to_vec3(vec4 v)
+{
+  return (vec3){ get_x(v), get_y(v), get_z(v) };
+}
+
+float vec4_min3(vec4 v)
+{
+  return min(get_x(v), min(get_y(v), get_z(v)));
+}
+
+float vec4_max3(vec4 v)
+{
+  return max(get_x(v), max(get_y(v), get_z(v)));
+}
+
+float vec4_calc_area(vec4 min, vec4 max)
+{
+  // x * y, y * z, z * x
+  vec4 d = vec4_sub(max, min);
+  vec4 p = vec4_mul(d, rotate(d));
+  return get_x(p) + get_y(p) + get_z(p);
+}
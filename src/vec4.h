@@ -0,0 +1,47 @@
+#ifndef VEC4_H
+#define VEC4_H
+
+#include <stdint.h>
+#include "vec3.h"
+
+// Four float vector backing the vec3 and aabb kernels. SSE in the native
+// version, simd128 in the wasm one if built with SIMD=1 (-msimd128), else
+// plain floats. Always 16-byte aligned. Used for xyz with w as padding
+// unless noted, w of loaded values may hold anything.
+
+#if defined(__SSE__)
+  // Same as __m128, the intrinsics headers stay out of the includers since
+  // they clash with mutil.h
+  typedef float vec4 __attribute__((vector_size(16)));
+#elif defined(__wasm_simd128__)
+  #include <wasm_simd128.h>
+  typedef v128_t vec4;
+#else
+  typedef struct vec4 {
+    _Alignas(16) float x;
+    float y, z, w;
+  } vec4;
+#endif
+
+vec4  vec4_set(float x, float y, float z, float w);
+vec4  vec4_set1(float v);
+vec4  vec4_load(const float *p); // Any alignment, reads 4 floats
+void  vec4_store(float *p, vec4 v); // Any alignment
+void  vec4_store_int(int32_t *p, vec4 v); // Truncates, any alignment
+
+vec4  vec4_from_vec3(vec3 v); // w = 0
+vec3  vec4_to_vec3(vec4 v);
+
+vec4  vec4_add(vec4 a, vec4 b);
+vec4  vec4_sub(vec4 a, vec4 b);
+vec4  vec4_mul(vec4 a, vec4 b);
+vec4  vec4_min(vec4 a, vec4 b); // Per lane like min() of mutil.h
+vec4  vec4_max(vec4 a, vec4 b);
+
+float vec4_min3(vec4 v); // Of x, y and z
+float vec4_max3(vec4 v);
+
+// Surface area of the box from min to max like aabb_calc_area
+float vec4_calc_area(vec4 min, vec4 max);
+
+#endif
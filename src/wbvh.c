@@ -0,0 +1,265 @@
+#include "wbvh.h"
+#include <float.h>
+#include <stdbool.h>
+#if defined(__AVX__) || defined(__SSE__)
+  #include <immintrin.h>
+#elif defined(__wasm_simd128__)
+  #include <wasm_simd128.h>
+#endif
+#include "sutil.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "scn.h"
+#include "ray.h"
+
+// Each wide node pops one entry and pushes at most WBVH_WIDTH
+#define STACK_SIZE (BVH_MAX_DEPTH * (WBVH_WIDTH - 1) + 1)
+
+typedef struct entry {
+  uint32_t  start_idx;
+  uint32_t  obj_cnt;
+  float     dist;
+} entry;
+
+static float calc_node_area(const bvh_node *n)
+{
+  return aabb_calc_area((aabb){ n->min, n->max });
+}
+
+// Binary nodes that become the children of a wide node. Opens the interior
+// child with the largest surface area until the node is full.
+static uint32_t collect_children(const bvh *b, uint32_t node_idx,
+    uint32_t *children)
+{
+  const bvh_node *n = &b->nodes[node_idx];
+  if(n->obj_cnt > 0) {
+    // Binary root is a leaf
+    children[0] = node_idx;
+    return 1;
+  }
+
+  children[0] = n->start_idx;
+  children[1] = n->start_idx + 1;
+  uint32_t cnt = 2;
+
+  while(cnt < WBVH_WIDTH) {
+    int32_t best = -1;
+    float best_area = -1.0f;
+    for(uint32_t i=0; i<cnt; i++) {
+      const bvh_node *c = &b->nodes[children[i]];
+      float area = calc_node_area(c);
+      if(c->obj_cnt == 0 && area > best_area) {
+        best = i;
+        best_area = area;
+      }
+    }
+
+    if(best < 0)
+      break;
+
+    uint32_t first = b->nodes[children[best]].start_idx;
+    children[best] = first;
+    children[cnt++] = first + 1;
+  }
+
+  return cnt;
+}
+
+wbvh *wbvh_create(const bvh *b)
+{
+  // Every wide node opens at least one distinct binary interior node
+  size_t max_node_cnt = b->node_cnt / 2 + 1;
+
+  wbvh *w = malloc(sizeof(*w));
+  w->nodes = malloc(max_node_cnt * sizeof(*w->nodes));
+  w->indices = b->indices;
+  w->huge_start = b->nodes[b->node_cnt].start_idx;
+  w->huge_cnt = b->huge_cnt;
+  w->node_cnt = 1;
+
+  // Binary node each wide node is collapsed from, processed breadth first
+  uint32_t *src = malloc(max_node_cnt * sizeof(*src));
+  src[0] = 0;
+
+  for(size_t i=0; i<w->node_cnt; i++) {
+    uint32_t children[WBVH_WIDTH];
+    wbvh_node *n = &w->nodes[i];
+    n->child_cnt = collect_children(b, src[i], children);
+
+    for(uint32_t j=0; j<WBVH_WIDTH; j++) {
+      if(j < n->child_cnt) {
+        const bvh_node *c = &b->nodes[children[j]];
+        n->min_x[j] = c->min.x;
+        n->min_y[j] = c->min.y;
+        n->min_z[j] = c->min.z;
+        n->max_x[j] = c->max.x;
+        n->max_y[j] = c->max.y;
+        n->max_z[j] = c->max.z;
+        n->obj_cnt[j] = c->obj_cnt;
+        if(c->obj_cnt > 0) {
+          n->start_idx[j] = c->start_idx;
+        } else {
+          src[w->node_cnt] = children[j];
+          n->start_idx[j] = w->node_cnt++;
+        }
+      } else {
+        // Unused, masked out by child_cnt
+        n->min_x[j] = n->min_y[j] = n->min_z[j] = 0.0f;
+        n->max_x[j] = n->max_y[j] = n->max_z[j] = 0.0f;
+        n->start_idx[j] = n->obj_cnt[j] = 0;
+      }
+    }
+  }
+
+  free(src);
+
+  return w;
+}
+
+void wbvh_release(wbvh *w)
+{
+  free(w->nodes);
+  free(w);
+}
+
+// Slab test of all children. Returns the mask of children hit and writes
+// their entry distances.
+static uint32_t intersect_children(const wbvh_node *n, const ray *r,
+    float *dist)
+{
+  uint32_t valid = (1u << n->child_cnt) - 1;
+
+#if WBVH_WIDTH == 8 && defined(__AVX__)
+  __m256 ox = _mm256_set1_ps(r->ori.x);
+  __m256 oy = _mm256_set1_ps(r->ori.y);
+  __m256 oz = _mm256_set1_ps(r->ori.z);
+  __m256 ix = _mm256_set1_ps(r->inv_dir.x);
+  __m256 iy = _mm256_set1_ps(r->inv_dir.y);
+  __m256 iz = _mm256_set1_ps(r->inv_dir.z);
+
+  __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n->min_x), ox), ix);
+  __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n->min_y), oy), iy);
+  __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n->min_z), oz), iz);
+  __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n->max_x), ox), ix);
+  __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n->max_y), oy), iy);
+  __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n->max_z), oz), iz);
+
+  __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x),
+        _mm256_min_ps(t0y, t1y)), _mm256_min_ps(t0z, t1z));
+  __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x),
+        _mm256_max_ps(t0y, t1y)), _mm256_max_ps(t0z, t1z));
+
+  __m256 hit = _mm256_and_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ),
+      _mm256_and_ps(_mm256_cmp_ps(tmin, _mm256_set1_ps(r->t), _CMP_LT_OQ),
+        _mm256_cmp_ps(tmax, _mm256_set1_ps(r->tmin), _CMP_GT_OQ)));
+
+  _mm256_storeu_ps(dist, tmin);
+  return _mm256_movemask_ps(hit) & valid;
+#elif WBVH_WIDTH == 4 && defined(__SSE__)
+  __m128 ox = _mm_set1_ps(r->ori.x);
+  __m128 oy = _mm_set1_ps(r->ori.y);
+  __m128 oz = _mm_set1_ps(r->ori.z);
+  __m128 ix = _mm_set1_ps(r->inv_dir.x);
+  __m128 iy = _mm_set1_ps(r->inv_dir.y);
+  __m128 iz = _mm_set1_ps(r->inv_dir.z);
+
+  __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n->min_x), ox), ix);
+  __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n->min_y), oy), iy);
+  __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n->min_z), oz), iz);
+  __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n->max_x), ox), ix);
+  __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n->max_y), oy), iy);
+  __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(n->max_z), oz), iz);
+
+  __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x),
+        _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+  __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x),
+        _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+
+  __m128 hit = _mm_and_ps(_mm_cmple_ps(tmin, tmax),
+      _mm_and_ps(_mm_cmplt_ps(tmin, _mm_set1_ps(r->t)),
+        _mm_cmpgt_ps(tmax, _mm_set1_ps(r->tmin))));
+
+  _mm_storeu_ps(dist, tmin);
+  return _mm_movemask_ps(hit) & valid;
+#elif WBVH_WIDTH == 4 && defined(__wasm_simd128__)
+  v128_t ox = wasm_f32x4_splat(r->ori.x);
+  v128_t oy = wasm_f32x4_splat(r->ori.y);
+  v128_t oz = wasm_f32x4_splat(r->ori.z);
+  v128_t ix = wasm_f32x4_splat(r->inv_dir.x);
+  v128_t iy = wasm_f32x4_splat(r->inv_dir.y);
+  v128_t iz = wasm_f32x4_splat(r->inv_dir.z);
+
+  v128_t t0x = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(n->min_x), ox), ix);
+  v128_t t0y = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(n->min_y), oy), iy);
+  v128_t t0z = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(n->min_z), oz), iz);
+  v128_t t1x = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(n->max_x), ox), ix);
+  v128_t t1y = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(n->max_y), oy), iy);
+  v128_t t1z = wasm_f32x4_mul(wasm_f32x4_sub(wasm_v128_load(n->max_z), oz), iz);
+
+  v128_t tmin = wasm_f32x4_max(wasm_f32x4_max(wasm_f32x4_min(t0x, t1x),
+        wasm_f32x4_min(t0y, t1y)), wasm_f32x4_min(t0z, t1z));
+  v128_t tmax = wasm_f32x4_min(wasm_f32x4_min(wasm_f32x4_max(t0x, t1x),
+        wasm_f32x4_max(t0y, t1y)), wasm_f32x4_max(t0z, t1z));
+
+  v128_t hit = wasm_v128_and(wasm_f32x4_le(tmin, tmax),
+      wasm_v128_and(wasm_f32x4_lt(tmin, wasm_f32x4_splat(r->t)),
+        wasm_f32x4_gt(tmax, wasm_f32x4_splat(r->tmin))));
+
+  wasm_v128_store(dist, tmin);
+  return wasm_i32x4_bitmask(hit) & valid;
+#else
+  uint32_t mask = 0;
+  for(uint32_t i=0; i<n->child_cnt; i++) {
+    dist[i] = ray_intersect_aabb(r,
+        (vec3){ n->min_x[i], n->min_y[i], n->min_z[i] },
+        (vec3){ n->max_x[i], n->max_y[i], n->max_z[i] });
+    if(dist[i] < MAX_DISTANCE)
+      mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+void wbvh_intersect(const wbvh *w, const scn *s, ray *r, uint32_t *obj_idx)
+{
+  entry stack[STACK_SIZE];
+  uint32_t stack_cnt = 0;
+  stack[stack_cnt++] = (entry){ 0, 0, 0.0f };
+
+  // Huge objects first, their hits shorten the ray for the tree
+  if(w->huge_cnt > 0)
+    stack[stack_cnt++] = (entry){ w->huge_start, w->huge_cnt, 0.0f };
+
+  while(stack_cnt > 0) {
+    entry e = stack[--stack_cnt];
+    if(e.dist >= r->t)
+      continue; // Closer hit found meanwhile
+
+    if(e.obj_cnt > 0) {
+      // Leaf, test all objects
+      scn_intersect_objs(s, w->indices, e.start_idx, e.obj_cnt & BVH_CNT_MASK,
+          e.obj_cnt >> BVH_TYPE_SHIFT, r, obj_idx);
+      continue;
+    }
+
+    const wbvh_node *n = &w->nodes[e.start_idx];
+    float dist[WBVH_WIDTH];
+    uint32_t mask = intersect_children(n, r, dist);
+
+    // Sort hit children far to near so the nearest is popped first
+    entry hits[WBVH_WIDTH];
+    uint32_t hit_cnt = 0;
+    while(mask) {
+      uint32_t i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      entry h = { n->start_idx[i], n->obj_cnt[i], dist[i] };
+      uint32_t j = hit_cnt++;
+      for(; j>0 && hits[j - 1].dist < h.dist; j--)
+        hits[j] = hits[j - 1];
+      hits[j] = h;
+    }
+
+    for(uint32_t i=0; i<hit_cnt; i++)
+      stack[stack_cnt++] = hits[i];
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef WBVH_H
+#define WBVH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Wide BVH for CPU traversal, collapsed from a binary bvh. 4 wide uses
+// SSE/wasm simd128 node tests, 8 wide (-DWBVH_WIDTH=8) uses AVX.
+#ifndef WBVH_WIDTH
+  #define WBVH_WIDTH 4
+#endif
+
+typedef struct bvh bvh;
+typedef struct scn scn;
+typedef struct ray ray;
+
+// Child bounds in SoA layout, children 0 to child_cnt - 1 are valid
+typedef struct wbvh_node {
+  float     min_x[WBVH_WIDTH];
+  float     min_y[WBVH_WIDTH];
+  float     min_z[WBVH_WIDTH];
+  float     max_x[WBVH_WIDTH];
+  float     max_y[WBVH_WIDTH];
+  float     max_z[WBVH_WIDTH];
+  uint32_t  start_idx[WBVH_WIDTH]; // obj start or node index
+  uint32_t  obj_cnt[WBVH_WIDTH]; // 0 = interior node
+  uint32_t  child_cnt;
+} wbvh_node;
+
+typedef struct wbvh {
+  size_t          node_cnt;
+  wbvh_node       *nodes;
+  const uint32_t  *indices; // Of the binary bvh
+  uint32_t        huge_start; // Huge objects outside the tree, see bvh
+  uint32_t        huge_cnt;
+} wbvh;
+
+// The binary bvh needs to outlive the wide one
+wbvh  *wbvh_create(const bvh *b);
+void  wbvh_release(wbvh *w);
+
+void  wbvh_intersect(const wbvh *w, const scn *s, ray *r, uint32_t *obj_idx);
+
+#endif
@@ -0,0 +1,100 @@
+// Wasm module of the fmath accuracy test and benchmark, driven by
+// test/fmath.mjs under node (make test-wasm). JS fills the inputs, calls
+// eval and checks the results against its double precision Math.
+
+#include <stdint.h>
+#include "../src/fmath.h"
+
+#define MAX_CNT 65536
+
+typedef enum fn_type {
+  FN_SQRT,
+  FN_SIN,
+  FN_COS,
+  FN_TAN,
+  FN_ACOS,
+  FN_ATAN2,
+  FN_POW
+} fn_type;
+
+static float xs[MAX_CNT];
+static float ys[MAX_CNT];
+static float vs[MAX_CNT];
+
+__attribute__((visibility("default")))
+uint32_t get_max_cnt(void)
+{
+  return MAX_CNT;
+}
+
+__attribute__((visibility("default")))
+float *get_x(void)
+{
+  return xs;
+}
+
+__attribute__((visibility("default")))
+float *get_y(void)
+{
+  return ys;
+}
+
+__attribute__((visibility("default")))
+float *get_v(void)
+{
+  return vs;
+}
+
+// Writes v = fn(x[, y]) for cnt values. Batch variants exist for sqrt, sin,
+// cos and pow (with y[0] as the exponent), returns 0 for the others.
+__attribute__((visibility("default")))
+uint32_t eval(uint32_t fn, uint32_t cnt, uint32_t batch)
+{
+  if(batch) {
+    switch(fn) {
+      case FN_SQRT:
+        fmath_sqrt_n(vs, xs, cnt);
+        return 1;
+      case FN_SIN:
+        fmath_sin_n(vs, xs, cnt);
+        return 1;
+      case FN_COS:
+        fmath_cos_n(vs, xs, cnt);
+        return 1;
+      case FN_POW:
+        fmath_pow_n(vs, xs, ys[0], cnt);
+        return 1;
+      default:
+        return 0;
+    }
+  }
+
+  for(uint32_t i=0; i<cnt; i++) {
+    switch(fn) {
+      case FN_SQRT:
+        vs[i] = fmath_sqrt(xs[i]);
+        break;
+      case FN_SIN:
+        vs[i] = fmath_sin(xs[i]);
+        break;
+      case FN_COS:
+        vs[i] = fmath_cos(xs[i]);
+        break;
+      case FN_TAN:
+        vs[i] = fmath_tan(xs[i]);
+        break;
+      case FN_ACOS:
+        vs[i] = fmath_acos(xs[i]);
+        break;
+      case FN_ATAN2:
+        vs[i] = fmath_atan2(ys[i], xs[i]);
+        break;
+      case FN_POW:
+        vs[i] = fmath_pow(xs[i], ys[i]);
+        break;
+      default:
+        return 0;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,115 @@
+// Accuracy test and benchmark of fmath in wasm, see test/fmath.c. Prints
+// max errors against double precision Math and ns per value like raynin -A,
+// exits with 1 if an error exceeds the bound documented in fmath.h.
+// Usage: node test/fmath.mjs fmathtest.wasm
+
+import { readFileSync } from "node:fs";
+import { performance } from "node:perf_hooks";
+
+const RUNS = 20;
+const GAMMA = 1.0 / 2.2;
+const FN = { SQRT: 0, SIN: 1, COS: 2, TAN: 3, ACOS: 4, ATAN2: 5, POW: 6 };
+
+// Error bounds in ulp of the float result, relative for pow
+const cases = [
+  { name: "sqrt", fn: FN.SQRT, lo: 0, hi: 1e4, bound: 0.5, ref: x => Math.sqrt(x) },
+  { name: "sin", fn: FN.SIN, lo: -Math.PI, hi: Math.PI, bound: 1.5, ref: x => Math.sin(x) },
+  { name: "sin", fn: FN.SIN, lo: -1e4, hi: 1e4, bound: 25, ref: x => Math.sin(x) },
+  { name: "cos", fn: FN.COS, lo: -Math.PI, hi: Math.PI, bound: 1.5, ref: x => Math.cos(x) },
+  { name: "cos", fn: FN.COS, lo: -1e4, hi: 1e4, bound: 25, ref: x => Math.cos(x) },
+  { name: "tan", fn: FN.TAN, lo: -1.5, hi: 1.5, bound: 3.5, ref: x => Math.tan(x) },
+  { name: "tan", fn: FN.TAN, lo: -1e4, hi: 1e4, bound: 20, ref: x => Math.tan(x) },
+  { name: "acos", fn: FN.ACOS, lo: -1, hi: 1, bound: 2, ref: x => Math.acos(x) },
+  { name: "atan2", fn: FN.ATAN2, lo: -10, hi: 10, ylo: -10, yhi: 10, bound: 3.5,
+    ref: (x, y) => Math.atan2(y, x) },
+  { name: "pow", fn: FN.POW, lo: 0, hi: 1, ylo: GAMMA, yhi: GAMMA, bound: 1e-6, rel: true,
+    ref: (x, y) => Math.pow(x, y) },
+  { name: "pow", fn: FN.POW, lo: 0.1, hi: 10, ylo: -4, yhi: 4, bound: 1e-6, rel: true,
+    ref: (x, y) => Math.pow(x, y) } ];
+
+// Mulberry32, fixed seed for reproducible inputs
+let seed = 42;
+function rand()
+{
+  seed = (seed + 0x6d2b79f5) | 0;
+  let t = Math.imul(seed ^ (seed >>> 15), 1 | seed);
+  t = (t + Math.imul(t ^ (t >>> 7), 61 | t)) ^ t;
+  return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+}
+
+const bits = new Uint32Array(1);
+const bitsf = new Float32Array(bits.buffer);
+
+// Distance to the next float of |v|
+function ulp(v)
+{
+  bitsf[0] = Math.abs(v);
+  const f = bitsf[0];
+  bits[0]++;
+  return bitsf[0] - f;
+}
+
+function calcErr(c, v, ref)
+{
+  const d = Math.abs(v - ref);
+  return c.rel ? (ref != 0 ? d / Math.abs(ref) : d) : d / ulp(ref);
+}
+
+// Best of RUNS in ns per value
+function bench(wa, c, cnt, batch)
+{
+  let best = Infinity;
+  for(let r=0; r<RUNS; r++) {
+    const start = performance.now();
+    wa.eval(c.fn, cnt, batch);
+    best = Math.min(best, performance.now() - start);
+  }
+  return best * 1e6 / cnt;
+}
+
+const { instance } = await WebAssembly.instantiate(readFileSync(process.argv[2]), { env: {} });
+const wa = instance.exports;
+const cnt = wa.get_max_cnt();
+const mem = () => wa.memory.buffer;
+const x = new Float32Array(mem(), wa.get_x(), cnt);
+const y = new Float32Array(mem(), wa.get_y(), cnt);
+const v = new Float32Array(mem(), wa.get_v(), cnt);
+
+let failed = false;
+for(const c of cases) {
+  for(let i=0; i<cnt; i++) {
+    x[i] = c.lo + rand() * (c.hi - c.lo);
+    y[i] = c.ylo === undefined ? 0 : c.ylo + rand() * (c.yhi - c.ylo);
+  }
+
+  wa.eval(c.fn, cnt, 0);
+  let err = 0;
+  let absErr = 0;
+  for(let i=0; i<cnt; i++) {
+    const ref = c.ref(x[i], y[i]);
+    err = Math.max(err, calcErr(c, v[i], ref));
+    absErr = Math.max(absErr, Math.abs(v[i] - ref));
+  }
+  const scalar = Float32Array.from(v);
+  let line = `fmath ${c.name} [${+c.lo.toPrecision(6)}, ${+c.hi.toPrecision(6)}]: max err ${err.toPrecision(3)}` +
+    ` ${c.rel ? "rel" : "ulp"}, abs ${absErr.toPrecision(3)},` +
+    ` ${bench(wa, c, cnt, 0).toFixed(2)} ns`;
+
+  // Batch pow takes y[0] for all, same as the constant exponent of the case
+  if(wa.eval(c.fn, cnt, 1) && (c.fn != FN.POW || c.ylo == c.yhi)) {
+    let diff = 0;
+    for(let i=0; i<cnt; i++) {
+      err = Math.max(err, calcErr(c, v[i], c.ref(x[i], y[i])));
+      diff = Math.max(diff, Math.abs(v[i] - scalar[i]) / ulp(scalar[i]));
+    }
+    line += `, batch ${bench(wa, c, cnt, 1).toFixed(2)} ns, ${diff.toPrecision(3)} ulp from scalar`;
+  }
+
+  if(err > c.bound) {
+    line += ` EXCEEDS ${c.bound}`;
+    failed = true;
+  }
+  console.log(line);
+}
+
+process.exit(failed ? 1 : 0);
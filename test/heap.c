@@ -0,0 +1,221 @@
+// Native test of the wasm heap of sutil.c. The wasm builtins are mapped to a
+// simulated linear memory and the heap functions are renamed to not replace
+// the ones of libc. Random allocations of small and large blocks are filled
+// with a pattern that is checked on free. Arena allocations are checked the
+// same way before a reset or release.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_PAGE_SIZE 65536
+#define SIM_MAX_PAGES 4096  // 256 MB
+#define SIM_INIT_PAGES 16
+
+static _Alignas(SIM_PAGE_SIZE) unsigned char
+  sim_mem[SIM_MAX_PAGES * SIM_PAGE_SIZE];
+static size_t sim_pages = SIM_INIT_PAGES;
+
+// Page counts are absolute, like addresses in wasm linear memory
+static size_t sim_memory_size(void)
+{
+  return (uintptr_t)sim_mem / SIM_PAGE_SIZE + sim_pages;
+}
+
+static size_t sim_memory_grow(size_t pages)
+{
+  if(sim_pages + pages > SIM_MAX_PAGES)
+    return (size_t)-1;
+  size_t prev = sim_pages;
+  sim_pages += pages;
+  return prev;
+}
+
+#define __builtin_wasm_memory_size(m) sim_memory_size()
+#define __builtin_wasm_memory_grow(m, p) sim_memory_grow(p)
+#define HEAP_BASE ((uintptr_t)sim_mem)
+
+#define malloc  heap_malloc
+#define free    heap_free
+#define memset  heap_memset
+#define memcpy  heap_memcpy
+#define sqrtf   heap_sqrtf
+#define sinf    heap_sinf
+#define cosf    heap_cosf
+#define tanf    heap_tanf
+#define acosf   heap_acosf
+#define atan2f  heap_atan2f
+#define powf    heap_powf
+
+#include "../src/sutil.c"
+
+#define SLOT_CNT  4000
+#define OP_CNT    400000
+#define LARGE_MAX 300000  // Bytes, i.e. large blocks across several grows
+#define SMALL_MAX 200
+#define ARENA_CHUNK 65536
+
+typedef struct slot {
+  unsigned char *p;
+  size_t        size;
+} slot;
+
+static slot slots[SLOT_CNT];
+
+static unsigned char pattern(size_t slot_idx, size_t i)
+{
+  return (unsigned char)(slot_idx * 31 + i);
+}
+
+static bool check_free(size_t idx)
+{
+  slot *s = &slots[idx];
+  for(size_t i=0; i<s->size; i++) {
+    if(s->p[i] != pattern(idx, i)) {
+      printf("heap: slot %zu corrupted at byte %zu of %zu\n", idx, i, s->size);
+      return false;
+    }
+  }
+  free(s->p);
+  s->p = NULL;
+  return true;
+}
+
+static bool check_alloc(size_t idx, size_t size)
+{
+  slot *s = &slots[idx];
+  s->p = malloc(size);
+  s->size = size;
+  if(!s->p) {
+    printf("heap: out of memory for %zu bytes\n", size);
+    return false;
+  }
+  if((uintptr_t)s->p % ALIGN != 0) {
+    printf("heap: %zu bytes misaligned at %p\n", size, (void *)s->p);
+    return false;
+  }
+  if(s->p < sim_mem || s->p + size > sim_mem + sim_pages * SIM_PAGE_SIZE) {
+    printf("heap: %zu bytes outside the memory at %p\n", size, (void *)s->p);
+    return false;
+  }
+  for(size_t i=0; i<size; i++)
+    s->p[i] = pattern(idx, i);
+  return true;
+}
+
+// Fills the slots from the arena, some allocations exceed the chunk size
+static bool check_arena_alloc(arena *a)
+{
+  for(size_t i=0; i<SLOT_CNT; i++) {
+    slot *s = &slots[i];
+    s->size = i % 64 == 0 ? 2 * ARENA_CHUNK : i % SMALL_MAX;
+    s->p = arena_alloc(a, s->size);
+    if(!s->p || (uintptr_t)s->p % ALIGN != 0) {
+      printf("heap: arena alloc of %zu bytes failed or misaligned\n", s->size);
+      return false;
+    }
+    for(size_t j=0; j<s->size; j++)
+      s->p[j] = pattern(i, j);
+  }
+
+  // Allocations do not overlap
+  for(size_t i=0; i<SLOT_CNT; i++) {
+    slot *s = &slots[i];
+    for(size_t j=0; j<s->size; j++) {
+      if(s->p[j] != pattern(i, j)) {
+        printf("heap: arena slot %zu corrupted at byte %zu\n", i, j);
+        return false;
+      }
+    }
+    s->p = NULL;
+  }
+  return true;
+}
+
+// Reset keeps one chunk and gives the others back, release all of them
+static bool check_arena(void)
+{
+  mem_stats st = mem_get_stats();
+  size_t curr = st.curr;
+  size_t grows = 0;
+  arena *a = arena_init(ARENA_CHUNK);
+  for(uint32_t r=0; r<3; r++) {
+    if(!check_arena_alloc(a))
+      return false;
+    arena_reset(a);
+    st = mem_get_stats();
+    if(st.curr - curr > 2 * ARENA_CHUNK + 2 * LARGE_GRAN) {
+      printf("heap: %zu bytes still used after arena reset\n", st.curr - curr);
+      return false;
+    }
+    if(r == 2 && st.grow_cnt != grows) {
+      printf("heap: arena grew %zu times after reset\n", st.grow_cnt - grows);
+      return false;
+    }
+    grows = st.grow_cnt;
+  }
+
+  arena_release(a);
+  st = mem_get_stats();
+  if(st.curr != curr || st.alloc_cnt != st.free_cnt) {
+    printf("heap: %zu bytes still used after arena release\n", st.curr - curr);
+    return false;
+  }
+  return true;
+}
+
+int main(void)
+{
+  crand c = crand_init(42, 0);
+
+  // Random frees and allocs, 1/8 of them large blocks
+  for(uint32_t i=0; i<OP_CNT; i++) {
+    size_t idx = crand_next(&c) % SLOT_CNT;
+    bool ok;
+    if(slots[idx].p)
+      ok = check_free(idx);
+    else
+      ok = check_alloc(idx, crand_next(&c) % 8 == 0 ?
+          crand_next(&c) % LARGE_MAX : crand_next(&c) % SMALL_MAX);
+    if(!ok)
+      return 1;
+  }
+
+  mem_stats st = mem_get_stats();
+  printf("heap: %u ops, %zu bytes peak, %zu heap, %zu grows\n", OP_CNT,
+      st.peak, st.heap, st.grow_cnt);
+
+  for(size_t i=0; i<SLOT_CNT; i++)
+    if(slots[i].p && !check_free(i))
+      return 1;
+
+  st = mem_get_stats();
+  if(st.curr != 0 || st.alloc_cnt != st.free_cnt) {
+    printf("heap: %zu bytes still used, %zu allocs, %zu frees\n", st.curr,
+        st.alloc_cnt, st.free_cnt);
+    return 1;
+  }
+
+  // Same allocs after a release reuse the memory, e.g. of a rebuilt scene
+  size_t grows = 0;
+  for(uint32_t r=0; r<2; r++) {
+    for(size_t i=0; i<SLOT_CNT; i++)
+      if(!check_alloc(i, i % 8 == 0 ? LARGE_MAX / 4 : SMALL_MAX))
+        return 1;
+    for(size_t i=0; i<SLOT_CNT; i++)
+      if(!check_free(i))
+        return 1;
+    st = mem_get_stats();
+    if(r == 1 && st.grow_cnt != grows) {
+      printf("heap: grew %zu times on reuse\n", st.grow_cnt - grows);
+      return 1;
+    }
+    grows = st.grow_cnt;
+  }
+
+  if(!check_arena())
+    return 1;
+
+  printf("heap: ok\n");
+  return 0;
+}
@@ -66,6 +66,14 @@ const SHAPE_TYPE_BOX = 2u;
 const SHAPE_TYPE_CYLINDER = 3u;
 const SHAPE_TYPE_QUAD = 4u;
 const SHAPE_TYPE_MESH = 5u;
+// Baked quad of scn_bake, one vec4f per line:
+// (q, nrm.x), (u, nrm.y), (v, nrm.z), (wu, dot(nrm, q)), (wv, 0)
+// with a = dot(p - q, wu) and b = dot(p - q, wv) of points p on the plane
+const SHAPE_TYPE_QUAD_BAKED = 6u;
+
+// Leaf shape type in the top bits of objCount of typed builds, 0 if mixed
+const BVH_TYPE_SHIFT = 29u;
+const BVH_CNT_MASK = (1u << BVH_TYPE_SHIFT) - 1u;
 
 const MAT_TYPE_LAMBERT = 1u;
 const MAT_TYPE_METAL = 2u;
@@ -77,12 +85,11 @@ const vertexPos = array<vec2f, 4u>(vec2f(-1.0, 1.0), vec2f(-1.0), vec2f(1.0), ve
 
 @group(0) @binding(0) var<uniform> globals: Global;
 @group(0) @binding(1) var<storage, read> bvhNodes: array<BvhNode>;
-@group(0) @binding(2) var<storage, read> indices: array<u32>;
-@group(0) @binding(3) var<storage, read> objects: array<Object>;
-@group(0) @binding(4) var<storage, read> shapes: array<vec4f>;
-@group(0) @binding(5) var<storage, read> materials: array<vec4f>;
-@group(0) @binding(6) var<storage, read_write> buffer: array<vec4f>;
-@group(0) @binding(7) var<storage, read_write> image: array<vec4f>;
+@group(0) @binding(2) var<storage, read> objects: array<Object>; // In BVH leaf order
+@group(0) @binding(3) var<storage, read> shapes: array<vec4f>;
+@group(0) @binding(4) var<storage, read> materials: array<vec4f>;
+@group(0) @binding(5) var<storage, read_write> buffer: array<vec4f>;
+@group(0) @binding(6) var<storage, read_write> image: array<vec4f>;
 
 var<private> nodeStack: array<u32, 32>; // Fixed size
 var<private> rngState: u32;
@@ -219,6 +226,31 @@ fn intersectQuad(ray: Ray, q: vec3f, u: vec3f, v: vec3f) -> f32
   return select(t, MAX_DISTANCE, a < 0.0 || 1.0 < a || b < 0.0 || 1.0 < b);
 }
 
+fn intersectQuadBaked(ray: Ray, ofs: u32) -> f32
+{
+  let l0 = shapes[ofs];
+  let l1 = shapes[ofs + 1u];
+  let l2 = shapes[ofs + 2u];
+  let l3 = shapes[ofs + 3u];
+  let nrm = vec3f(l0.w, l1.w, l2.w);
+  let denom = dot(nrm, ray.dir);
+
+  if(abs(denom) < EPSILON) {
+    return MAX_DISTANCE;
+  }
+
+  let t = (l3.w - dot(nrm, ray.ori)) / denom;
+  if(t < ray.tmin || t > ray.t) {
+    return MAX_DISTANCE;
+  }
+
+  let planar = ray.ori + t * ray.dir - l0.xyz;
+  let a = dot(planar, l3.xyz);
+  let b = dot(planar, shapes[ofs + 4u].xyz);
+
+  return select(t, MAX_DISTANCE, a < 0.0 || 1.0 < a || b < 0.0 || 1.0 < b);
+}
+
 fn completeHitQuad(ray: Ray, q: vec3f, u: vec3f, v: vec3f, h: ptr<function, Hit>)
 {
   (*h).pos = ray.ori + ray.t * ray.dir;
@@ -362,7 +394,7 @@ fn evalMaterial(in: Ray, h: Hit, attenuation: ptr<function, vec3f>, emission: pt
 
 fn intersectObject(ray: Ray, objIndex: u32) -> f32
 {
-  let obj = &objects[indices[objIndex]];
+  let obj = &objects[objIndex];
   let data = shapes[(*obj).shapeOfs];
   
   switch((*obj).shapeType) {
@@ -374,19 +406,57 @@ fn intersectObject(ray: Ray, objIndex: u32) -> f32
       let v = shapes[(*obj).shapeOfs + 2u];
       return intersectQuad(ray, data.xyz, u.xyz, v.xyz);
     }
+    case SHAPE_TYPE_QUAD_BAKED: {
+      return intersectQuadBaked(ray, (*obj).shapeOfs);
+    }
     default: {
       return ray.t;
     }
   }
 }
 
-fn intersectObjects(ray: ptr<function, Ray>, objStartIndex: u32, objCount: u32, objId: ptr<function, u32>)
+fn intersectObjects(ray: ptr<function, Ray>, objStartIndex: u32, objCountType: u32, objId: ptr<function, u32>)
 {
-  for(var i=objStartIndex; i<objStartIndex + objCount; i++) {
-    let currDist = intersectObject(*ray, i);
-    if(currDist < (*ray).t) {
-      (*ray).t = currDist;
-      *objId = i;
+  // Loop per shape type for leaves of a single type
+  let objEndIndex = objStartIndex + (objCountType & BVH_CNT_MASK);
+  switch(objCountType >> BVH_TYPE_SHIFT) {
+    case SHAPE_TYPE_SPHERE: {
+      for(var i=objStartIndex; i<objEndIndex; i++) {
+        let data = shapes[objects[i].shapeOfs];
+        let currDist = intersectSphere(*ray, data.xyz, data.w);
+        if(currDist < (*ray).t) {
+          (*ray).t = currDist;
+          *objId = i;
+        }
+      }
+    }
+    case SHAPE_TYPE_QUAD: {
+      for(var i=objStartIndex; i<objEndIndex; i++) {
+        let shapeOfs = objects[i].shapeOfs;
+        let currDist = intersectQuad(*ray, shapes[shapeOfs].xyz, shapes[shapeOfs + 1u].xyz, shapes[shapeOfs + 2u].xyz);
+        if(currDist < (*ray).t) {
+          (*ray).t = currDist;
+          *objId = i;
+        }
+      }
+    }
+    case SHAPE_TYPE_QUAD_BAKED: {
+      for(var i=objStartIndex; i<objEndIndex; i++) {
+        let currDist = intersectQuadBaked(*ray, objects[i].shapeOfs);
+        if(currDist < (*ray).t) {
+          (*ray).t = currDist;
+          *objId = i;
+        }
+      }
+    }
+    default: {
+      for(var i=objStartIndex; i<objEndIndex; i++) {
+        let currDist = intersectObject(*ray, i);
+        if(currDist < (*ray).t) {
+          (*ray).t = currDist;
+          *objId = i;
+        }
+      }
     }
   }
 }
@@ -397,6 +467,10 @@ fn intersectScene(ray: ptr<function, Ray>, hit: ptr<function, Hit>) -> bool
   
   //intersectObjects(ray, 0, arrayLength(&objects), &objId);
 
+  // Huge objects outside the tree (last node), their hits shorten the ray
+  let hugeNode = &bvhNodes[arrayLength(&bvhNodes) - 1u];
+  intersectObjects(ray, (*hugeNode).startIndex, (*hugeNode).objCount, &objId);
+
   var nodeIndex = 0u;
   var nodeStackIndex = 0u;
 
@@ -444,7 +518,7 @@ fn intersectScene(ray: ptr<function, Ray>, hit: ptr<function, Hit>) -> bool
   }
 
   if((*ray).t < MAX_DISTANCE) {
-    let obj = &objects[indices[objId]];
+    let obj = &objects[objId];
     let data = shapes[(*obj).shapeOfs];
     switch((*obj).shapeType) {
       case SHAPE_TYPE_SPHERE: {
@@ -455,6 +529,12 @@ fn intersectScene(ray: ptr<function, Ray>, hit: ptr<function, Hit>) -> bool
         let v = shapes[(*obj).shapeOfs + 2u];
         completeHitQuad(*ray, data.xyz, u.xyz, v.xyz, hit);
       }
+      case SHAPE_TYPE_QUAD_BAKED: {
+        let l1 = shapes[(*obj).shapeOfs + 1u];
+        let l2 = shapes[(*obj).shapeOfs + 2u];
+        (*hit).pos = (*ray).ori + (*ray).t * (*ray).dir;
+        (*hit).nrm = vec3f(data.w, l1.w, l2.w);
+      }
       case SHAPE_TYPE_MESH: {
         return false;
       }